@@ -30,7 +30,7 @@ typedef struct {
 AlError hm_band_init(HmBand **band);
 void hm_band_free(HmBand *band);
 
-void hm_band_set_sample_rate(HmBand *band, int sampleRate);
+AlError hm_band_set_sample_rate(HmBand *band, int sampleRate);
 
 HmLib *hm_band_get_lib(HmBand *band);
 HmSeq *hm_band_get_seq(HmBand *band);
@@ -40,6 +40,15 @@ AlError hm_band_set_channel_synth(HmBand *band, int channel, const HmSynthType *
 
 const char **hm_band_get_channel_params(HmBand *band, int channel, int *numParams);
 float hm_band_get_channel_param(HmBand *band, int channel, int param);
+int hm_band_get_channel_num_patches(HmBand *band, int channel);
+int hm_band_get_channel_patch(HmBand *band, int channel);
+AlError hm_band_set_channel_patch(HmBand *band, int channel, int patch);
+AlError hm_band_set_channel_param(HmBand *band, int channel, int param, float value);
+int hm_band_get_channel_polyphony(HmBand *band, int channel);
+AlError hm_band_set_channel_polyphony(HmBand *band, int channel, int voices);
+
+/* Has the channel's synth load from path, for synths that play from files */
+AlError hm_band_load_channel(HmBand *band, int channel, const char *path);
 
 void hm_band_run(HmBand *band, float *buffer, uint64_t numSamples);
 
@@ -11,5 +11,6 @@
 
 AlError sine_wave_register(HmBand *band);
 AlError mda_dx10_register(HmBand *band);
+AlError sampler_register(HmBand *band);
 
 #endif
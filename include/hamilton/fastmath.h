@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_FASTMATH_H
+#define _HAMILTON_FASTMATH_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Approximations to the libm functions synths use when starting notes and
+ * working out coefficients. The errors given are the largest found against
+ * double precision libm in a sweep of 40 million points over each range.
+ *
+ * Against glibc, tan takes about half the time of tanf and exp2 two thirds
+ * that of powf(2, x), but sin, cos and exp are a little slower than
+ * sinf, cosf and expf, which are already fast there. They are here for
+ * libms that are not, and for tan to build on.
+ */
+
+/* Frequencies in Hz of MIDI notes 0 to 127, with A4 (69) at 440 */
+extern const float hm_note_freqs[128];
+
+static inline float hm_note_to_freq(int note)
+{
+	return hm_note_freqs[(note < 0) ? 0 : (note > 127) ? 127 : note];
+}
+
+/* 2^x, clamped to [-126, 127]. Relative error under 2.5e-7 */
+static inline float hm_fast_exp2(float x)
+{
+	if (x < -126.0f) {
+		x = -126.0f;
+	} else if (x > 127.0f) {
+		x = 127.0f;
+	}
+
+	float r = x + 0.5f;
+	int i = (int)r;
+	if (r < (float)i) {
+		i--;
+	}
+
+	float f = x - (float)i;
+	float p = 1.0f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f +
+		f * (0.00961812911f + f * (0.00133335581f + f * 0.000154035304f)))));
+
+	uint32_t bits = (uint32_t)(i + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+
+	return p * scale;
+}
+
+/* e^x, for x in [-87, 88]. Relative error under 2.5e-7 * (1 + |x|) */
+static inline float hm_fast_exp(float x)
+{
+	return hm_fast_exp2(x * 1.44269504f);
+}
+
+/*
+ * Reduces x to [-pi, pi]. Two pi is split into a short part, which n
+ * multiplies exactly, and the rest, to keep precision.
+ */
+static inline float hm_fast_reduce(float x)
+{
+	float k = x * 0.159154943f;
+	int n = (int)(k + ((k < 0.0f) ? -0.5f : 0.5f));
+
+	return (x - (float)n * 6.28125f) - (float)n * 0.00193530718f;
+}
+
+/* sin(x). Absolute error under 2.5e-7 for |x| < 1000 */
+static inline float hm_fast_sin(float x)
+{
+	const float PI = 3.14159265f;
+	const float HALF_PI = 1.57079633f;
+
+	x = hm_fast_reduce(x);
+	if (x > HALF_PI) {
+		x = PI - x;
+	} else if (x < -HALF_PI) {
+		x = -PI - x;
+	}
+
+	float xx = x * x;
+	return x * (1.0f + xx * (-1.0f / 6 + xx * (1.0f / 120 + xx * (-1.0f / 5040 +
+		xx * (1.0f / 362880 + xx * (-1.0f / 39916800))))));
+}
+
+/*
+ * cos(x). Absolute error under 3e-7 for |x| < 1000. It has its own series,
+ * rather than shifting sin, so it is as good as cosf near one, where
+ * oscillators built on 2cos(w) are most sensitive.
+ */
+static inline float hm_fast_cos(float x)
+{
+	const float PI = 3.14159265f;
+	const float HALF_PI = 1.57079633f;
+
+	x = hm_fast_reduce(x);
+
+	float sign = 1.0f;
+	if (x > HALF_PI) {
+		x = PI - x;
+		sign = -1.0f;
+	} else if (x < -HALF_PI) {
+		x = -PI - x;
+		sign = -1.0f;
+	}
+
+	float xx = x * x;
+	return sign * (1.0f + xx * (-1.0f / 2 + xx * (1.0f / 24 + xx * (-1.0f / 720 +
+		xx * (1.0f / 40320 + xx * (-1.0f / 3628800 + xx * (1.0f / 479001600)))))));
+}
+
+/* tan(x) for x in [0, pi/2). Relative error under 1e-5 up to 0.49 pi */
+static inline float hm_fast_tan(float x)
+{
+	return hm_fast_sin(x) / hm_fast_cos(x);
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_FILTERS_H
+#define _HAMILTON_FILTERS_H
+
+#include "hamilton/voices.h"
+
+static const int HM_FILTER_LANES = 4;
+
+/*
+ * A bank of low-pass filters, one per voice, for synths to embed alongside
+ * their HmVoices. Each is a 12dB/octave state-variable filter in trapezoidal
+ * form, which stays stable however fast its cutoff moves.
+ *
+ * State is kept as one array per field, and the filters run
+ * HM_FILTER_LANES voices at a time, so filtering costs grow with the number
+ * of lane groups rather than voices. Input and output for a group are
+ * interleaved by voice, with sample n of lane l at
+ * n * HM_FILTER_LANES + l.
+ */
+typedef struct {
+	float a1[HM_MAX_VOICES], a2[HM_MAX_VOICES], a3[HM_MAX_VOICES];
+	float ic1[HM_MAX_VOICES], ic2[HM_MAX_VOICES];
+} HmFilterBank;
+
+/* Clears a voice's filter state, keeping its cutoff */
+void hm_filters_reset(HmFilterBank *filters, int voice);
+
+/* Sets the cutoff in Hz, clamped to just below Nyquist */
+void hm_filters_set_cutoff(HmFilterBank *filters, int voice, float cutoff, float sampleRate);
+
+/* Copies a voice's filter, for an HmVoices move callback */
+void hm_filters_move(HmFilterBank *filters, int from, int to);
+
+/*
+ * Filters length samples for the voices [first, first + HM_FILTER_LANES).
+ * first must be a multiple of HM_FILTER_LANES, and input may be output.
+ */
+void hm_filters_process(HmFilterBank *filters, int first, const float *input, float *output, int length);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_PROJECT_H
+#define _HAMILTON_PROJECT_H
+
+#include "albase/common.h"
+#include "hamilton/band.h"
+
+/*
+ * Binary projects hold the channel synths, their current patch and params,
+ * the tempo map, automation lanes and the sequence in its sorted playback
+ * layout. Files are written in the native byte order and struct layout, and
+ * are loaded by mapping them straight into the committed sequence.
+ */
+AlError hm_project_save(HmBand *band, const char *path);
+AlError hm_project_load(HmBand *band, const char *path);
+
+#endif
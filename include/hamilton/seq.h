@@ -12,7 +12,16 @@
 
 #include "albase/common.h"
 
-static const float HM_SEQ_TICK_RATE = 1000.0f;
+/*
+ * Sequence times are in ticks, HM_SEQ_PPQ to the quarter note. Until the
+ * first tempo change the sequence runs at HM_SEQ_DEFAULT_BPM, which makes a
+ * tick one millisecond. Ticks are placed at samples up to 2^40, over 66 days
+ * at 192kHz; anything later is held at that sample.
+ */
+static const int HM_SEQ_PPQ = 500;
+static const float HM_SEQ_DEFAULT_BPM = 120.0f;
+static const float HM_SEQ_MIN_BPM = 1.0f;
+static const float HM_SEQ_MAX_BPM = 1000.0f;
 
 typedef struct HmSeq HmSeq;
 
@@ -33,6 +42,7 @@ typedef struct {
 		struct {
 			int num;
 			float velocity;
+			uint32_t length;
 		} note;
 		float pitch;
 		struct {
@@ -51,6 +61,57 @@ typedef struct {
 	float velocity;
 } HmNoteData;
 
+typedef struct {
+	int channel;
+	uint32_t time;
+	HmNoteData data;
+} HmSeqNote;
+
+typedef struct {
+	uint32_t time;
+	float bpm;
+} HmTempo;
+
+typedef struct HmPattern HmPattern;
+typedef struct HmInstance HmInstance;
+typedef struct HmSeqVersion HmSeqVersion;
+
+/*
+ * Automation lanes drive a channel's pitch, or one of its controls or
+ * params, from a list of points. Each point sets the curve from it to the
+ * next: step holds its value, linear ramps and exponential ramps by a
+ * constant ratio, falling back to linear unless both values are positive.
+ */
+typedef enum {
+	HM_CURVE_STEP,
+	HM_CURVE_LINEAR,
+	HM_CURVE_EXPONENTIAL
+} HmCurve;
+
+typedef struct {
+	uint32_t time;
+	float value;
+	HmCurve curve;
+} HmAutoPoint;
+
+typedef struct {
+	int channel;
+	HmEventType type;
+	int num;
+} HmAutoTarget;
+
+/*
+ * Places a pattern on a channel at a time. Note numbers are shifted by
+ * transpose and note velocities scaled by velocity; notes shifted outside
+ * 0-127 are skipped.
+ */
+typedef struct {
+	int channel;
+	uint32_t time;
+	int transpose;
+	float velocity;
+} HmInstanceData;
+
 typedef struct {
 	enum {
 		HM_SEQ_NOTE,
@@ -75,19 +136,101 @@ typedef struct {
 	} data;
 } HmSeqItem;
 
+/*
+ * Iterates over the items visible in the window [start, end), including
+ * notes that start before the window and are still sounding in it.
+ * channel < 0 matches every channel; types is a mask of (1 << HM_SEQ_*)
+ * values, or 0 for all types. The sequence must not be edited while a
+ * range is in use.
+ */
+typedef struct {
+	HmSeq *seq;
+	uint32_t start, end;
+	int channel;
+	unsigned types;
+	int chunk, index;
+} HmSeqRange;
+
+/*
+ * Where a read of the committed sequence has got to: the sample to carry on
+ * from and how many of the events at that sample were already returned.
+ */
+typedef struct {
+	uint64_t sample;
+	int skip;
+} HmSeqPos;
+
+/*
+ * Where a read of the state at a sample has got to: how many keyframe
+ * events were returned, then the position in the events played since.
+ * Zeroed to start with.
+ */
+typedef struct {
+	int keyEvents;
+	HmSeqPos pos;
+} HmSeqStatePos;
+
 AlError hm_seq_init(HmSeq **seq);
 void hm_seq_free(HmSeq *seq);
 
-int hm_seq_get_events(HmSeq *seq, HmEvent *events, int numEvents, uint64_t start, uint64_t end, double sampleRate);
+/*
+ * Sets the sample rate used to place committed events, and commits the
+ * sequence so that playback picks it up.
+ */
+AlError hm_seq_set_sample_rate(HmSeq *seq, double sampleRate);
 
+/*
+ * Audio thread. Fills events with those falling in the samples [pos, end),
+ * with times set to their offset in samples from pos->sample, and moves pos
+ * past them. Start pos at the first sample with skip 0; a full result may
+ * end part way through the events for one sample, and calling again with
+ * the same pos carries on from there.
+ */
+int hm_seq_get_events(HmSeq *seq, HmEvent *events, int numEvents, HmSeqPos *pos, uint64_t end);
+
+/*
+ * Audio thread. Fills events with the patch, param, control and pitch
+ * changes that bring the synths to their state at sample: those saved in the
+ * keyframe before it, then those played since. Reading starts from pos and
+ * moves it past the events returned, so a long state can be read over
+ * several calls until one returns fewer than numEvents. Event times are left
+ * at 0.
+ */
+int hm_seq_get_state(HmSeq *seq, HmEvent *events, int numEvents, uint64_t sample, HmSeqStatePos *pos);
+
+/*
+ * Audio thread. Converts between ticks and samples using the tempo map of
+ * the committed sequence.
+ */
+uint64_t hm_seq_get_sample(HmSeq *seq, uint32_t tick);
+uint32_t hm_seq_get_tick(HmSeq *seq, uint64_t sample);
+
+/*
+ * Audio thread. Fills events with the value at sample to of each automation
+ * lane that changed since sample from, or of every lane that has started
+ * if chase is set. Event times are left at 0.
+ */
+int hm_seq_get_automation(HmSeq *seq, HmEvent *events, int numEvents, uint64_t from, uint64_t to, bool chase);
+
+/*
+ * Releases snapshots the audio thread has finished with, and commits that
+ * have been built. Commits and edits do this as well, so this only frees
+ * memory sooner when nothing is being edited.
+ */
 void hm_seq_process_messages(HmSeq *seq);
 
 AlError hm_seq_get_items(HmSeq *seq, HmSeqItem **items, int *numItems);
 
+AlError hm_seq_range_init(HmSeq *seq, HmSeqRange *range, uint32_t start, uint32_t end, int channel, unsigned types);
+bool hm_seq_range_next(HmSeqRange *range, HmSeqItem *item);
+
 AlError hm_seq_add_note(HmSeq *seq, int channel, uint32_t time, HmNoteData *data);
 AlError hm_seq_remove_note(HmSeq *seq, HmNote *note);
 AlError hm_seq_update_note(HmSeq *seq, HmNote *note, uint32_t time, HmNoteData *data);
 
+AlError hm_seq_add_notes(HmSeq *seq, const HmSeqNote *notes, int numNotes);
+AlError hm_seq_add_events(HmSeq *seq, const HmEvent *events, int numEvents);
+
 AlError hm_seq_set_pitch(HmSeq *seq, int channel, uint32_t time, float pitch);
 AlError hm_seq_clear_pitch(HmSeq *seq, int channel, uint32_t time);
 
@@ -100,6 +243,98 @@ AlError hm_seq_clear_param(HmSeq *seq, int channel, uint32_t time, int param);
 AlError hm_seq_set_patch(HmSeq *seq, int channel, uint32_t time, int patch);
 AlError hm_seq_clear_patch(HmSeq *seq, int channel, uint32_t time);
 
+/*
+ * Patterns hold notes and events once, with times relative to the start of
+ * the pattern and channels ignored, and can't be changed once added. They
+ * are played by instances, which are expanded as the audio thread renders
+ * so repeats cost no more than the instance. Removing a pattern removes its
+ * instances. Commits fail if more than 128 instances would be playing at
+ * once.
+ */
+AlError hm_seq_add_pattern(HmSeq *seq, const HmSeqNote *notes, int numNotes, const HmEvent *events, int numEvents, HmPattern **pattern);
+AlError hm_seq_remove_pattern(HmSeq *seq, HmPattern *pattern);
+AlError hm_seq_add_instance(HmSeq *seq, HmPattern *pattern, const HmInstanceData *data, HmInstance **instance);
+AlError hm_seq_remove_instance(HmSeq *seq, HmInstance *instance);
+
+AlError hm_seq_set_tempo(HmSeq *seq, uint32_t time, float bpm);
+AlError hm_seq_clear_tempo(HmSeq *seq, uint32_t time);
+AlError hm_seq_set_tempos(HmSeq *seq, const HmTempo *tempos, int numTempos);
+const HmTempo *hm_seq_get_tempos(HmSeq *seq, int *numTempos);
+
+/*
+ * Replaces the lane for a target, or removes it if there are no points.
+ * Point times must be strictly increasing. Pitch lanes ignore num.
+ */
+AlError hm_seq_set_lane(HmSeq *seq, const HmAutoTarget *target, const HmAutoPoint *points, int numPoints);
+AlError hm_seq_clear_lanes(HmSeq *seq);
+const HmAutoPoint *hm_seq_get_lane(HmSeq *seq, const HmAutoTarget *target, int *numPoints);
+int hm_seq_get_num_lanes(HmSeq *seq);
+const HmAutoPoint *hm_seq_get_lane_at(HmSeq *seq, int index, HmAutoTarget *target, int *numPoints);
+
+/*
+ * Versions capture the notes, events, patterns, instances, tempo map and
+ * automation of the sequence for undo or comparison. They share everything
+ * that hasn't changed since, so saving one costs a pointer for each chunk
+ * of events rather than a copy of them. Restoring a version replaces the
+ * edits, keeping note, pattern and instance handles from that version
+ * valid, and needs a commit like any other edit. Versions must be freed
+ * before the sequence.
+ */
+AlError hm_seq_save_version(HmSeq *seq, HmSeqVersion **version);
+AlError hm_seq_restore_version(HmSeq *seq, const HmSeqVersion *version);
+void hm_seq_free_version(HmSeq *seq, HmSeqVersion *version);
+
+/*
+ * Asks the builder thread to publish the current edits to the audio thread
+ * and returns straight away. The commit shares the edit copy rather than
+ * copying it, so edits carry on while it builds. A commit replaces one
+ * that hasn't started building yet. Errors from a build are returned by
+ * the next commit or wait.
+ */
 AlError hm_seq_commit(HmSeq *seq);
 
+/*
+ * Waits until every commit so far has been published.
+ */
+AlError hm_seq_wait(HmSeq *seq);
+
+/*
+ * Counts the events that playback of the committed sequence gives in the
+ * ticks [start, end), reading them batch at a time as the band does. Waits
+ * for commits to be published first.
+ */
+AlError hm_seq_count_events(HmSeq *seq, uint32_t start, uint32_t end, int batch, int *count);
+
+/*
+ * Returns every event in the sequence in playback order, with pattern
+ * instances expanded.
+ */
+AlError hm_seq_flatten(HmSeq *seq, HmEvent **events, int *numEvents);
+
+/*
+ * Replaces the sequence with a sorted event array and commits it without
+ * copying. The edit copy is only built from the events when it is first
+ * needed; changing the tempo map or lanes doesn't need it, and places the
+ * loaded events again at the next commit. release is called with owner once the events are no longer used;
+ * if loading fails the caller keeps ownership.
+ */
+AlError hm_seq_load(HmSeq *seq, const HmEvent *events, int numEvents, void (*release)(void *owner), void *owner);
+
+/*
+ * Loads like hm_seq_load, but the events must be a read-only file mapping.
+ * Only the pages around the playhead are kept resident: a pager thread reads
+ * ahead of playback and gives back what has been played. The keyframes for
+ * seeking are built by the pager too, after loading returns; until they are
+ * done, hm_seq_get_state replays from the start. Editing the sequence still
+ * reads all of it into memory.
+ */
+AlError hm_seq_load_mapped(HmSeq *seq, const HmEvent *events, int numEvents, void (*release)(void *owner), void *owner);
+
+/*
+ * For a mapped sequence, reads in the pages a seek to tick chases through
+ * and plays first, and keeps them in until the next prefetch, so the audio
+ * thread doesn't wait for them. Does nothing for other sequences.
+ */
+void hm_seq_prefetch(HmSeq *seq, uint32_t tick);
+
 #endif
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_SMF_H
+#define _HAMILTON_SMF_H
+
+#include "albase/common.h"
+#include "hamilton/seq.h"
+
+/*
+ * Reads a type 0 or 1 Standard MIDI File and adds its notes, pitch bends,
+ * controller and program changes to the sequence. MIDI channels map to
+ * sequencer channels of the same number, times are rescaled to HM_SEQ_PPQ
+ * and values are scaled to the ranges used by the synths. The file's tempo
+ * map replaces the sequence's. The sequence is not committed.
+ *
+ * If numPatches is given, it holds the number of patches the synth on each
+ * of the 16 channels has, and program changes past that are skipped.
+ */
+AlError hm_smf_import(HmSeq *seq, const char *path, const int *numPatches);
+
+/*
+ * Writes the sequence and its tempo map as a type 0 Standard MIDI File.
+ * Param changes and channels above 15 have no MIDI equivalent and are
+ * skipped.
+ */
+AlError hm_smf_export(HmSeq *seq, const char *path);
+
+#endif
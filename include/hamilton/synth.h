@@ -7,6 +7,17 @@
 #ifndef _HAMILTON_SYNTH_H
 #define _HAMILTON_SYNTH_H
 
+#include "hamilton/seq.h"
+
+/*
+ * Synths set version to the newest of these they implement. Version 0 synths
+ * get one call per event through startNote, stopNote and the rest, with
+ * generate called between them. Version 1 synths implement process instead,
+ * and are given each block's events at once.
+ */
+static const int HM_SYNTH_ABI_EVENTS = 0;
+static const int HM_SYNTH_ABI_PROCESS = 1;
+
 struct HmSynth;
 struct HmSynthType;
 
@@ -20,6 +31,7 @@ struct HmSynthType {
 
 struct HmSynth {
 	const HmSynthType *type;
+	int version;
 	void (*free)(HmSynth *synth);
 
 	void (*setSampleRate)(HmSynth *synth, int sampleRate);
@@ -38,7 +50,31 @@ struct HmSynth {
 	void (*setPitch)(HmSynth *synth, float pitch);
 	void (*setControl)(HmSynth *synth, int control, float value);
 
+	int (*getPolyphony)(HmSynth *synth);
+	void (*setPolyphony)(HmSynth *synth, int voices);
+
 	void (*generate)(HmSynth *synth, float *buffer, int length);
+
+	/*
+	 * Adds length samples to buffer, applying the events as it goes. Event
+	 * times are offsets into the buffer, in order, and none is past length.
+	 * length may be 0, with buffer NULL, to apply events between blocks.
+	 */
+	void (*process)(HmSynth *synth, const HmEvent *events, int numEvents, float *buffer, int length);
+
+	/*
+	 * Loads what the synth plays from, such as a sample set, from path. This
+	 * runs on the control thread while the synth plays, so the synth hands
+	 * the result over to process itself.
+	 */
+	AlError (*load)(HmSynth *synth, const char *path);
 };
 
+/*
+ * Calls the synth's process if it has one. Otherwise splits the block at
+ * each event and passes them on through the version 0 hooks, skipping any
+ * the synth leaves NULL.
+ */
+void hm_synth_process(HmSynth *synth, const HmEvent *events, int numEvents, float *buffer, int length);
+
 #endif
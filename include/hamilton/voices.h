@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_VOICES_H
+#define _HAMILTON_VOICES_H
+
+#include <stdbool.h>
+
+static const int HM_MAX_VOICES = 128;
+static const int HM_VOICE_NOTES = 128;
+
+/*
+ * Voice allocation for synths. A synth keeps the state of each voice itself,
+ * indexed by voice number, and embeds an HmVoices to decide which voice
+ * plays each note, which to steal when they are all in use and which to
+ * hold while the sustain pedal is down.
+ *
+ * Sounding voices are always numbered [0, numActive), so render loops only
+ * visit live voices. When a voice is freed the last one is moved into its
+ * place through the move callback, after which the old number is unused.
+ * release is called when a voice's note ends, so the synth can start its
+ * release; the synth frees the voice once it has gone silent.
+ *
+ * Only numVoices and numActive should be read directly.
+ */
+typedef struct {
+	int numVoices;
+	int numActive;
+	bool sustain;
+
+	void (*move)(void *synth, int from, int to);
+	void (*release)(void *synth, int voice);
+	void *synth;
+
+	int note[HM_MAX_VOICES];
+	int list[HM_MAX_VOICES];
+	int prev[HM_MAX_VOICES], next[HM_MAX_VOICES];
+	int nextSameNote[HM_MAX_VOICES];
+	int first[2], last[2];
+	int noteVoices[HM_VOICE_NOTES + 1];
+} HmVoices;
+
+void hm_voices_init(HmVoices *voices, int numVoices, void (*move)(void *synth, int from, int to), void (*release)(void *synth, int voice), void *synth);
+
+/*
+ * Changes the number of voices, between 1 and HM_MAX_VOICES. Voices over
+ * the new limit are freed without release, oldest first, so the synth should
+ * silence any from numActive up afterwards.
+ */
+void hm_voices_set_polyphony(HmVoices *voices, int numVoices);
+
+/*
+ * Returns the voice to start the note on, or -1 if the note is out of range.
+ * A free voice is used if there is one, otherwise the voice that has been
+ * releasing longest is stolen, then the one that has been held longest.
+ */
+int hm_voices_start(HmVoices *voices, int note);
+
+/*
+ * Releases the voices playing the note, or holds them until the sustain
+ * pedal is lifted.
+ */
+void hm_voices_stop(HmVoices *voices, int note);
+void hm_voices_set_sustain(HmVoices *voices, bool sustain);
+
+void hm_voices_free(HmVoices *voices, int voice);
+
+#endif
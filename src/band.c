@@ -11,8 +11,8 @@
 #include "albase/mq.h"
 #include "albase/triple_buffer.h"
 
-#define TICKS_TO_SAMPLES(t) (t) * (band->sampleRate / HM_SEQ_TICK_RATE)
-#define SAMPLES_TO_TICKS(n) (n) * (HM_SEQ_TICK_RATE / band->sampleRate)
+#define MAX_EVENTS 128
+#define CONTROL_SAMPLES 64
 
 typedef struct {
 	enum {
@@ -20,7 +20,10 @@ typedef struct {
 		PAUSE,
 		SEEK,
 		SET_LOOPING,
-		SET_LOOP
+		SET_LOOP,
+		SET_PATCH,
+		SET_PARAM,
+		SET_POLYPHONY
 	} type;
 	union {
 		uint32_t position;
@@ -28,6 +31,19 @@ typedef struct {
 		struct {
 			uint32_t start, end;
 		} loop;
+		struct {
+			int channel;
+			int patch;
+		} patch;
+		struct {
+			int channel;
+			int num;
+			float value;
+		} param;
+		struct {
+			int channel;
+			int voices;
+		} polyphony;
 	} data;
 } ToAudioMessage;
 
@@ -37,8 +53,15 @@ struct HmBand {
 	uint64_t time;
 	bool playing;
 	bool looping;
-	uint64_t loopStart;
-	uint64_t loopEnd;
+	uint32_t loopStart;
+	uint32_t loopEnd;
+	uint64_t controlTime;
+	uint64_t nextControl;
+	bool chase;
+
+	HmEvent queue[NUM_CHANNELS][MAX_EVENTS];
+	int numQueued[NUM_CHANNELS];
+	int rendered[NUM_CHANNELS];
 
 	HmLib *lib;
 	HmSeq *seq;
@@ -63,6 +86,13 @@ AlError hm_band_init(HmBand **result)
 	band->looping = false;
 	band->loopStart = 0;
 	band->loopEnd = 0;
+	band->controlTime = 0;
+	band->nextControl = 0;
+	band->chase = true;
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		band->numQueued[i] = 0;
+		band->rendered[i] = 0;
+	}
 	band->lib = NULL;
 	band->seq = NULL;
 	band->toAudio = NULL;
@@ -100,8 +130,10 @@ void hm_band_free(HmBand *band)
 	}
 }
 
-void hm_band_set_sample_rate(HmBand *band, int sampleRate)
+AlError hm_band_set_sample_rate(HmBand *band, int sampleRate)
 {
+	BEGIN()
+
 	band->sampleRate = sampleRate;
 
 	for (int i = 0; i < NUM_CHANNELS; i++) {
@@ -109,6 +141,10 @@ void hm_band_set_sample_rate(HmBand *band, int sampleRate)
 			band->synths[i]->setSampleRate(band->synths[i], sampleRate);
 		}
 	}
+
+	TRY(hm_seq_set_sample_rate(band->seq, sampleRate));
+
+	PASS()
 }
 
 HmLib *hm_band_get_lib(HmBand *band)
@@ -164,6 +200,115 @@ float hm_band_get_channel_param(HmBand *band, int channel, int param)
 	return synth->getParam(synth, param);
 }
 
+int hm_band_get_channel_num_patches(HmBand *band, int channel)
+{
+	HmSynth *synth = band->synths[channel];
+	return (synth && synth->getNumPatches) ? synth->getNumPatches(synth) : 0;
+}
+
+int hm_band_get_channel_patch(HmBand *band, int channel)
+{
+	HmSynth *synth = band->synths[channel];
+	return (synth && synth->getPatch) ? synth->getPatch(synth) : -1;
+}
+
+AlError hm_band_set_channel_patch(HmBand *band, int channel, int patch)
+{
+	BEGIN()
+
+	ToAudioMessage message = {
+		.type = SET_PATCH,
+		.data = {
+			.patch = {
+				.channel = channel,
+				.patch = patch
+			}
+		}
+	};
+
+	if (!al_mq_push(band->toAudio, &message))
+		THROW(AL_ERROR_MEMORY);
+
+	PASS()
+}
+
+int hm_band_get_channel_polyphony(HmBand *band, int channel)
+{
+	HmSynth *synth = band->synths[channel];
+	return (synth && synth->getPolyphony) ? synth->getPolyphony(synth) : 1;
+}
+
+AlError hm_band_set_channel_polyphony(HmBand *band, int channel, int voices)
+{
+	BEGIN()
+
+	ToAudioMessage message = {
+		.type = SET_POLYPHONY,
+		.data = {
+			.polyphony = {
+				.channel = channel,
+				.voices = voices
+			}
+		}
+	};
+
+	if (!al_mq_push(band->toAudio, &message))
+		THROW(AL_ERROR_MEMORY);
+
+	PASS()
+}
+
+AlError hm_band_load_channel(HmBand *band, int channel, const char *path)
+{
+	BEGIN()
+
+	HmSynth *synth = band->synths[channel];
+	if (!synth || !synth->load)
+		THROW(AL_ERROR_GENERIC);
+
+	TRY(synth->load(synth, path));
+
+	PASS()
+}
+
+AlError hm_band_set_channel_param(HmBand *band, int channel, int param, float value)
+{
+	BEGIN()
+
+	ToAudioMessage message = {
+		.type = SET_PARAM,
+		.data = {
+			.param = {
+				.channel = channel,
+				.num = param,
+				.value = value
+			}
+		}
+	};
+
+	if (!al_mq_push(band->toAudio, &message))
+		THROW(AL_ERROR_MEMORY);
+
+	PASS()
+}
+
+static void process_event(HmBand *band, HmEvent *event);
+
+/* Brings the synths to the state at the current time after a jump */
+static void chase_events(HmBand *band)
+{
+	HmEvent events[MAX_EVENTS];
+	HmSeqStatePos pos = {0, {0, 0}};
+	int numEvents;
+
+	do {
+		numEvents = hm_seq_get_state(band->seq, events, MAX_EVENTS, band->time, &pos);
+		for (int i = 0; i < numEvents; i++) {
+			process_event(band, &events[i]);
+		}
+	} while (numEvents == MAX_EVENTS);
+}
+
 static void process_messages(HmBand *band)
 {
 	ToAudioMessage message;
@@ -171,6 +316,8 @@ static void process_messages(HmBand *band)
 		switch (message.type) {
 			case PLAY:
 				band->playing = true;
+				band->chase = true;
+				band->nextControl = 0;
 				break;
 
 			case PAUSE:
@@ -178,7 +325,10 @@ static void process_messages(HmBand *band)
 				break;
 
 			case SEEK:
-				band->time = TICKS_TO_SAMPLES(message.data.position);
+				band->time = hm_seq_get_sample(band->seq, message.data.position);
+				chase_events(band);
+				band->chase = true;
+				band->nextControl = 0;
 				break;
 
 			case SET_LOOPING:
@@ -186,96 +336,165 @@ static void process_messages(HmBand *band)
 				break;
 
 			case SET_LOOP:
-				band->loopStart = TICKS_TO_SAMPLES(message.data.loop.start);
-				band->loopEnd = TICKS_TO_SAMPLES(message.data.loop.end);
+				band->loopStart = message.data.loop.start;
+				band->loopEnd = message.data.loop.end;
+				break;
+
+			case SET_PATCH:
+				process_event(band, &(HmEvent){
+					.channel = message.data.patch.channel,
+					.type = HM_EV_PATCH,
+					.data = {
+						.patch = message.data.patch.patch
+					}
+				});
+				break;
+
+			case SET_PARAM:
+				process_event(band, &(HmEvent){
+					.channel = message.data.param.channel,
+					.type = HM_EV_PARAM,
+					.data = {
+						.param = {
+							.num = message.data.param.num,
+							.value = message.data.param.value
+						}
+					}
+				});
+				break;
+
+			case SET_POLYPHONY: {
+				int channel = message.data.polyphony.channel;
+				HmSynth *synth = (channel >= 0 && channel < NUM_CHANNELS) ? band->synths[channel] : NULL;
+				if (synth && synth->setPolyphony) {
+					synth->setPolyphony(synth, message.data.polyphony.voices);
+				}
 				break;
+			}
 		}
 	}
 }
 
+/* Applies an event between blocks */
 static void process_event(HmBand *band, HmEvent *event)
 {
+	if (event->channel < 0 || event->channel >= NUM_CHANNELS)
+		return;
+
 	HmSynth *synth = band->synths[event->channel];
 	if (!synth)
 		return;
 
-	switch (event->type) {
-		case HM_EV_NOTE_OFF:
-			synth->stopNote(synth, event->data.note.num);
-			break;
+	hm_synth_process(synth, event, 1, NULL, 0);
+}
 
-		case HM_EV_NOTE_ON:
-			synth->startNote(synth, event->data.note.num, event->data.note.velocity);
-			break;
+/*
+ * Renders a channel from where it last got to up to until, an offset into
+ * the block, with the events queued for it so far.
+ */
+static void flush_channel(HmBand *band, float *buffer, int channel, int until)
+{
+	HmSynth *synth = band->synths[channel];
+	HmEvent *events = band->queue[channel];
+	int numEvents = band->numQueued[channel];
+	int from = band->rendered[channel];
 
-		case HM_EV_PITCH:
-			synth->setPitch(synth, event->data.pitch);
-			break;
+	if (synth) {
+		for (int i = 0; i < numEvents; i++) {
+			events[i].time -= from;
+		}
 
-		case HM_EV_CONTROL:
-			synth->setControl(synth, event->data.control.num, event->data.control.value);
-			break;
+		hm_synth_process(synth, events, numEvents, buffer + from, until - from);
+	}
 
-		case HM_EV_PARAM:
-			synth->setParam(synth, event->data.param.num, event->data.param.value);
-			break;
+	band->numQueued[channel] = 0;
+	band->rendered[channel] = until;
+}
 
-		case HM_EV_PATCH:
-			synth->setPatch(synth, event->data.patch);
+/* Queues an event for its channel at offset samples into the block */
+static void queue_event(HmBand *band, float *buffer, const HmEvent *event, int offset)
+{
+	int channel = event->channel;
+	if (channel < 0 || channel >= NUM_CHANNELS || !band->synths[channel])
+		return;
+
+	if (band->numQueued[channel] == MAX_EVENTS) {
+		flush_channel(band, buffer, channel, offset);
+	}
+
+	HmEvent *queued = &band->queue[channel][band->numQueued[channel]++];
+	*queued = *event;
+	queued->time = offset;
+}
+
+static void update_automation(HmBand *band, float *buffer, uint64_t start, uint64_t time)
+{
+	HmEvent events[MAX_EVENTS];
+
+	int numEvents = hm_seq_get_automation(band->seq, events, MAX_EVENTS, band->controlTime, time, band->chase);
+	for (int i = 0; i < numEvents; i++) {
+		queue_event(band, buffer, &events[i], (int)(time - start));
+	}
+
+	band->controlTime = time;
+	band->nextControl = (time / CONTROL_SAMPLES + 1) * CONTROL_SAMPLES;
+	band->chase = false;
+}
+
+/*
+ * Queues automation for each control block that starts before until, or at
+ * start for the first after a jump.
+ */
+static void queue_automation(HmBand *band, float *buffer, uint64_t start, uint64_t until)
+{
+	while (true) {
+		uint64_t time = (band->nextControl > start) ? band->nextControl : start;
+		if (time >= until)
 			break;
+
+		update_automation(band, buffer, start, time);
 	}
 }
 
+/*
+ * Sorts the block's events and automation into per channel queues, then
+ * has each synth render the whole block with its queue in one call.
+ */
 static void run(HmBand *band, float *buffer, uint64_t numSamples)
 {
-	uint64_t time = band->time;
+	HmEvent events[MAX_EVENTS];
 
-	HmEvent events[128];
-	int numEvents;
-	int event = 0;
+	uint64_t start = band->time;
+	uint64_t end = start + numSamples;
 
-	if (band->playing) {
-		numEvents = hm_seq_get_events(band->seq, events, sizeof(events), time, time + numSamples, band->sampleRate);
-	} else {
-		numEvents = 0;
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		band->numQueued[i] = 0;
+		band->rendered[i] = 0;
 	}
 
-	bool eventUpcoming = numEvents > 0;
-
-	do {
-		while (eventUpcoming && events[event].time <= time) {
-			process_event(band, &events[event]);
-			event++;
-			eventUpcoming = event < numEvents;
-		}
+	if (band->playing) {
+		HmSeqPos pos = {start, 0};
+		int numEvents;
 
-		uint64_t intervalSamples;
-		if (eventUpcoming) {
-			intervalSamples = TICKS_TO_SAMPLES(events[event].time - time);
-		}
+		do {
+			uint64_t from = pos.sample;
+			numEvents = hm_seq_get_events(band->seq, events, MAX_EVENTS, &pos, end);
 
-		if (!eventUpcoming || intervalSamples > numSamples) {
-			intervalSamples = numSamples;
-		}
+			for (int i = 0; i < numEvents; i++) {
+				uint64_t eventTime = from + events[i].time;
 
-		for (int i = 0; i < NUM_CHANNELS; i++) {
-			HmSynth *synth = band->synths[i];
-			if (synth) {
-				synth->generate(synth, buffer, (int)intervalSamples);
+				queue_automation(band, buffer, start, eventTime);
+				queue_event(band, buffer, &events[i], (int)(eventTime - start));
 			}
-		}
-
-		if (eventUpcoming) {
-			time = events[event].time;
-		}
+		} while (numEvents == MAX_EVENTS);
 
-		if (band->playing) {
-			band->time += intervalSamples;
-		}
-		buffer += intervalSamples;
-		numSamples -= intervalSamples;
+		queue_automation(band, buffer, start, end);
+		band->time = end;
+	}
 
-	} while (numSamples);
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		flush_channel(band, buffer, i, (int)numSamples);
+	}
 }
 
 void hm_band_run(HmBand *band, float *buffer, uint64_t numSamples)
@@ -286,17 +505,23 @@ void hm_band_run(HmBand *band, float *buffer, uint64_t numSamples)
 
 	process_messages(band);
 
+	uint64_t loopStart = hm_seq_get_sample(band->seq, band->loopStart);
+	uint64_t loopEnd = hm_seq_get_sample(band->seq, band->loopEnd);
+
 	while (true) {
 		if (band->playing &&
 			band->looping &&
-			band->time <= band->loopEnd &&
-			band->time + numSamples > band->loopEnd) {
+			band->time <= loopEnd &&
+			band->time + numSamples > loopEnd) {
 
-			uint64_t intervalSamples = band->loopEnd - band->time;
+			uint64_t intervalSamples = loopEnd - band->time;
 
 			run(band, buffer, intervalSamples);
 
-			band->time = band->loopStart;
+			band->time = loopStart;
+			chase_events(band);
+			band->chase = true;
+			band->nextControl = 0;
 			buffer += intervalSamples;
 			numSamples -= intervalSamples;
 
@@ -309,10 +534,10 @@ void hm_band_run(HmBand *band, float *buffer, uint64_t numSamples)
 	HmBandState *state = al_triple_buffer_write(band->state);
 	*state = (HmBandState){
 		.playing = band->playing,
-		.position = SAMPLES_TO_TICKS(band->time),
+		.position = hm_seq_get_tick(band->seq, band->time),
 		.looping = band->looping,
-		.loopStart = SAMPLES_TO_TICKS(band->loopStart),
-		.loopEnd = SAMPLES_TO_TICKS(band->loopEnd)
+		.loopStart = band->loopStart,
+		.loopEnd = band->loopEnd
 	};
 	al_triple_buffer_flip(band->state);
 }
@@ -349,6 +574,9 @@ AlError hm_band_seek(HmBand *band, uint32_t	position)
 {
 	BEGIN()
 
+	/* So chasing to the new position doesn't fault pages on the audio thread */
+	hm_seq_prefetch(band->seq, position);
+
 	ToAudioMessage message = {
 		.type = SEEK,
 		.data = {
@@ -42,6 +42,50 @@ int cmd_set_synth(lua_State *L)
 	return 0;
 }
 
+int cmd_get_polyphony(lua_State *L)
+{
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	int channel = (int)luaL_checkinteger(L, 1) - 1;
+
+	if (channel < 0 || channel >= NUM_CHANNELS)
+		return luaL_error(L, "no such channel: %d", channel + 1);
+
+	lua_pushinteger(L, hm_band_get_channel_polyphony(band, channel));
+
+	return 1;
+}
+
+int cmd_set_polyphony(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	int channel = (int)luaL_checkinteger(L, 1) - 1;
+	int voices = (int)luaL_checkinteger(L, 2);
+
+	TRY(hm_band_set_channel_polyphony(band, channel, voices));
+
+	CATCH_LUA(, "error setting polyphony")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_load_channel(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	int channel = (int)luaL_checkinteger(L, 1) - 1;
+	const char *path = luaL_checkstring(L, 2);
+
+	if (channel < 0 || channel >= NUM_CHANNELS)
+		return luaL_error(L, "no such channel: %d", channel + 1);
+
+	TRY(hm_band_load_channel(band, channel, path));
+
+	CATCH_LUA(, "error loading channel")
+	FINALLY_LUA(, 0)
+}
+
 int cmd_play(lua_State *L)
 {
 	BEGIN()
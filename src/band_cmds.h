@@ -11,6 +11,9 @@
 
 int cmd_get_synths(lua_State *L);
 int cmd_set_synth(lua_State *L);
+int cmd_get_polyphony(lua_State *L);
+int cmd_set_polyphony(lua_State *L);
+int cmd_load_channel(lua_State *L);
 int cmd_play(lua_State *L);
 int cmd_pause(lua_State *L);
 int cmd_seek(lua_State *L);
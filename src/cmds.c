@@ -10,12 +10,17 @@
 
 #include "band_cmds.h"
 #include "seq_cmds.h"
+#include "project_cmds.h"
+#include "smf_cmds.h"
 
 AlLuaKey bandKey;
 
 static const luaL_Reg lib[] = {
 	{"get_synths", cmd_get_synths},
 	{"set_synth", cmd_set_synth},
+	{"get_polyphony", cmd_get_polyphony},
+	{"set_polyphony", cmd_set_polyphony},
+	{"load_channel", cmd_load_channel},
 
 	{"play", cmd_play},
 	{"pause", cmd_pause},
@@ -37,9 +42,30 @@ static const luaL_Reg lib[] = {
 	{"clear_set_param", cmd_clear_set_param},
 	{"add_set_patch", cmd_add_set_patch},
 	{"clear_set_patch", cmd_clear_set_patch},
+	{"set_tempo", cmd_set_tempo},
+	{"clear_tempo", cmd_clear_tempo},
+	{"set_lane", cmd_set_lane},
+	{"add_notes", cmd_add_notes},
+	{"add_events", cmd_add_events},
+	{"add_pattern", cmd_add_pattern},
+	{"remove_pattern", cmd_remove_pattern},
+	{"add_instance", cmd_add_instance},
+	{"remove_instance", cmd_remove_instance},
 
 	{"get_seq_items", cmd_get_seq_items},
+	{"get_seq_range", cmd_get_seq_range},
+	{"get_tempos", cmd_get_tempos},
+	{"get_lane", cmd_get_lane},
+	{"save_seq_version", cmd_save_seq_version},
+	{"restore_seq_version", cmd_restore_seq_version},
+	{"free_seq_version", cmd_free_seq_version},
 	{"seq_commit", cmd_seq_commit},
+	{"count_seq_events", cmd_count_seq_events},
+
+	{"save_project", cmd_save_project},
+	{"load_project", cmd_load_project},
+	{"import_midi", cmd_import_midi},
+	{"export_midi", cmd_export_midi},
 
 	{NULL, NULL}
 };
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "hamilton/fastmath.h"
+
+const float hm_note_freqs[128] = {
+	8.17579892f, 8.66195722f, 9.177024f, 9.72271824f,
+	10.3008612f, 10.9133822f, 11.5623257f, 12.2498574f,
+	12.9782718f, 13.75f, 14.5676175f, 15.4338532f,
+	16.3515978f, 17.3239144f, 18.354048f, 19.4454365f,
+	20.6017223f, 21.8267645f, 23.1246514f, 24.4997147f,
+	25.9565436f, 27.5f, 29.1352351f, 30.8677063f,
+	32.7031957f, 34.6478289f, 36.708096f, 38.890873f,
+	41.2034446f, 43.6535289f, 46.2493028f, 48.9994295f,
+	51.9130872f, 55.0f, 58.2704702f, 61.7354127f,
+	65.4063913f, 69.2956577f, 73.416192f, 77.7817459f,
+	82.4068892f, 87.3070579f, 92.4986057f, 97.998859f,
+	103.826174f, 110.0f, 116.54094f, 123.470825f,
+	130.812783f, 138.591315f, 146.832384f, 155.563492f,
+	164.813778f, 174.614116f, 184.997211f, 195.997718f,
+	207.652349f, 220.0f, 233.081881f, 246.941651f,
+	261.625565f, 277.182631f, 293.664768f, 311.126984f,
+	329.627557f, 349.228231f, 369.994423f, 391.995436f,
+	415.304698f, 440.0f, 466.163762f, 493.883301f,
+	523.251131f, 554.365262f, 587.329536f, 622.253967f,
+	659.255114f, 698.456463f, 739.988845f, 783.990872f,
+	830.609395f, 880.0f, 932.327523f, 987.766603f,
+	1046.50226f, 1108.73052f, 1174.65907f, 1244.50793f,
+	1318.51023f, 1396.91293f, 1479.97769f, 1567.98174f,
+	1661.21879f, 1760.0f, 1864.65505f, 1975.53321f,
+	2093.00452f, 2217.46105f, 2349.31814f, 2489.01587f,
+	2637.02046f, 2793.82585f, 2959.95538f, 3135.96349f,
+	3322.43758f, 3520.0f, 3729.31009f, 3951.06641f,
+	4186.00904f, 4434.9221f, 4698.63629f, 4978.03174f,
+	5274.04091f, 5587.6517f, 5919.91076f, 6271.92698f,
+	6644.87516f, 7040.0f, 7458.62018f, 7902.13282f,
+	8372.01809f, 8869.84419f, 9397.27257f, 9956.06348f,
+	10548.0818f, 11175.3034f, 11839.8215f, 12543.854f
+};
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+/*
+ * Sweeps each approximation in fastmath.h over its range against double
+ * precision libm and fails if any error is over the bound documented
+ * there. The fastmathtest target runs this as part of the build.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "hamilton/fastmath.h"
+
+#define NUM_POINTS 4000000
+
+static bool check(const char *name, double error, double bound)
+{
+	bool ok = error < bound;
+	printf("%-10s %.3g (bound %.3g)%s\n", name, error, bound, ok ? "" : " FAILED");
+
+	return ok;
+}
+
+int main(void)
+{
+	double exp2Error = 0, expError = 0, sinError = 0, cosError = 0, tanError = 0, noteError = 0;
+
+	for (long i = 0; i <= NUM_POINTS; i++) {
+		double u = (double)i / NUM_POINTS;
+
+		float x = (float)(-126 + 253 * u);
+		double error = fabs(hm_fast_exp2(x) / exp2(x) - 1);
+		if (error > exp2Error) {
+			exp2Error = error;
+		}
+
+		/* Relative to the growing bound, so it can be checked against 2.5e-7 */
+		x = (float)(-87 + 175 * u);
+		error = fabs(hm_fast_exp(x) / exp(x) - 1) / (1 + fabs(x));
+		if (error > expError) {
+			expError = error;
+		}
+
+		x = (float)(-1000 + 2000 * u);
+		error = fabs(hm_fast_sin(x) - sin(x));
+		if (error > sinError) {
+			sinError = error;
+		}
+
+		error = fabs(hm_fast_cos(x) - cos(x));
+		if (error > cosError) {
+			cosError = error;
+		}
+
+		x = (float)(0.49 * M_PI * u);
+		if (x > 0) {
+			error = fabs(hm_fast_tan(x) / tan(x) - 1);
+			if (error > tanError) {
+				tanError = error;
+			}
+		}
+	}
+
+	for (int note = 0; note < 128; note++) {
+		double freq = 440 * exp2((note - 69) / 12.0);
+		double error = fabs(hm_note_to_freq(note) / freq - 1);
+		if (error > noteError) {
+			noteError = error;
+		}
+	}
+
+	bool ok = true;
+	ok &= check("exp2", exp2Error, 2.5e-7);
+	ok &= check("exp", expError, 2.5e-7);
+	ok &= check("sin", sinError, 2.5e-7);
+	ok &= check("cos", cosError, 3e-7);
+	ok &= check("tan", tanError, 1e-5);
+	ok &= check("note freq", noteError, 1.2e-7);
+
+	return ok ? 0 : 1;
+}
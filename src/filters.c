@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <math.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define HAVE_SSE
+#endif
+
+#include "hamilton/filters.h"
+#include "hamilton/fastmath.h"
+
+/* Butterworth damping, 1 / Q */
+static const float DAMPING = 1.414213562f;
+
+/*
+ * State below this is flushed to zero after each block, so a filter left
+ * ringing into silence never reaches denormals, which are very slow
+ */
+static const float FLUSH_LEVEL = 1e-20f;
+
+void hm_filters_reset(HmFilterBank *filters, int voice)
+{
+	filters->ic1[voice] = 0.0f;
+	filters->ic2[voice] = 0.0f;
+}
+
+void hm_filters_set_cutoff(HmFilterBank *filters, int voice, float cutoff, float sampleRate)
+{
+	float w = cutoff / sampleRate;
+	if (w > 0.49f) {
+		w = 0.49f;
+	} else if (w < 0.0f) {
+		w = 0.0f;
+	}
+
+	float g = hm_fast_tan((float)M_PI * w);
+	float a1 = 1.0f / (1.0f + g * (g + DAMPING));
+
+	filters->a1[voice] = a1;
+	filters->a2[voice] = g * a1;
+	filters->a3[voice] = g * g * a1;
+}
+
+void hm_filters_move(HmFilterBank *filters, int from, int to)
+{
+	filters->a1[to] = filters->a1[from];
+	filters->a2[to] = filters->a2[from];
+	filters->a3[to] = filters->a3[from];
+	filters->ic1[to] = filters->ic1[from];
+	filters->ic2[to] = filters->ic2[from];
+}
+
+#ifdef HAVE_SSE
+void hm_filters_process(HmFilterBank *filters, int first, const float *input, float *output, int length)
+{
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 flush = _mm_set1_ps(FLUSH_LEVEL);
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128 a1 = _mm_loadu_ps(&filters->a1[first]);
+	const __m128 a2 = _mm_loadu_ps(&filters->a2[first]);
+	const __m128 a3 = _mm_loadu_ps(&filters->a3[first]);
+	__m128 ic1 = _mm_loadu_ps(&filters->ic1[first]);
+	__m128 ic2 = _mm_loadu_ps(&filters->ic2[first]);
+
+	for (int n = 0; n < length; n++) {
+		__m128 v3 = _mm_sub_ps(_mm_loadu_ps(&input[n * HM_FILTER_LANES]), ic2);
+		__m128 v1 = _mm_add_ps(_mm_mul_ps(a1, ic1), _mm_mul_ps(a2, v3));
+		__m128 v2 = _mm_add_ps(ic2, _mm_add_ps(_mm_mul_ps(a2, ic1), _mm_mul_ps(a3, v3)));
+		ic1 = _mm_sub_ps(_mm_mul_ps(two, v1), ic1);
+		ic2 = _mm_sub_ps(_mm_mul_ps(two, v2), ic2);
+
+		_mm_storeu_ps(&output[n * HM_FILTER_LANES], v2);
+	}
+
+	ic1 = _mm_and_ps(ic1, _mm_cmpge_ps(_mm_andnot_ps(sign, ic1), flush));
+	ic2 = _mm_and_ps(ic2, _mm_cmpge_ps(_mm_andnot_ps(sign, ic2), flush));
+	_mm_storeu_ps(&filters->ic1[first], ic1);
+	_mm_storeu_ps(&filters->ic2[first], ic2);
+}
+
+#else
+void hm_filters_process(HmFilterBank *filters, int first, const float *input, float *output, int length)
+{
+	for (int n = 0; n < length; n++) {
+		for (int l = 0; l < HM_FILTER_LANES; l++) {
+			int i = first + l;
+
+			float v3 = input[n * HM_FILTER_LANES + l] - filters->ic2[i];
+			float v1 = filters->a1[i] * filters->ic1[i] + filters->a2[i] * v3;
+			float v2 = filters->ic2[i] + (filters->a2[i] * filters->ic1[i] + filters->a3[i] * v3);
+			filters->ic1[i] = 2.0f * v1 - filters->ic1[i];
+			filters->ic2[i] = 2.0f * v2 - filters->ic2[i];
+
+			output[n * HM_FILTER_LANES + l] = v2;
+		}
+	}
+
+	for (int i = first; i < first + HM_FILTER_LANES; i++) {
+		if (fabsf(filters->ic1[i]) < FLUSH_LEVEL) {
+			filters->ic1[i] = 0.0f;
+		}
+		if (fabsf(filters->ic2[i]) < FLUSH_LEVEL) {
+			filters->ic2[i] = 0.0f;
+		}
+	}
+}
+#endif
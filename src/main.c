@@ -5,6 +5,7 @@
  */
 
 #include <SDL2/SDL.h>
+#include <string.h>
 
 #include "hamilton/band.h"
 #include "hamilton/lib.h"
@@ -12,6 +13,7 @@
 #include "hamilton/midi.h"
 #include "hamilton/core_synths.h"
 #include "hamilton/cmds.h"
+#include "hamilton/project.h"
 #include "albase/lua.h"
 #include "albase/script.h"
 
@@ -27,6 +29,7 @@ int main(int argc, char *argv[])
 
 	TRY(sine_wave_register(band));
 	TRY(mda_dx10_register(band));
+	TRY(sampler_register(band));
 
 	TRY(hm_audio_init(band));
 	hm_audio_start();
@@ -35,7 +38,13 @@ int main(int argc, char *argv[])
 	hm_load_cmds(L, band);
 
 	for (int i = 1; i < argc; i++) {
-		TRY(al_script_run_file(L, argv[i]));
+		size_t length = strlen(argv[i]);
+
+		if (length > 4 && !strcmp(argv[i] + length - 4, ".hmp")) {
+			TRY(hm_project_load(band, argv[i]));
+		} else {
+			TRY(al_script_run_file(L, argv[i]));
+		}
 	}
 
 	while (true) {
@@ -7,13 +7,31 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX
+#endif
 
 #include "hamilton/synth.h"
+#include "hamilton/voices.h"
+#include "hamilton/fastmath.h"
 #include "hamilton/band.h"
 #include "hamilton/lib.h"
 #include "hamilton/core_synths.h"
 
+#define NUM_PARAMS 16
+#define NUM_PATCHES 32
+#define NUM_EDITS 8
+
 static const char *name = "mda DX10";
 static const char *params[] = {
 	"Attack",
@@ -34,84 +52,167 @@ static const char *params[] = {
 	"LFO Rate"
 };
 
-const int NUM_PARAMS = 16;
-const int NUM_PATCHES = 32;
-const int NUM_VOICES = 8;
+const int DEFAULT_VOICES = 8;
 const float SILENCE = 0.0003f;
-const int SUSTAIN_NOTE = 128;
 
 const float MIDI_TO_FREQ_1 = 8.175798915644f;
 const float MIDI_TO_FREQ_2 = 0.05776226505f;
 const float HALF_PI = 1.570796326795f;
 
-struct Patch {
+/* Coefficients derived from a patch's params at the current sample rate */
+struct Coeffs {
+	struct {
+		float attack, decay, release;
+	} env;
+
+	struct {
+		float ratio;
+		float initDepth, susDepth;
+		float decay, release;
+		float mix;
+	} mod;
+
+	struct {
+		float d, vibrato;
+	} lfo;
+
+	float tune, fine, velSens;
+	float waveform;
+};
+
+/*
+ * Factory coefficients at one sample rate. Every instance running at that
+ * rate shares a bank, so changing patch is just a pointer swap and a new
+ * instance works nothing out. Banks are made on the control thread when an
+ * instance first needs the rate, and kept for the life of the process.
+ */
+struct Bank {
+	int sampleRate;
+	struct Coeffs coeffs[NUM_PATCHES];
+	struct Bank *next;
+};
+
+/*
+ * A patch edited in one instance. Setting a param copies the factory params
+ * into an edit from the instance's fixed pool, so the audio thread never
+ * allocates. An edit is marked dirty when one of its params is set, and its
+ * coefficients worked out again when next needed. Once the pool is used up,
+ * params set on patches that haven't been edited yet are dropped.
+ */
+struct Edit {
 	float params[NUM_PARAMS];
+	struct Coeffs coeffs;
+	bool dirty;
 };
 
-struct Voice {
-	int note;
+static const float factoryPatches[NUM_PATCHES][NUM_PARAMS] = {
+	{0.000, 0.650, 0.441, 0.842, 0.329, 0.230, 0.800, 0.050, 0.800, 0.900, 0.000, 0.500, 0.500, 0.447, 0.000, 0.414},
+	{0.000, 0.500, 0.100, 0.671, 0.000, 0.441, 0.336, 0.243, 0.800, 0.500, 0.000, 0.500, 0.500, 0.178, 0.000, 0.500},
+	{0.000, 0.700, 0.400, 0.230, 0.184, 0.270, 0.474, 0.224, 0.800, 0.974, 0.250, 0.500, 0.500, 0.428, 0.836, 0.500},
+	{0.000, 0.700, 0.400, 0.320, 0.217, 0.599, 0.670, 0.309, 0.800, 0.500, 0.263, 0.507, 0.500, 0.276, 0.638, 0.526},
+	{0.400, 0.600, 0.650, 0.760, 0.000, 0.390, 0.250, 0.160, 0.900, 0.500, 0.362, 0.500, 0.500, 0.401, 0.296, 0.493},
+	{0.000, 0.342, 0.000, 0.280, 0.000, 0.880, 0.100, 0.408, 0.740, 0.000, 0.000, 0.600, 0.500, 0.842, 0.651, 0.500},
+	{0.000, 0.400, 0.100, 0.360, 0.000, 0.875, 0.160, 0.592, 0.800, 0.500, 0.000, 0.500, 0.500, 0.303, 0.868, 0.500},
+	{0.000, 0.500, 0.704, 0.230, 0.000, 0.151, 0.750, 0.493, 0.770, 0.500, 0.000, 0.400, 0.500, 0.421, 0.632, 0.500},
+	{0.600, 0.990, 0.400, 0.320, 0.283, 0.570, 0.300, 0.050, 0.240, 0.500, 0.138, 0.500, 0.500, 0.283, 0.822, 0.500},
+	{0.000, 0.500, 0.650, 0.368, 0.651, 0.395, 0.550, 0.257, 0.900, 0.500, 0.300, 0.800, 0.500, 0.000, 0.414, 0.500},
+	{0.000, 0.700, 0.520, 0.230, 0.197, 0.520, 0.720, 0.280, 0.730, 0.500, 0.250, 0.500, 0.500, 0.336, 0.428, 0.500},
+	{0.000, 0.240, 0.000, 0.390, 0.000, 0.880, 0.100, 0.600, 0.740, 0.500, 0.000, 0.500, 0.500, 0.526, 0.480, 0.500},
+	{0.000, 0.500, 0.700, 0.160, 0.000, 0.158, 0.349, 0.000, 0.280, 0.900, 0.000, 0.618, 0.500, 0.401, 0.000, 0.500},
+	{0.000, 0.500, 0.100, 0.390, 0.000, 0.490, 0.250, 0.250, 0.800, 0.500, 0.000, 0.500, 0.500, 0.263, 0.145, 0.500},
+	{0.000, 0.300, 0.507, 0.480, 0.730, 0.000, 0.100, 0.303, 0.730, 1.000, 0.000, 0.600, 0.500, 0.579, 0.000, 0.500},
+	{0.000, 0.300, 0.500, 0.320, 0.000, 0.467, 0.079, 0.158, 0.500, 0.500, 0.000, 0.400, 0.500, 0.151, 0.020, 0.500},
+	{0.000, 0.990, 0.100, 0.230, 0.000, 0.000, 0.200, 0.450, 0.800, 0.000, 0.112, 0.600, 0.500, 0.711, 0.000, 0.401},
+	{0.280, 0.990, 0.280, 0.230, 0.000, 0.180, 0.400, 0.300, 0.800, 0.500, 0.000, 0.400, 0.500, 0.217, 0.480, 0.500},
+	{0.220, 0.990, 0.250, 0.170, 0.000, 0.240, 0.310, 0.257, 0.900, 0.757, 0.000, 0.500, 0.500, 0.697, 0.803, 0.500},
+	{0.220, 0.990, 0.250, 0.450, 0.070, 0.240, 0.310, 0.360, 0.900, 0.500, 0.211, 0.500, 0.500, 0.184, 0.000, 0.414},
+	{0.697, 0.990, 0.421, 0.230, 0.138, 0.750, 0.390, 0.513, 0.800, 0.316, 0.467, 0.678, 0.500, 0.743, 0.757, 0.487},
+	{0.000, 0.400, 0.000, 0.280, 0.125, 0.474, 0.250, 0.100, 0.500, 0.500, 0.000, 0.400, 0.500, 0.579, 0.592, 0.500},
+	{0.230, 0.500, 0.100, 0.395, 0.000, 0.388, 0.092, 0.250, 0.150, 0.500, 0.200, 0.200, 0.500, 0.178, 0.822, 0.500},
+	{0.000, 0.600, 0.400, 0.230, 0.000, 0.450, 0.320, 0.050, 0.900, 0.500, 0.000, 0.200, 0.500, 0.520, 0.105, 0.500},
+	{0.000, 0.600, 0.400, 0.170, 0.145, 0.290, 0.350, 0.100, 0.900, 0.500, 0.000, 0.400, 0.500, 0.441, 0.309, 0.500},
+	{0.000, 0.600, 0.490, 0.170, 0.151, 0.099, 0.400, 0.000, 0.900, 0.500, 0.000, 0.400, 0.500, 0.118, 0.013, 0.500},
+	{0.000, 0.600, 0.100, 0.320, 0.000, 0.350, 0.670, 0.100, 0.150, 0.500, 0.000, 0.200, 0.500, 0.303, 0.730, 0.500},
+	{0.300, 0.500, 0.400, 0.280, 0.000, 0.180, 0.540, 0.000, 0.700, 0.500, 0.000, 0.400, 0.500, 0.296, 0.033, 0.500},
+	{0.300, 0.500, 0.400, 0.360, 0.000, 0.461, 0.070, 0.070, 0.700, 0.500, 0.000, 0.400, 0.500, 0.546, 0.467, 0.500},
+	{0.000, 0.500, 0.500, 0.280, 0.000, 0.330, 0.200, 0.000, 0.700, 0.500, 0.000, 0.500, 0.500, 0.151, 0.079, 0.500},
+	{0.000, 0.500, 0.000, 0.000, 0.240, 0.580, 0.630, 0.000, 0.000, 0.500, 0.000, 0.600, 0.500, 0.816, 0.243, 0.500},
+	{0.000, 0.355, 0.350, 0.000, 0.105, 0.000, 0.000, 0.200, 0.500, 0.500, 0.000, 0.645, 0.500, 1.000, 0.296, 0.500}
+};
 
+/*
+ * Voice state is kept as one array per field, so the generate loop can work
+ * on several voices at once. Voices from alloc.numActive up are kept silent,
+ * as the vector loops run over whole vectors.
+ */
+struct Voices {
 	struct {
-		float phase, delta;
+		float phase[HM_MAX_VOICES], delta[HM_MAX_VOICES];
 	} carrier;
 
 	struct {
-		float d, x0, x1;
+		float d[HM_MAX_VOICES], x0[HM_MAX_VOICES], x1[HM_MAX_VOICES];
 	} mod;
 
 	struct {
-		float level;
-		float target;
-		float decay;
+		float level[HM_MAX_VOICES];
+		float target[HM_MAX_VOICES];
+		float decay[HM_MAX_VOICES];
 	} modEnv;
 
 	struct {
-		float attack, decay;
-		float decayLevel, level;
+		float attack[HM_MAX_VOICES], decay[HM_MAX_VOICES];
+		float decayLevel[HM_MAX_VOICES], level[HM_MAX_VOICES];
 	} env;
 };
 
+struct Dx10;
+typedef void (*GenerateVoices)(struct Dx10 *this, float *output, int samples, float mw);
+
 typedef struct Dx10 {
 	HmSynth base;
 
 	float sampleRate;
 
-	struct Patch patches[NUM_PATCHES];
+	const struct Bank *bank;
+	struct Edit edits[NUM_EDITS];
+	int numEdits;
+	signed char editOf[NUM_PATCHES];
 	int currentPatch;
 
-	struct Voice voices[NUM_VOICES];
+	HmVoices alloc;
+	struct Voices voices;
 	int activeVoices;
+	const GenerateVoices *kernels;
+	bool modActive;
 
-	bool sustain;
-
-	struct {
-		float attack, decay, release;
-	} env;
-
-	struct {
-		float ratio;
-		float initDepth, susDepth;
-		float decay, release;
-		float mix;
-	} mod;
+	const struct Coeffs *coeffs;
 
 	struct {
-		float d, x0, x1;
+		float x0, x1;
 		int t;
-		float vibrato, mw;
+		float mw;
 	} lfo;
 
-	float tune, pitchBend;
-	float modWheel, velSens, volume;
-	float waveform;
+	float pitchBend;
+	float modWheel, volume;
+
+	/*
+	 * The waveform and mod mix are used every sample, so the voice loops ramp
+	 * to them across a block rather than jumping.
+	 */
+	struct {
+		float waveform, mix;
+		float waveformStep, mixStep;
+	} ramp;
 } Dx10;
 
-static void update_params(Dx10 *this)
+static void update_coeffs(struct Coeffs *c, const float *params, float sampleRate)
 {
-	float sampleTime = 1.0f / this->sampleRate;
-	float *params = this->patches[this->currentPatch].params;
+	float sampleTime = 1.0f / sampleRate;
 
-	this->tune = MIDI_TO_FREQ_1 * sampleTime * powf(2.0f, floorf(params[11] * 6.9f) - 2.0f);
+	c->tune = MIDI_TO_FREQ_1 * sampleTime * powf(2.0f, floorf(params[11] * 6.9f) - 2.0f);
+	c->fine = expf(MIDI_TO_FREQ_2 * (2.0f * params[12] - 1.0f));
 
 	float ratio = floorf(40.1f * params[3] * params[3]);
 
@@ -128,104 +229,199 @@ static void update_params(Dx10 *this)
 		}
 	}
 
-	this->mod.ratio = HALF_PI * ratio;
-	this->mod.initDepth = 0.0002f * params[5] * params[5];
-	this->mod.susDepth = 0.0002f * params[7] * params[7];
+	c->mod.ratio = HALF_PI * ratio;
+	c->mod.initDepth = 0.0002f * params[5] * params[5];
+	c->mod.susDepth = 0.0002f * params[7] * params[7];
 
-	this->velSens = params[9];
-	this->lfo.vibrato = 0.001f * params[10] * params[10];
+	c->velSens = params[9];
+	c->lfo.vibrato = 0.001f * params[10] * params[10];
 
-	this->env.attack = 1.0f - expf(-sampleTime * expf(8.0f - 8.0f * params[0]));
+	c->env.attack = 1.0f - expf(-sampleTime * expf(8.0f - 8.0f * params[0]));
 
 	if(params[1] > 0.98f) {
-		this->env.decay = 1.0f;
+		c->env.decay = 1.0f;
 	} else {
-		this->env.decay = expf(-sampleTime * expf(5.0f - 8.0f * params[1]));
+		c->env.decay = expf(-sampleTime * expf(5.0f - 8.0f * params[1]));
 	}
 
-	this->env.release =        expf(-sampleTime * expf(5.0f - 5.0f * params[2]));
-	this->mod.decay =   1.0f - expf(-sampleTime * expf(6.0f - 7.0f * params[6]));
-	this->mod.release = 1.0f - expf(-sampleTime * expf(5.0f - 8.0f * params[8]));
+	c->env.release =        expf(-sampleTime * expf(5.0f - 5.0f * params[2]));
+	c->mod.decay =   1.0f - expf(-sampleTime * expf(6.0f - 7.0f * params[6]));
+	c->mod.release = 1.0f - expf(-sampleTime * expf(5.0f - 8.0f * params[8]));
 
-	this->waveform = 0.50f - 3.0f * params[13] * params[13];
-	this->mod.mix = 0.25f * params[14] * params[14];
-	this->lfo.d = 628.3f * sampleTime * 25.0f * params[15] * params[15]; //these params not in original DX10
+	c->waveform = 0.50f - 3.0f * params[13] * params[13];
+	c->mod.mix = 0.25f * params[14] * params[14];
+	c->lfo.d = 628.3f * sampleTime * 25.0f * params[15] * params[15]; //these params not in original DX10
 }
 
+static pthread_mutex_t banksLock = PTHREAD_MUTEX_INITIALIZER;
+static struct Bank *banks = NULL;
+
+/* Finds the shared bank for a sample rate, working it out the first time */
+static const struct Bank *get_bank(int sampleRate)
+{
+	pthread_mutex_lock(&banksLock);
+
+	struct Bank *bank = banks;
+	while (bank && bank->sampleRate != sampleRate) {
+		bank = bank->next;
+	}
+
+	if (!bank) {
+		bank = malloc(sizeof(struct Bank));
+		if (bank) {
+			bank->sampleRate = sampleRate;
+
+			for (int i = 0; i < NUM_PATCHES; i++) {
+				update_coeffs(&bank->coeffs[i], factoryPatches[i], sampleRate);
+			}
+
+			bank->next = banks;
+			banks = bank;
+		}
+	}
+
+	pthread_mutex_unlock(&banksLock);
+
+	return bank;
+}
+
+static const float *current_params(Dx10 *this)
+{
+	int edit = this->editOf[this->currentPatch];
+
+	return (edit < 0) ? factoryPatches[this->currentPatch] : this->edits[edit].params;
+}
+
+static void point_coeffs(Dx10 *this)
+{
+	int edit = this->editOf[this->currentPatch];
+
+	this->coeffs = (edit < 0) ? &this->bank->coeffs[this->currentPatch] : &this->edits[edit].coeffs;
+}
+
+static void refresh_params(Dx10 *this)
+{
+	int edit = this->editOf[this->currentPatch];
+
+	if (edit >= 0 && this->edits[edit].dirty) {
+		update_coeffs(&this->edits[edit].coeffs, this->edits[edit].params, this->sampleRate);
+		this->edits[edit].dirty = false;
+	}
+}
+
+/* Keeps the old bank if a new one can't be made, so the coefficients stay valid */
 static void set_sample_rate(HmSynth *base, int sampleRate)
 {
 	Dx10 *this = (Dx10 *)base;
 
+	const struct Bank *bank = get_bank(sampleRate);
+	if (!bank)
+		return;
+
+	this->bank = bank;
 	this->sampleRate = sampleRate;
-	update_params(this);
+
+	for (int i = 0; i < this->numEdits; i++) {
+		update_coeffs(&this->edits[i].coeffs, this->edits[i].params, sampleRate);
+		this->edits[i].dirty = false;
+	}
+
+	point_coeffs(this);
 }
 
-static struct Voice *find_next_voice(Dx10 *this)
+static void reset_voice(Dx10 *this, int i)
 {
-	float level = 1;
-	struct Voice *voice;
+	struct Voices *voices = &this->voices;
+
+	voices->carrier.phase[i] = 0;
+	voices->carrier.delta[i] = 0;
+	voices->mod.d[i] = 0;
+	voices->mod.x0[i] = 0;
+	voices->mod.x1[i] = 0;
+	voices->modEnv.level[i] = 0;
+	voices->modEnv.target[i] = 0;
+	voices->modEnv.decay[i] = 0;
+	voices->env.attack[i] = 0;
+	voices->env.decay[i] = 0.99f;
+	voices->env.decayLevel[i] = 0;
+	voices->env.level[i] = 0;
+}
 
-	for (int i = 0; i < NUM_VOICES; i++) {
-		if (this->voices[i].env.decayLevel < level) {
-			level = this->voices[i].env.decayLevel;
-			voice = &this->voices[i];
-		}
-	}
+static void move_voice(void *synth, int from, int to)
+{
+	struct Voices *voices = &((Dx10 *)synth)->voices;
+
+	voices->carrier.phase[to] = voices->carrier.phase[from];
+	voices->carrier.delta[to] = voices->carrier.delta[from];
+	voices->mod.d[to] = voices->mod.d[from];
+	voices->mod.x0[to] = voices->mod.x0[from];
+	voices->mod.x1[to] = voices->mod.x1[from];
+	voices->modEnv.level[to] = voices->modEnv.level[from];
+	voices->modEnv.target[to] = voices->modEnv.target[from];
+	voices->modEnv.decay[to] = voices->modEnv.decay[from];
+	voices->env.attack[to] = voices->env.attack[from];
+	voices->env.decay[to] = voices->env.decay[from];
+	voices->env.decayLevel[to] = voices->env.decayLevel[from];
+	voices->env.level[to] = voices->env.level[from];
+
+	reset_voice(synth, from);
+}
+
+static void release_voice(void *synth, int i)
+{
+	Dx10 *this = synth;
+	struct Voices *voices = &this->voices;
 
-	return voice;
+	refresh_params(this);
+
+	voices->env.decay[i] = this->coeffs->env.release; //release phase
+	voices->env.decayLevel[i] = voices->env.level[i];
+	voices->env.attack[i] = 1.0f;
+	voices->modEnv.target[i] = 0.0f;
+	voices->modEnv.decay[i] = this->coeffs->mod.release;
 }
 
 static void start_note(HmSynth *base, int note, float velocity)
 {
 	Dx10 *this = (Dx10 *)base;
 
-	float *params = this->patches[this->currentPatch].params;
-	struct Voice *voice = find_next_voice(this);
+	int i = hm_voices_start(&this->alloc, note);
+	if (i < 0)
+		return;
+
+	refresh_params(this);
 
-	float delta = expf(MIDI_TO_FREQ_2 * ((float)note + 2.0f * params[12] - 1.0f));
-	voice->note = note;
-	voice->carrier.phase = 0.0f;
-	voice->carrier.delta = this->tune * this->pitchBend * delta;
+	const float *params = current_params(this);
+	struct Voices *voices = &this->voices;
+
+	float delta = hm_note_freqs[note] / MIDI_TO_FREQ_1 * this->coeffs->fine;
+	voices->carrier.phase[i] = 0.0f;
+	voices->carrier.delta[i] = this->coeffs->tune * this->pitchBend * delta;
 
 	if (delta > 50.0f) delta = 50.0f; //key tracking
 
-	float depth = delta * (64.0f + this->velSens * (velocity * 127.0f - 64.0f));
-	voice->modEnv.level = this->mod.initDepth * depth;
-	voice->modEnv.target = this->mod.susDepth * depth;
-	voice->modEnv.decay = this->mod.decay;
+	float depth = delta * (64.0f + this->coeffs->velSens * (velocity * 127.0f - 64.0f));
+	voices->modEnv.level[i] = this->coeffs->mod.initDepth * depth;
+	voices->modEnv.target[i] = this->coeffs->mod.susDepth * depth;
+	voices->modEnv.decay[i] = this->coeffs->mod.decay;
 
-	float modDelta = this->mod.ratio * voice->carrier.delta;
-	voice->mod.x0 = 0.0f;
-	voice->mod.x1 = sinf(modDelta);
-	voice->mod.d = 2.0f * cosf(modDelta);
+	float modDelta = this->coeffs->mod.ratio * voices->carrier.delta[i];
+	voices->mod.x0[i] = 0.0f;
+	voices->mod.x1[i] = sinf(modDelta);
+	voices->mod.d[i] = 2.0f * cosf(modDelta);
 
 	//scale volume with richness
-	voice->env.decayLevel = (1.5f - params[13]) * this->volume * (velocity * 127.0f + 10.0f);
-	voice->env.attack = this->env.attack;
-	voice->env.level = 0.0f;
-	voice->env.decay = this->env.decay;
+	voices->env.decayLevel[i] = (1.5f - params[13]) * this->volume * (velocity * 127.0f + 10.0f);
+	voices->env.attack[i] = this->coeffs->env.attack;
+	voices->env.level[i] = 0.0f;
+	voices->env.decay[i] = this->coeffs->env.decay;
 }
 
 static void stop_note(HmSynth *base, int note)
 {
 	Dx10 *this = (Dx10 *)base;
 
-	for (int i = 0; i < NUM_VOICES; i++) {
-		struct Voice *voice = &this->voices[i];
-
-		if (voice->note == note) {
-			if (!this->sustain) {
-				voice->env.decay = this->env.release; //release phase
-				voice->env.decayLevel = voice->env.level;
-				voice->env.attack = 1.0f;
-				voice->modEnv.target = 0.0f;
-				voice->modEnv.decay = this->mod.release;
-
-			} else {
-				voice->note = SUSTAIN_NOTE;
-			}
-		}
-	}
+	hm_voices_stop(&this->alloc, note);
 }
 
 static void set_pitch(HmSynth *base, float pitch)
@@ -248,10 +444,7 @@ static void set_control(HmSynth *base, int control, float value)
 			this->volume = 0.00564515f * value * value;
 
 		case 64:
-			this->sustain = value >= 0.5f;
-			if (!this->sustain) {
-				stop_note(base, SUSTAIN_NOTE);
-			}
+			hm_voices_set_sustain(&this->alloc, value >= 0.5f);
 			break;
 
 		case 123:
@@ -259,8 +452,8 @@ static void set_control(HmSynth *base, int control, float value)
 		case 125:
 		case 126:
 		case 127:
-			for (int i = 0; i < NUM_VOICES; i++) {
-				this->voices[i].env.decay = 0.99f;
+			for (int i = 0; i < this->alloc.numActive; i++) {
+				this->voices.env.decay[i] = 0.99f;
 			}
 			break;
 	}
@@ -276,15 +469,47 @@ static float get_param(HmSynth *base, int param)
 {
 	Dx10 *this = (Dx10 *)base;
 
-	return this->patches[this->currentPatch].params[param];
+	return current_params(this)[param];
 }
 
 static void set_param(HmSynth *base, int param, float value)
 {
 	Dx10 *this = (Dx10 *)base;
 
-	this->patches[this->currentPatch].params[param] = value;
-	update_params(this);
+	int edit = this->editOf[this->currentPatch];
+
+	if (edit < 0) {
+		if (this->numEdits == NUM_EDITS)
+			return;
+
+		edit = this->numEdits++;
+		memcpy(this->edits[edit].params, factoryPatches[this->currentPatch], sizeof(float) * NUM_PARAMS);
+		this->edits[edit].coeffs = this->bank->coeffs[this->currentPatch];
+		this->editOf[this->currentPatch] = edit;
+		point_coeffs(this);
+	}
+
+	this->edits[edit].params[param] = value;
+	this->edits[edit].dirty = true;
+}
+
+static int get_polyphony(HmSynth *base)
+{
+	Dx10 *this = (Dx10 *)base;
+
+	return this->alloc.numVoices;
+}
+
+static void set_polyphony(HmSynth *base, int numVoices)
+{
+	Dx10 *this = (Dx10 *)base;
+	int numActive = this->alloc.numActive;
+
+	hm_voices_set_polyphony(&this->alloc, numVoices);
+
+	for (int i = this->alloc.numActive; i < numActive; i++) {
+		reset_voice(this, i);
+	}
 }
 
 static int get_num_patches(HmSynth *base)
@@ -296,8 +521,11 @@ static void set_patch(HmSynth *base, int patch)
 {
 	Dx10 *this = (Dx10 *)base;
 
+	if (patch < 0 || patch >= NUM_PATCHES)
+		return;
+
 	this->currentPatch = patch;
-	update_params(this);
+	point_coeffs(this);
 }
 
 static int get_patch(HmSynth *base)
@@ -307,127 +535,416 @@ static int get_patch(HmSynth *base)
 	return this->currentPatch;
 }
 
+/*
+ * Frees voices that have gone silent, from the end as freeing moves the last,
+ * and notes whether any mod envelope is still going
+ */
 static void update_voices(Dx10 *this)
 {
-	this->activeVoices = NUM_VOICES;
+	struct Voices *voices = &this->voices;
 
-	for (int i = 0; i < NUM_VOICES; i++) {
-		if (this->voices[i].env.decayLevel < SILENCE) {
-			this->voices[i].env.decayLevel = 0.0f;
-			this->voices[i].env.level = 0.0f;
-			this->activeVoices--;
+	this->modActive = false;
+
+	for (int i = this->alloc.numActive - 1; i >= 0; i--) {
+		if (voices->modEnv.level[i] < SILENCE) {
+			voices->modEnv.level[i] = 0.0f;
+			voices->modEnv.target[i] = 0.0f;
+		} else {
+			this->modActive = true;
 		}
 
-		if (this->voices[i].modEnv.level < SILENCE) {
-			this->voices[i].modEnv.level = 0.0f;
-			this->voices[i].modEnv.target = 0.0f;
+		if (voices->env.decayLevel[i] < SILENCE) {
+			reset_voice(this, i);
+			hm_voices_free(&this->alloc, i);
 		}
 	}
+
+	this->activeVoices = this->alloc.numActive;
 }
 
-static void generate(HmSynth *base, float *output, int samples)
-{
-	Dx10 *this = (Dx10 *)base;
+/*
+ * The voice loops add samples of every sounding voice to output, with the
+ * LFO held at mw. Silent voices are skipped, or masked out in the vector
+ * versions, and are left as they were.
+ *
+ * Each loop is built once for every combination of the optional paths
+ * below, so a patch that doesn't use one doesn't test for it per sample.
+ * A path left out must contribute exactly nothing, so every version gives
+ * the same output:
+ *   KERNEL_MIX   the modulator is mixed into the output (Mod Thru)
+ *   KERNEL_LFO   mw is non-zero
+ *   KERNEL_MOD   some voice's mod envelope is non-zero
+ *   KERNEL_RAMP  the waveform and mod mix are ramping
+ */
+enum {
+	KERNEL_MIX = 1,
+	KERNEL_LFO = 2,
+	KERNEL_MOD = 4,
+	KERNEL_RAMP = 8,
+	NUM_KERNELS = 16
+};
 
-	int lfoT = this->lfo.t;
-	float mw = this->lfo.mw;
+#define KERNEL_VARIANT(kernel, attr, flags) \
+	attr static void kernel##_##flags(Dx10 *this, float *output, int samples, float mw) \
+	{ \
+		kernel(this, output, samples, mw, flags); \
+	}
 
-	update_voices(this);
+#define KERNEL_VARIANTS(kernel, attr) \
+	KERNEL_VARIANT(kernel, attr, 0)  KERNEL_VARIANT(kernel, attr, 1) \
+	KERNEL_VARIANT(kernel, attr, 2)  KERNEL_VARIANT(kernel, attr, 3) \
+	KERNEL_VARIANT(kernel, attr, 4)  KERNEL_VARIANT(kernel, attr, 5) \
+	KERNEL_VARIANT(kernel, attr, 6)  KERNEL_VARIANT(kernel, attr, 7) \
+	KERNEL_VARIANT(kernel, attr, 8)  KERNEL_VARIANT(kernel, attr, 9) \
+	KERNEL_VARIANT(kernel, attr, 10) KERNEL_VARIANT(kernel, attr, 11) \
+	KERNEL_VARIANT(kernel, attr, 12) KERNEL_VARIANT(kernel, attr, 13) \
+	KERNEL_VARIANT(kernel, attr, 14) KERNEL_VARIANT(kernel, attr, 15) \
+	static const GenerateVoices kernel##_variants[NUM_KERNELS] = { \
+		kernel##_0,  kernel##_1,  kernel##_2,  kernel##_3, \
+		kernel##_4,  kernel##_5,  kernel##_6,  kernel##_7, \
+		kernel##_8,  kernel##_9,  kernel##_10, kernel##_11, \
+		kernel##_12, kernel##_13, kernel##_14, kernel##_15 \
+	};
 
-	if (this->activeVoices == 0)
-		return;
+#ifndef HAVE_SSE2
+static inline __attribute__((always_inline))
+void generate_voices_scalar(Dx10 *this, float *output, int samples, float mw, const int flags)
+{
+	struct Voices *v = &this->voices;
+	float waveform = this->ramp.waveform;
+	float mix = this->ramp.mix;
 
-	while (--samples >= 0) {
+	for (int n = 0; n < samples; n++) {
 		float out = 0.0f;
 
-		if(--lfoT < 0) {
-			this->lfo.x0 += this->lfo.d * this->lfo.x1; //sine LFO
-			this->lfo.x1 -= this->lfo.d * this->lfo.x0;
-			mw = this->lfo.x1 * (this->modWheel + this->lfo.vibrato);
-			lfoT = 100;
+		if (flags & KERNEL_RAMP) {
+			waveform += this->ramp.waveformStep;
+			mix += this->ramp.mixStep;
 		}
 
-		for (int i = 0; i < NUM_VOICES; i++) {
-			struct Voice *voice = &this->voices[i];
-
-			float env = voice->env.decayLevel;
+		for (int i = 0; i < this->alloc.numActive; i++) {
+			float env = v->env.decayLevel[i];
 			if (env < SILENCE)
 				continue;
 
-			voice->env.decayLevel = env * voice->env.decay;
-			voice->env.level += voice->env.attack * (env - voice->env.level);
+			v->env.decayLevel[i] = env * v->env.decay[i];
+			v->env.level[i] += v->env.attack[i] * (env - v->env.level[i]);
 
-			float mod = voice->mod.d * voice->mod.x0 - voice->mod.x1;
-			voice->mod.x1 = voice->mod.x0;
-			voice->mod.x0 = mod;
-			voice->modEnv.level += voice->modEnv.decay * (voice->modEnv.target - voice->modEnv.level);
+			float mod = v->mod.d[i] * v->mod.x0[i] - v->mod.x1[i];
+			v->mod.x1[i] = v->mod.x0[i];
+			v->mod.x0[i] = mod;
 
-			float phase = voice->carrier.phase + voice->carrier.delta + mod * voice->modEnv.level + mw;
+			float phase = v->carrier.phase[i] + v->carrier.delta[i];
+			if (flags & KERNEL_MOD) {
+				v->modEnv.level[i] += v->modEnv.decay[i] * (v->modEnv.target[i] - v->modEnv.level[i]);
+				phase += mod * v->modEnv.level[i];
+			}
+			if (flags & KERNEL_LFO) {
+				phase += mw;
+			}
 			while (phase >  1.0f) phase -= 2.0f;
 			while (phase < -1.0f) phase += 2.0f;
-			voice->carrier.phase = phase;
+			v->carrier.phase[i] = phase;
 
 			float x = phase;
-			float wave = x + x * x * x * (this->waveform * x * x - this->waveform - 1.0f);
+			float wave = x + x * x * x * (waveform * x * x - waveform - 1.0f);
 
-			out += voice->env.level * (this->mod.mix * voice->mod.x1 + wave);
+			if (flags & KERNEL_MIX) {
+				out += v->env.level[i] * (mix * v->mod.x1[i] + wave);
+			} else {
+				out += v->env.level[i] * wave;
+			}
 		}
 
-		*output++ += out;
+		output[n] += out;
 	}
 
-	this->lfo.t = lfoT;
-	this->lfo.mw = mw;
+	this->ramp.waveform = waveform;
+	this->ramp.mix = mix;
 }
 
-static void free_synth(HmSynth *synth)
+KERNEL_VARIANTS(generate_voices_scalar, )
+#endif
+
+#ifdef HAVE_SSE2
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b)
 {
-	free(synth);
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
 }
 
-static void set_patch_params(Dx10 *this, int patch, float params[NUM_PARAMS])
+static inline __attribute__((always_inline))
+void generate_voices_sse2(Dx10 *this, float *output, int samples, float mw, const int flags)
 {
-	float *patch_params = this->patches[patch].params;
+	struct Voices *v = &this->voices;
+	const __m128 silence = _mm_set1_ps(SILENCE);
+	const __m128 lfo = _mm_set1_ps(mw);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	int numVoices = (this->alloc.numActive + 3) & ~3;
+	float rampWaveform = this->ramp.waveform;
+	float rampMix = this->ramp.mix;
+
+	for (int n = 0; n < samples; n++) {
+		__m128 out = _mm_setzero_ps();
+
+		if (flags & KERNEL_RAMP) {
+			rampWaveform += this->ramp.waveformStep;
+			rampMix += this->ramp.mixStep;
+		}
+		const __m128 waveform = _mm_set1_ps(rampWaveform);
+		const __m128 waveform1 = _mm_set1_ps(rampWaveform + 1.0f);
+		const __m128 mix = _mm_set1_ps(rampMix);
+
+		for (int i = 0; i < numVoices; i += 4) {
+			__m128 env = _mm_loadu_ps(&v->env.decayLevel[i]);
+			__m128 on = _mm_cmpge_ps(env, silence);
+
+			__m128 level = _mm_loadu_ps(&v->env.level[i]);
+			level = _mm_add_ps(level, _mm_mul_ps(_mm_loadu_ps(&v->env.attack[i]), _mm_sub_ps(env, level)));
+			level = select_ps(on, level, _mm_loadu_ps(&v->env.level[i]));
+			_mm_storeu_ps(&v->env.level[i], level);
+			_mm_storeu_ps(&v->env.decayLevel[i], select_ps(on, _mm_mul_ps(env, _mm_loadu_ps(&v->env.decay[i])), env));
+
+			__m128 x0 = _mm_loadu_ps(&v->mod.x0[i]);
+			__m128 x1 = _mm_loadu_ps(&v->mod.x1[i]);
+			__m128 mod = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&v->mod.d[i]), x0), x1);
+			x1 = select_ps(on, x0, x1);
+			_mm_storeu_ps(&v->mod.x1[i], x1);
+			_mm_storeu_ps(&v->mod.x0[i], select_ps(on, mod, x0));
+
+			__m128 oldPhase = _mm_loadu_ps(&v->carrier.phase[i]);
+			__m128 phase = _mm_add_ps(oldPhase, _mm_loadu_ps(&v->carrier.delta[i]));
+			if (flags & KERNEL_MOD) {
+				__m128 modLevel = _mm_loadu_ps(&v->modEnv.level[i]);
+				__m128 newModLevel = _mm_add_ps(modLevel, _mm_mul_ps(_mm_loadu_ps(&v->modEnv.decay[i]),
+					_mm_sub_ps(_mm_loadu_ps(&v->modEnv.target[i]), modLevel)));
+				_mm_storeu_ps(&v->modEnv.level[i], select_ps(on, newModLevel, modLevel));
+
+				__m128 modOut = _mm_mul_ps(mod, newModLevel);
+				phase = _mm_add_ps(phase, (flags & KERNEL_LFO) ? _mm_add_ps(modOut, lfo) : modOut);
+			} else if (flags & KERNEL_LFO) {
+				phase = _mm_add_ps(phase, lfo);
+			}
+			/* Wrap into [-1, 1] by rounding to the nearest multiple of two */
+			phase = _mm_sub_ps(phase, _mm_mul_ps(two, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(phase, half)))));
+			_mm_storeu_ps(&v->carrier.phase[i], select_ps(on, phase, oldPhase));
+
+			__m128 xx = _mm_mul_ps(phase, phase);
+			__m128 wave = _mm_add_ps(phase, _mm_mul_ps(_mm_mul_ps(xx, phase), _mm_sub_ps(_mm_mul_ps(waveform, xx), waveform1)));
 
-	for (int i = 0; i < NUM_PARAMS; i++) {
-		patch_params[i] = params[i];
+			__m128 voiceOut = _mm_mul_ps(level, (flags & KERNEL_MIX) ? _mm_add_ps(_mm_mul_ps(mix, x1), wave) : wave);
+			out = _mm_add_ps(out, _mm_and_ps(on, voiceOut));
+		}
+
+		out = _mm_add_ps(out, _mm_movehl_ps(out, out));
+		out = _mm_add_ss(out, _mm_shuffle_ps(out, out, 1));
+		output[n] += _mm_cvtss_f32(out);
 	}
+
+	this->ramp.waveform = rampWaveform;
+	this->ramp.mix = rampMix;
 }
 
-static void fill_patches(Dx10 *this)
-{
-	set_patch_params(this,  0, (float[]){0.000, 0.650, 0.441, 0.842, 0.329, 0.230, 0.800, 0.050, 0.800, 0.900, 0.000, 0.500, 0.500, 0.447, 0.000, 0.414});
-	set_patch_params(this,  1, (float[]){0.000, 0.500, 0.100, 0.671, 0.000, 0.441, 0.336, 0.243, 0.800, 0.500, 0.000, 0.500, 0.500, 0.178, 0.000, 0.500});
-	set_patch_params(this,  2, (float[]){0.000, 0.700, 0.400, 0.230, 0.184, 0.270, 0.474, 0.224, 0.800, 0.974, 0.250, 0.500, 0.500, 0.428, 0.836, 0.500});
-	set_patch_params(this,  3, (float[]){0.000, 0.700, 0.400, 0.320, 0.217, 0.599, 0.670, 0.309, 0.800, 0.500, 0.263, 0.507, 0.500, 0.276, 0.638, 0.526});
-	set_patch_params(this,  4, (float[]){0.400, 0.600, 0.650, 0.760, 0.000, 0.390, 0.250, 0.160, 0.900, 0.500, 0.362, 0.500, 0.500, 0.401, 0.296, 0.493});
-	set_patch_params(this,  5, (float[]){0.000, 0.342, 0.000, 0.280, 0.000, 0.880, 0.100, 0.408, 0.740, 0.000, 0.000, 0.600, 0.500, 0.842, 0.651, 0.500});
-	set_patch_params(this,  6, (float[]){0.000, 0.400, 0.100, 0.360, 0.000, 0.875, 0.160, 0.592, 0.800, 0.500, 0.000, 0.500, 0.500, 0.303, 0.868, 0.500});
-	set_patch_params(this,  7, (float[]){0.000, 0.500, 0.704, 0.230, 0.000, 0.151, 0.750, 0.493, 0.770, 0.500, 0.000, 0.400, 0.500, 0.421, 0.632, 0.500});
-	set_patch_params(this,  8, (float[]){0.600, 0.990, 0.400, 0.320, 0.283, 0.570, 0.300, 0.050, 0.240, 0.500, 0.138, 0.500, 0.500, 0.283, 0.822, 0.500});
-	set_patch_params(this,  9, (float[]){0.000, 0.500, 0.650, 0.368, 0.651, 0.395, 0.550, 0.257, 0.900, 0.500, 0.300, 0.800, 0.500, 0.000, 0.414, 0.500});
-	set_patch_params(this, 10, (float[]){0.000, 0.700, 0.520, 0.230, 0.197, 0.520, 0.720, 0.280, 0.730, 0.500, 0.250, 0.500, 0.500, 0.336, 0.428, 0.500});
-	set_patch_params(this, 11, (float[]){0.000, 0.240, 0.000, 0.390, 0.000, 0.880, 0.100, 0.600, 0.740, 0.500, 0.000, 0.500, 0.500, 0.526, 0.480, 0.500});
-	set_patch_params(this, 12, (float[]){0.000, 0.500, 0.700, 0.160, 0.000, 0.158, 0.349, 0.000, 0.280, 0.900, 0.000, 0.618, 0.500, 0.401, 0.000, 0.500});
-	set_patch_params(this, 13, (float[]){0.000, 0.500, 0.100, 0.390, 0.000, 0.490, 0.250, 0.250, 0.800, 0.500, 0.000, 0.500, 0.500, 0.263, 0.145, 0.500});
-	set_patch_params(this, 14, (float[]){0.000, 0.300, 0.507, 0.480, 0.730, 0.000, 0.100, 0.303, 0.730, 1.000, 0.000, 0.600, 0.500, 0.579, 0.000, 0.500});
-	set_patch_params(this, 15, (float[]){0.000, 0.300, 0.500, 0.320, 0.000, 0.467, 0.079, 0.158, 0.500, 0.500, 0.000, 0.400, 0.500, 0.151, 0.020, 0.500});
-	set_patch_params(this, 16, (float[]){0.000, 0.990, 0.100, 0.230, 0.000, 0.000, 0.200, 0.450, 0.800, 0.000, 0.112, 0.600, 0.500, 0.711, 0.000, 0.401});
-	set_patch_params(this, 17, (float[]){0.280, 0.990, 0.280, 0.230, 0.000, 0.180, 0.400, 0.300, 0.800, 0.500, 0.000, 0.400, 0.500, 0.217, 0.480, 0.500});
-	set_patch_params(this, 18, (float[]){0.220, 0.990, 0.250, 0.170, 0.000, 0.240, 0.310, 0.257, 0.900, 0.757, 0.000, 0.500, 0.500, 0.697, 0.803, 0.500});
-	set_patch_params(this, 19, (float[]){0.220, 0.990, 0.250, 0.450, 0.070, 0.240, 0.310, 0.360, 0.900, 0.500, 0.211, 0.500, 0.500, 0.184, 0.000, 0.414});
-	set_patch_params(this, 20, (float[]){0.697, 0.990, 0.421, 0.230, 0.138, 0.750, 0.390, 0.513, 0.800, 0.316, 0.467, 0.678, 0.500, 0.743, 0.757, 0.487});
-	set_patch_params(this, 21, (float[]){0.000, 0.400, 0.000, 0.280, 0.125, 0.474, 0.250, 0.100, 0.500, 0.500, 0.000, 0.400, 0.500, 0.579, 0.592, 0.500});
-	set_patch_params(this, 22, (float[]){0.230, 0.500, 0.100, 0.395, 0.000, 0.388, 0.092, 0.250, 0.150, 0.500, 0.200, 0.200, 0.500, 0.178, 0.822, 0.500});
-	set_patch_params(this, 23, (float[]){0.000, 0.600, 0.400, 0.230, 0.000, 0.450, 0.320, 0.050, 0.900, 0.500, 0.000, 0.200, 0.500, 0.520, 0.105, 0.500});
-	set_patch_params(this, 24, (float[]){0.000, 0.600, 0.400, 0.170, 0.145, 0.290, 0.350, 0.100, 0.900, 0.500, 0.000, 0.400, 0.500, 0.441, 0.309, 0.500});
-	set_patch_params(this, 25, (float[]){0.000, 0.600, 0.490, 0.170, 0.151, 0.099, 0.400, 0.000, 0.900, 0.500, 0.000, 0.400, 0.500, 0.118, 0.013, 0.500});
-	set_patch_params(this, 26, (float[]){0.000, 0.600, 0.100, 0.320, 0.000, 0.350, 0.670, 0.100, 0.150, 0.500, 0.000, 0.200, 0.500, 0.303, 0.730, 0.500});
-	set_patch_params(this, 27, (float[]){0.300, 0.500, 0.400, 0.280, 0.000, 0.180, 0.540, 0.000, 0.700, 0.500, 0.000, 0.400, 0.500, 0.296, 0.033, 0.500});
-	set_patch_params(this, 28, (float[]){0.300, 0.500, 0.400, 0.360, 0.000, 0.461, 0.070, 0.070, 0.700, 0.500, 0.000, 0.400, 0.500, 0.546, 0.467, 0.500});
-	set_patch_params(this, 29, (float[]){0.000, 0.500, 0.500, 0.280, 0.000, 0.330, 0.200, 0.000, 0.700, 0.500, 0.000, 0.500, 0.500, 0.151, 0.079, 0.500});
-	set_patch_params(this, 30, (float[]){0.000, 0.500, 0.000, 0.000, 0.240, 0.580, 0.630, 0.000, 0.000, 0.500, 0.000, 0.600, 0.500, 0.816, 0.243, 0.500});
-	set_patch_params(this, 31, (float[]){0.000, 0.355, 0.350, 0.000, 0.105, 0.000, 0.000, 0.200, 0.500, 0.500, 0.000, 0.645, 0.500, 1.000, 0.296, 0.500});
+KERNEL_VARIANTS(generate_voices_sse2, )
+#endif
+
+#ifdef HAVE_AVX
+static inline __attribute__((always_inline, target("avx")))
+void generate_voices_avx(Dx10 *this, float *output, int samples, float mw, const int flags)
+{
+	struct Voices *v = &this->voices;
+	const __m256 silence = _mm256_set1_ps(SILENCE);
+	const __m256 lfo = _mm256_set1_ps(mw);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	int numVoices = (this->alloc.numActive + 7) & ~7;
+	float rampWaveform = this->ramp.waveform;
+	float rampMix = this->ramp.mix;
+
+	for (int n = 0; n < samples; n++) {
+		__m256 out = _mm256_setzero_ps();
+
+		if (flags & KERNEL_RAMP) {
+			rampWaveform += this->ramp.waveformStep;
+			rampMix += this->ramp.mixStep;
+		}
+		const __m256 waveform = _mm256_set1_ps(rampWaveform);
+		const __m256 waveform1 = _mm256_set1_ps(rampWaveform + 1.0f);
+		const __m256 mix = _mm256_set1_ps(rampMix);
+
+		for (int i = 0; i < numVoices; i += 8) {
+			__m256 env = _mm256_loadu_ps(&v->env.decayLevel[i]);
+			__m256 on = _mm256_cmp_ps(env, silence, _CMP_GE_OQ);
+
+			__m256 oldLevel = _mm256_loadu_ps(&v->env.level[i]);
+			__m256 level = _mm256_add_ps(oldLevel, _mm256_mul_ps(_mm256_loadu_ps(&v->env.attack[i]), _mm256_sub_ps(env, oldLevel)));
+			level = _mm256_blendv_ps(oldLevel, level, on);
+			_mm256_storeu_ps(&v->env.level[i], level);
+			_mm256_storeu_ps(&v->env.decayLevel[i], _mm256_blendv_ps(env, _mm256_mul_ps(env, _mm256_loadu_ps(&v->env.decay[i])), on));
+
+			__m256 x0 = _mm256_loadu_ps(&v->mod.x0[i]);
+			__m256 x1 = _mm256_loadu_ps(&v->mod.x1[i]);
+			__m256 mod = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(&v->mod.d[i]), x0), x1);
+			x1 = _mm256_blendv_ps(x1, x0, on);
+			_mm256_storeu_ps(&v->mod.x1[i], x1);
+			_mm256_storeu_ps(&v->mod.x0[i], _mm256_blendv_ps(x0, mod, on));
+
+			__m256 oldPhase = _mm256_loadu_ps(&v->carrier.phase[i]);
+			__m256 phase = _mm256_add_ps(oldPhase, _mm256_loadu_ps(&v->carrier.delta[i]));
+			if (flags & KERNEL_MOD) {
+				__m256 modLevel = _mm256_loadu_ps(&v->modEnv.level[i]);
+				__m256 newModLevel = _mm256_add_ps(modLevel, _mm256_mul_ps(_mm256_loadu_ps(&v->modEnv.decay[i]),
+					_mm256_sub_ps(_mm256_loadu_ps(&v->modEnv.target[i]), modLevel)));
+				_mm256_storeu_ps(&v->modEnv.level[i], _mm256_blendv_ps(modLevel, newModLevel, on));
+
+				__m256 modOut = _mm256_mul_ps(mod, newModLevel);
+				phase = _mm256_add_ps(phase, (flags & KERNEL_LFO) ? _mm256_add_ps(modOut, lfo) : modOut);
+			} else if (flags & KERNEL_LFO) {
+				phase = _mm256_add_ps(phase, lfo);
+			}
+			phase = _mm256_sub_ps(phase, _mm256_mul_ps(two,
+				_mm256_round_ps(_mm256_mul_ps(phase, half), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)));
+			_mm256_storeu_ps(&v->carrier.phase[i], _mm256_blendv_ps(oldPhase, phase, on));
+
+			__m256 xx = _mm256_mul_ps(phase, phase);
+			__m256 wave = _mm256_add_ps(phase, _mm256_mul_ps(_mm256_mul_ps(xx, phase), _mm256_sub_ps(_mm256_mul_ps(waveform, xx), waveform1)));
+
+			__m256 voiceOut = _mm256_mul_ps(level, (flags & KERNEL_MIX) ? _mm256_add_ps(_mm256_mul_ps(mix, x1), wave) : wave);
+			out = _mm256_add_ps(out, _mm256_and_ps(on, voiceOut));
+		}
+
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(out), _mm256_extractf128_ps(out, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		output[n] += _mm_cvtss_f32(sum);
+	}
+
+	this->ramp.waveform = rampWaveform;
+	this->ramp.mix = rampMix;
+}
+
+KERNEL_VARIANTS(generate_voices_avx, __attribute__((target("avx"))))
+#endif
+
+/* Picks the widest voice loops the CPU can run */
+static const GenerateVoices *choose_kernels(void)
+{
+#ifdef HAVE_AVX
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return generate_voices_avx_variants;
+#endif
+
+#ifdef HAVE_SSE2
+	return generate_voices_sse2_variants;
+#else
+	return generate_voices_scalar_variants;
+#endif
+}
+
+static void generate(HmSynth *base, float *output, int samples)
+{
+	Dx10 *this = (Dx10 *)base;
+
+	int lfoT = this->lfo.t;
+	float mw = this->lfo.mw;
+
+	refresh_params(this);
+	update_voices(this);
+
+	if (this->activeVoices == 0 || samples <= 0) {
+		this->ramp.waveform = this->coeffs->waveform;
+		this->ramp.mix = this->coeffs->mod.mix;
+		return;
+	}
+
+	this->ramp.waveformStep = (this->coeffs->waveform - this->ramp.waveform) / samples;
+	this->ramp.mixStep = (this->coeffs->mod.mix - this->ramp.mix) / samples;
+
+	int flags = 0;
+	if (this->coeffs->mod.mix != 0.0f || this->ramp.mix != 0.0f)
+		flags |= KERNEL_MIX;
+	if (this->modActive)
+		flags |= KERNEL_MOD;
+	if (this->ramp.waveformStep != 0.0f || this->ramp.mixStep != 0.0f)
+		flags |= KERNEL_RAMP;
+
+	/* The LFO steps every 101 samples, so the voices run between steps */
+	while (samples > 0) {
+		if (lfoT == 0) {
+			this->lfo.x0 += this->coeffs->lfo.d * this->lfo.x1; //sine LFO
+			this->lfo.x1 -= this->coeffs->lfo.d * this->lfo.x0;
+			mw = this->lfo.x1 * (this->modWheel + this->coeffs->lfo.vibrato);
+			lfoT = 101;
+		}
+
+		int run = (samples < lfoT) ? samples : lfoT;
+		this->kernels[(mw != 0.0f) ? flags | KERNEL_LFO : flags](this, output, run, mw);
+
+		output += run;
+		samples -= run;
+		lfoT -= run;
+	}
+
+	this->lfo.t = lfoT;
+	this->lfo.mw = mw;
+
+	/* Land exactly on the targets, whatever rounding the ramps picked up */
+	this->ramp.waveform = this->coeffs->waveform;
+	this->ramp.mix = this->coeffs->mod.mix;
+}
+
+/*
+ * Renders a block with its events, calling the handlers directly rather
+ * than going back through the band for each one
+ */
+static void process(HmSynth *base, const HmEvent *events, int numEvents, float *output, int samples)
+{
+	int done = 0;
+
+	for (int i = 0; i < numEvents; i++) {
+		const HmEvent *event = &events[i];
+
+		if ((int)event->time > done) {
+			generate(base, output + done, event->time - done);
+			done = event->time;
+		}
+
+		switch (event->type) {
+			case HM_EV_NOTE_OFF:
+				stop_note(base, event->data.note.num);
+				break;
+
+			case HM_EV_NOTE_ON:
+				start_note(base, event->data.note.num, event->data.note.velocity);
+				break;
+
+			case HM_EV_PITCH:
+				set_pitch(base, event->data.pitch);
+				break;
+
+			case HM_EV_CONTROL:
+				set_control(base, event->data.control.num, event->data.control.value);
+				break;
+
+			case HM_EV_PARAM:
+				set_param(base, event->data.param.num, event->data.param.value);
+				break;
+
+			case HM_EV_PATCH:
+				set_patch(base, event->data.patch);
+				break;
+		}
+	}
+
+	if (samples > done) {
+		generate(base, output + done, samples - done);
+	}
+}
+
+static void free_synth(HmSynth *synth)
+{
+	free(synth);
 }
 
 static HmSynth *init(const HmSynthType *type)
@@ -438,6 +955,7 @@ static HmSynth *init(const HmSynthType *type)
 
 	this->base = (HmSynth){
 		.type = type,
+		.version = HM_SYNTH_ABI_PROCESS,
 		.free = free_synth,
 		.setSampleRate = set_sample_rate,
 		.getNumPatches = get_num_patches,
@@ -450,40 +968,40 @@ static HmSynth *init(const HmSynthType *type)
 		.stopNote = stop_note,
 		.setPitch = set_pitch,
 		.setControl = set_control,
-		.generate = generate
+		.getPolyphony = get_polyphony,
+		.setPolyphony = set_polyphony,
+		.generate = generate,
+		.process = process
 	};
 
-	fill_patches(this);
-
-	this->currentPatch = 0;
-
-	for (int i = 0; i < NUM_VOICES; i++) {
-		this->voices[i] = (struct Voice){
-			.env = 0,
-			.carrier = {
-				.phase = 0,
-				.delta = 0
-			},
-			.mod = {
-				.d = 0,
-				.x0 = 0,
-				.x1 = 0
-			},
-			.env = {
-				.decay = 0.99f
-			}
-		};
+	this->bank = get_bank(44100);
+	if (!this->bank) {
+		free(this);
+		return NULL;
+	}
+
+	this->numEdits = 0;
+	memset(this->editOf, -1, sizeof(this->editOf));
+
+	for (int i = 0; i < HM_MAX_VOICES; i++) {
+		reset_voice(this, i);
 	}
 
+	hm_voices_init(&this->alloc, DEFAULT_VOICES, move_voice, release_voice, this);
+
 	this->activeVoices = 0;
-	this->sustain = false;
+	this->kernels = choose_kernels();
+	this->modActive = false;
 	this->lfo.t = 0;
 
-	this->lfo.x0 = this->lfo.d = this->modWheel = 0.0f;
+	this->lfo.x0 = this->modWheel = 0.0f;
 	this->lfo.x1 = this->pitchBend = 1.0f;
 	this->volume = 0.0035f;
 
-	update_params(this);
+	this->sampleRate = 44100;
+	set_patch(&this->base, 0);
+	this->ramp.waveform = this->coeffs->waveform;
+	this->ramp.mix = this->coeffs->mod.mix;
 
 	return &this->base;
 }
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hamilton/project.h"
+#include "hamilton/lib.h"
+
+static const char MAGIC[4] = {'H', 'M', 'P', 'J'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const uint32_t VERSION = 4;
+
+#define MAX_NAME 32
+#define EVENTS_ALIGN 64
+
+typedef struct {
+	char magic[4];
+	uint32_t byteOrder;
+	uint32_t version;
+	uint32_t eventSize;
+	uint32_t numChannels;
+	uint32_t numParams;
+	uint32_t numTempos;
+	uint32_t numLanes;
+	uint32_t numPoints;
+	uint64_t eventsOffset;
+	uint64_t numEvents;
+} Header;
+
+typedef struct {
+	char synth[MAX_NAME];
+	int32_t patch;
+	int32_t polyphony;
+	uint32_t firstParam;
+	uint32_t numParams;
+} ChannelRecord;
+
+typedef struct {
+	int32_t channel;
+	int32_t type;
+	int32_t num;
+	uint32_t firstPoint;
+	uint32_t numPoints;
+} LaneRecord;
+
+typedef struct {
+	void *data;
+	size_t size;
+} Mapping;
+
+static AlError write_data(FILE *file, const void *data, size_t size)
+{
+	return (size == 0 || fwrite(data, 1, size, file) == size) ? AL_NO_ERROR : AL_ERROR_IO;
+}
+
+AlError hm_project_save(HmBand *band, const char *path)
+{
+	BEGIN()
+
+	FILE *file = NULL;
+	char *tempPath = NULL;
+	HmEvent *events = NULL;
+	float *params = NULL;
+	LaneRecord *lanes = NULL;
+	HmAutoPoint *points = NULL;
+	int numEvents = 0;
+
+	const HmSynthType *types[NUM_CHANNELS];
+	ChannelRecord channels[NUM_CHANNELS];
+	uint32_t numParams = 0;
+
+	hm_band_get_channel_synths(band, types);
+
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		memset(&channels[i], 0, sizeof(ChannelRecord));
+		channels[i].patch = -1;
+
+		if (types[i]) {
+			if (strlen(types[i]->name) >= MAX_NAME)
+				THROW(AL_ERROR_INVALID_DATA);
+
+			int n;
+			hm_band_get_channel_params(band, i, &n);
+
+			strcpy(channels[i].synth, types[i]->name);
+			channels[i].patch = hm_band_get_channel_patch(band, i);
+			channels[i].polyphony = hm_band_get_channel_polyphony(band, i);
+			channels[i].firstParam = numParams;
+			channels[i].numParams = n;
+			numParams += n;
+		}
+	}
+
+	TRY(al_malloc(&params, sizeof(float) * (numParams + 1)));
+	for (int i = 0; i < NUM_CHANNELS; i++) {
+		for (uint32_t j = 0; j < channels[i].numParams; j++) {
+			params[channels[i].firstParam + j] = hm_band_get_channel_param(band, i, j);
+		}
+	}
+
+	HmSeq *seq = hm_band_get_seq(band);
+	int numTempos;
+	const HmTempo *tempos = hm_seq_get_tempos(seq, &numTempos);
+
+	int numLanes = hm_seq_get_num_lanes(seq);
+	uint32_t numPoints = 0;
+	for (int i = 0; i < numLanes; i++) {
+		HmAutoTarget target;
+		int n;
+		hm_seq_get_lane_at(seq, i, &target, &n);
+		numPoints += n;
+	}
+
+	TRY(al_malloc(&lanes, sizeof(LaneRecord) * (numLanes + 1)));
+	TRY(al_malloc(&points, sizeof(HmAutoPoint) * (numPoints + 1)));
+
+	numPoints = 0;
+	for (int i = 0; i < numLanes; i++) {
+		HmAutoTarget target;
+		int n;
+		const HmAutoPoint *lanePoints = hm_seq_get_lane_at(seq, i, &target, &n);
+
+		lanes[i] = (LaneRecord){
+			.channel = target.channel,
+			.type = target.type,
+			.num = target.num,
+			.firstPoint = numPoints,
+			.numPoints = n
+		};
+
+		memcpy(points + numPoints, lanePoints, sizeof(HmAutoPoint) * n);
+		numPoints += n;
+	}
+
+	TRY(hm_seq_flatten(seq, &events, &numEvents));
+
+	uint64_t offset = sizeof(Header) + sizeof(channels) + sizeof(float) * numParams + sizeof(HmTempo) * numTempos +
+		sizeof(LaneRecord) * numLanes + sizeof(HmAutoPoint) * numPoints;
+	uint64_t eventsOffset = (offset + EVENTS_ALIGN - 1) / EVENTS_ALIGN * EVENTS_ALIGN;
+	static const char padding[EVENTS_ALIGN];
+
+	Header header = {
+		.byteOrder = BYTE_ORDER_MARK,
+		.version = VERSION,
+		.eventSize = sizeof(HmEvent),
+		.numChannels = NUM_CHANNELS,
+		.numParams = numParams,
+		.numTempos = numTempos,
+		.numLanes = numLanes,
+		.numPoints = numPoints,
+		.eventsOffset = eventsOffset,
+		.numEvents = numEvents
+	};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+
+	/* Write alongside and rename, as the old file may still be mapped */
+	TRY(al_malloc(&tempPath, strlen(path) + 5));
+	sprintf(tempPath, "%s.tmp", path);
+
+	file = fopen(tempPath, "wb");
+	if (!file)
+		THROW(AL_ERROR_IO);
+
+	TRY(write_data(file, &header, sizeof(header)));
+	TRY(write_data(file, channels, sizeof(channels)));
+	TRY(write_data(file, params, sizeof(float) * numParams));
+	TRY(write_data(file, tempos, sizeof(HmTempo) * numTempos));
+	TRY(write_data(file, lanes, sizeof(LaneRecord) * numLanes));
+	TRY(write_data(file, points, sizeof(HmAutoPoint) * numPoints));
+	TRY(write_data(file, padding, eventsOffset - offset));
+	TRY(write_data(file, events, sizeof(HmEvent) * numEvents));
+
+	int closed = fclose(file);
+	file = NULL;
+	if (closed != 0)
+		THROW(AL_ERROR_IO);
+
+	if (rename(tempPath, path) != 0)
+		THROW(AL_ERROR_IO);
+
+	CATCH(
+		if (file) {
+			fclose(file);
+		}
+		if (tempPath) {
+			remove(tempPath);
+		}
+	)
+	FINALLY(
+		free(tempPath);
+		free(events);
+		free(params);
+		free(lanes);
+		free(points);
+	)
+}
+
+static void unmap(void *owner)
+{
+	Mapping *mapping = owner;
+
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+AlError hm_project_load(HmBand *band, const char *path)
+{
+	BEGIN()
+
+	int fd = -1;
+	Mapping *mapping = NULL;
+	void *data = MAP_FAILED;
+	size_t size = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		THROW(AL_ERROR_IO);
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		THROW(AL_ERROR_IO);
+
+	size = info.st_size;
+	if (size < sizeof(Header))
+		THROW(AL_ERROR_INVALID_DATA);
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		THROW(AL_ERROR_IO);
+
+	const Header *header = data;
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		header->byteOrder != BYTE_ORDER_MARK ||
+		header->version != VERSION ||
+		header->eventSize != sizeof(HmEvent))
+		THROW(AL_ERROR_INVALID_DATA);
+
+	uint64_t paramsOffset = sizeof(Header) + sizeof(ChannelRecord) * (uint64_t)header->numChannels;
+	uint64_t temposOffset = paramsOffset + sizeof(float) * (uint64_t)header->numParams;
+	uint64_t lanesOffset = temposOffset + sizeof(HmTempo) * (uint64_t)header->numTempos;
+	uint64_t pointsOffset = lanesOffset + sizeof(LaneRecord) * (uint64_t)header->numLanes;
+	uint64_t pointsEnd = pointsOffset + sizeof(HmAutoPoint) * (uint64_t)header->numPoints;
+
+	if (header->numChannels > (uint32_t)NUM_CHANNELS ||
+		pointsEnd > header->eventsOffset ||
+		header->eventsOffset % EVENTS_ALIGN != 0 ||
+		header->numEvents > INT32_MAX ||
+		header->eventsOffset + header->numEvents * sizeof(HmEvent) > size)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	const ChannelRecord *channels = (const void *)((const char *)data + sizeof(Header));
+	const float *params = (const void *)((const char *)data + paramsOffset);
+	const HmTempo *tempos = (const void *)((const char *)data + temposOffset);
+	const LaneRecord *lanes = (const void *)((const char *)data + lanesOffset);
+	const HmAutoPoint *points = (const void *)((const char *)data + pointsOffset);
+	const HmEvent *events = (const void *)((const char *)data + header->eventsOffset);
+
+	HmLib *lib = hm_band_get_lib(band);
+
+	for (uint32_t i = 0; i < header->numChannels; i++) {
+		const ChannelRecord *channel = &channels[i];
+		if (!channel->synth[0])
+			continue;
+
+		if (!memchr(channel->synth, 0, MAX_NAME) ||
+			channel->firstParam + (uint64_t)channel->numParams > header->numParams)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		const HmSynthType *type = hm_lib_get_synth(lib, channel->synth);
+		if (!type)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		TRY(hm_band_set_channel_synth(band, i, type));
+
+		if (channel->patch >= 0 && channel->patch < hm_band_get_channel_num_patches(band, i)) {
+			TRY(hm_band_set_channel_patch(band, i, channel->patch));
+		}
+
+		if (channel->polyphony > 0) {
+			TRY(hm_band_set_channel_polyphony(band, i, channel->polyphony));
+		}
+
+		for (uint32_t j = 0; j < channel->numParams; j++) {
+			TRY(hm_band_set_channel_param(band, i, j, params[channel->firstParam + j]));
+		}
+	}
+
+	TRY(al_malloc(&mapping, sizeof(Mapping)));
+	*mapping = (Mapping){
+		.data = data,
+		.size = size
+	};
+
+	HmSeq *seq = hm_band_get_seq(band);
+	TRY(hm_seq_set_tempos(seq, tempos, header->numTempos));
+	TRY(hm_seq_clear_lanes(seq));
+
+	for (uint32_t i = 0; i < header->numLanes; i++) {
+		const LaneRecord *lane = &lanes[i];
+		if (lane->firstPoint + (uint64_t)lane->numPoints > header->numPoints)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		HmAutoTarget target = {
+			.channel = lane->channel,
+			.type = lane->type,
+			.num = lane->num
+		};
+
+		TRY(hm_seq_set_lane(seq, &target, points + lane->firstPoint, lane->numPoints));
+	}
+
+	TRY(hm_seq_load_mapped(seq, events, (int)header->numEvents, unmap, mapping));
+
+	CATCH(
+		if (data != MAP_FAILED) {
+			munmap(data, size);
+		}
+		free(mapping);
+	)
+	FINALLY(
+		if (fd >= 0) {
+			close(fd);
+		}
+	)
+}
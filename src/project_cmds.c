@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "project_cmds.h"
+#include "hamilton/project.h"
+
+int cmd_save_project(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	const char *path = luaL_checkstring(L, 1);
+
+	TRY(hm_project_save(band, path));
+
+	CATCH_LUA(, "error saving project")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_load_project(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	const char *path = luaL_checkstring(L, 1);
+
+	TRY(hm_project_load(band, path));
+
+	CATCH_LUA(, "error loading project")
+	FINALLY_LUA(, 0)
+}
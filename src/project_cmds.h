@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_PROJECT_CMDS_H
+#define _HAMILTON_PROJECT_CMDS_H
+
+#include "albase/lua.h"
+
+int cmd_save_project(lua_State *L);
+int cmd_load_project(lua_State *L);
+
+#endif
@@ -0,0 +1,934 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "hamilton/synth.h"
+#include "hamilton/voices.h"
+#include "hamilton/fastmath.h"
+#include "hamilton/band.h"
+#include "hamilton/lib.h"
+#include "hamilton/core_synths.h"
+
+static const char *name = "Sampler";
+static const char *params[] = {
+	"Attack", "Release", "Volume"
+};
+static const int DEFAULT_VOICES = 16;
+
+#define NUM_PARAMS 3
+
+enum {
+	PARAM_ATTACK, PARAM_RELEASE, PARAM_VOLUME
+};
+
+/* Samples named without a note number play at their own pitch on middle C */
+static const int DEFAULT_ROOT = 60;
+
+/*
+ * The start of each sample is decoded at load, so notes sound at once and
+ * the streamer has this long to catch up
+ */
+static const int PRELOAD_MS = 250;
+
+/* Frames of streamed sample each voice holds, a power of two */
+#define RING_FRAMES 16384
+#define RING_MASK (RING_FRAMES - 1)
+
+static const int STREAM_INTERVAL_MS = 5;
+
+/* Stream positions are tagged with the start they belong to in the top bits */
+#define FRAME_BITS 48
+#define FRAME_MASK ((UINT64_C(1) << FRAME_BITS) - 1)
+
+enum Format {
+	FORMAT_PCM16, FORMAT_PCM24, FORMAT_FLOAT
+};
+
+/* A mapped WAV file and the start of it decoded to mono */
+struct Zone {
+	void *map;
+	size_t mapSize;
+	const uint8_t *data;
+	uint64_t numFrames;
+	int numChannels;
+	int frameSize;
+	enum Format format;
+	float rate;
+	int root;
+
+	float *preload;
+	uint64_t numPreload;
+};
+
+typedef struct SampleSet SampleSet;
+
+struct SampleSet {
+	struct Zone *zones;
+	int numZones;
+	int noteZones[HM_VOICE_NOTES];
+
+	SampleSet *nextRetired;
+};
+
+/*
+ * The rest of a voice's sample past its preload, read ahead into a ring by
+ * the streamer. The audio thread restarts a stream by setting its zone and
+ * bumping gen, and reports how far it has read. The streamer tags how far
+ * it has written with the gen it was writing for, so the audio thread
+ * ignores anything left over from an earlier note.
+ */
+struct Stream {
+	uint32_t gen;
+	const struct Zone *zone;
+	uint64_t read;
+	uint64_t written;
+
+	float ring[RING_FRAMES];
+};
+
+/*
+ * Each voice keeps the same stream for life. Moving a voice swaps it with
+ * the one it replaces, so freed voices carry their streams past numActive.
+ */
+struct Voice {
+	int stream;
+	const struct Zone *zone;
+	double pos, step;
+	float velocity;
+	float amp, ampStep;
+};
+
+typedef struct {
+	HmSynth base;
+
+	float sampleRate;
+	float params[NUM_PARAMS];
+	float bend;
+
+	HmVoices alloc;
+	struct Voice voices[HM_MAX_VOICES];
+	struct Stream *streams;
+
+	/*
+	 * The audio thread plays from set. load hands it next, and it retires the
+	 * set it replaces to the streamer, which unmaps it.
+	 */
+	SampleSet *set;
+	SampleSet *next;
+	SampleSet *retired;
+
+	pthread_t streamer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool quit;
+} Sampler;
+
+static uint16_t get_le16(const uint8_t *pos)
+{
+	return pos[0] | pos[1] << 8;
+}
+
+static uint32_t get_le32(const uint8_t *pos)
+{
+	return (uint32_t)pos[0] | (uint32_t)pos[1] << 8 | (uint32_t)pos[2] << 16 | (uint32_t)pos[3] << 24;
+}
+
+/* Decodes frames [first, last), averaging the channels, to out[frame & mask] */
+static void decode(const struct Zone *zone, uint64_t first, uint64_t last, float *out, uint64_t mask)
+{
+	const float scale = 1.0f / zone->numChannels;
+	const uint8_t *pos = zone->data + first * zone->frameSize;
+
+	for (uint64_t frame = first; frame < last; frame++) {
+		float sum = 0.0f;
+
+		for (int c = 0; c < zone->numChannels; c++) {
+			switch (zone->format) {
+				case FORMAT_PCM16:
+					sum += (int16_t)get_le16(pos) * (1.0f / 32768.0f);
+					pos += 2;
+					break;
+
+				case FORMAT_PCM24:
+					sum += (int32_t)((uint32_t)pos[0] << 8 | (uint32_t)pos[1] << 16 | (uint32_t)pos[2] << 24) * (1.0f / 2147483648.0f);
+					pos += 3;
+					break;
+
+				case FORMAT_FLOAT: {
+					uint32_t bits = get_le32(pos);
+					float value;
+					memcpy(&value, &bits, sizeof(value));
+					sum += value;
+					pos += 4;
+					break;
+				}
+			}
+		}
+
+		out[frame & mask] = sum * scale;
+	}
+}
+
+/*
+ * Gives back the whole pages of the mapping within frames [first, last),
+ * once they have been decoded, so a long sample's resident set stays small
+ */
+static void drop_frames(const struct Zone *zone, uint64_t first, uint64_t last)
+{
+	uintptr_t osPage = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t from = ((uintptr_t)(zone->data + first * zone->frameSize) + osPage - 1) & ~(osPage - 1);
+	uintptr_t to = (uintptr_t)(zone->data + last * zone->frameSize) & ~(osPage - 1);
+
+	if (from < to) {
+		madvise((void *)from, to - from, MADV_DONTNEED);
+	}
+}
+
+/* Asks for frames [first, last) to be read in ahead of the next fill */
+static void prefetch_frames(const struct Zone *zone, uint64_t first, uint64_t last)
+{
+	if (last > zone->numFrames) {
+		last = zone->numFrames;
+	}
+	if (first >= last)
+		return;
+
+	uintptr_t osPage = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t from = (uintptr_t)(zone->data + first * zone->frameSize) & ~(osPage - 1);
+	uintptr_t to = (uintptr_t)(zone->data + last * zone->frameSize);
+
+	madvise((void *)from, to - from, MADV_WILLNEED);
+}
+
+static AlError parse_wav(struct Zone *zone, const uint8_t *data, size_t size)
+{
+	BEGIN()
+
+	if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	int format = -1, numChannels = 0, bits = 0;
+	uint32_t rate = 0;
+	const uint8_t *samples = NULL;
+	size_t samplesSize = 0;
+
+	size_t pos = 12;
+	while (pos + 8 <= size) {
+		const uint8_t *chunk = data + pos;
+		size_t body = pos + 8;
+		size_t chunkSize = get_le32(chunk + 4);
+
+		/* Recorders that stop short leave the data size too long */
+		if (chunkSize > size - body) {
+			chunkSize = size - body;
+		}
+
+		if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+			format = get_le16(data + body);
+			numChannels = get_le16(data + body + 2);
+			rate = get_le32(data + body + 4);
+			bits = get_le16(data + body + 14);
+
+			/* WAVE_FORMAT_EXTENSIBLE keeps the real format in its subformat */
+			if (format == 0xfffe && chunkSize >= 26) {
+				format = get_le16(data + body + 24);
+			}
+
+		} else if (memcmp(chunk, "data", 4) == 0) {
+			samples = data + body;
+			samplesSize = chunkSize;
+		}
+
+		pos = body + chunkSize + (chunkSize & 1);
+	}
+
+	if (!samples || numChannels < 1 || rate == 0)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	if (format == 1 && bits == 16) {
+		zone->format = FORMAT_PCM16;
+	} else if (format == 1 && bits == 24) {
+		zone->format = FORMAT_PCM24;
+	} else if (format == 3 && bits == 32) {
+		zone->format = FORMAT_FLOAT;
+	} else {
+		THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	zone->data = samples;
+	zone->numChannels = numChannels;
+	zone->frameSize = numChannels * bits / 8;
+	zone->numFrames = samplesSize / zone->frameSize;
+	zone->rate = rate;
+
+	if (zone->numFrames < 2)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	PASS()
+}
+
+static AlError load_zone(struct Zone *zone, const char *path, int root)
+{
+	BEGIN()
+
+	int fd = -1;
+	void *data = MAP_FAILED;
+	size_t size = 0;
+	float *preload = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		THROW(AL_ERROR_IO);
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		THROW(AL_ERROR_IO);
+
+	size = info.st_size;
+	if (size == 0)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		THROW(AL_ERROR_IO);
+
+	TRY(parse_wav(zone, data, size));
+
+	uint64_t numPreload = (uint64_t)(zone->rate * PRELOAD_MS / 1000);
+	if (numPreload > zone->numFrames) {
+		numPreload = zone->numFrames;
+	}
+
+	TRY(al_malloc(&preload, sizeof(float) * numPreload));
+	decode(zone, 0, numPreload, preload, UINT64_MAX);
+	drop_frames(zone, 0, numPreload);
+
+	zone->map = data;
+	zone->mapSize = size;
+	zone->root = root;
+	zone->preload = preload;
+	zone->numPreload = numPreload;
+
+	CATCH(
+		if (data != MAP_FAILED) {
+			munmap(data, size);
+		}
+		free(preload);
+	)
+	FINALLY(
+		if (fd >= 0) {
+			close(fd);
+		}
+	)
+}
+
+static void free_set(SampleSet *set)
+{
+	if (set) {
+		for (int i = 0; i < set->numZones; i++) {
+			munmap(set->zones[i].map, set->zones[i].mapSize);
+			free(set->zones[i].preload);
+		}
+
+		free(set->zones);
+		free(set);
+	}
+}
+
+static AlError add_zone(SampleSet *set, const char *path, int root)
+{
+	BEGIN()
+
+	struct Zone *zones = realloc(set->zones, sizeof(struct Zone) * (set->numZones + 1));
+	if (!zones)
+		THROW(AL_ERROR_MEMORY);
+
+	set->zones = zones;
+
+	TRY(load_zone(&set->zones[set->numZones], path, root));
+	set->numZones++;
+
+	PASS()
+}
+
+/*
+ * Accepts names ending in .wav, reading the root note from any digits just
+ * before it, as in piano_060.wav
+ */
+static bool parse_name(const char *fileName, int *root)
+{
+	size_t length = strlen(fileName);
+	if (fileName[0] == '.' || length < 4 || strcasecmp(fileName + length - 4, ".wav") != 0)
+		return false;
+
+	size_t digits = length - 4;
+	while (digits > 0 && fileName[digits - 1] >= '0' && fileName[digits - 1] <= '9') {
+		digits--;
+	}
+
+	if (digits == length - 4) {
+		*root = DEFAULT_ROOT;
+	} else {
+		*root = atoi(fileName + digits);
+		if (*root > HM_VOICE_NOTES - 1) {
+			*root = HM_VOICE_NOTES - 1;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Loads a single WAV file, or every WAV file in a directory. Each note plays
+ * the sample with the nearest root.
+ */
+static AlError load_set(const char *path, SampleSet **result)
+{
+	BEGIN()
+
+	SampleSet *set = NULL;
+	DIR *dir = NULL;
+	char *filePath = NULL;
+
+	TRY(al_malloc(&set, sizeof(SampleSet)));
+	set->zones = NULL;
+	set->numZones = 0;
+	set->nextRetired = NULL;
+
+	struct stat info;
+	if (stat(path, &info) != 0)
+		THROW(AL_ERROR_IO);
+
+	if (!S_ISDIR(info.st_mode)) {
+		TRY(add_zone(set, path, DEFAULT_ROOT));
+
+	} else {
+		dir = opendir(path);
+		if (!dir)
+			THROW(AL_ERROR_IO);
+
+		struct dirent *entry;
+		while ((entry = readdir(dir))) {
+			int root;
+			if (!parse_name(entry->d_name, &root))
+				continue;
+
+			free(filePath);
+			filePath = NULL;
+			TRY(al_malloc(&filePath, strlen(path) + strlen(entry->d_name) + 2));
+			sprintf(filePath, "%s/%s", path, entry->d_name);
+
+			TRY(add_zone(set, filePath, root));
+		}
+	}
+
+	if (set->numZones == 0)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	for (int note = 0; note < HM_VOICE_NOTES; note++) {
+		int best = 0;
+		for (int i = 1; i < set->numZones; i++) {
+			if (abs(set->zones[i].root - note) < abs(set->zones[best].root - note)) {
+				best = i;
+			}
+		}
+
+		set->noteZones[note] = best;
+	}
+
+	*result = set;
+
+	CATCH(
+		free_set(set);
+	)
+	FINALLY(
+		free(filePath);
+		if (dir) {
+			closedir(dir);
+		}
+	)
+}
+
+/* Brings a stream's ring up to RING_FRAMES ahead of where its voice has read */
+static void fill_stream(struct Stream *stream)
+{
+	uint32_t gen = __atomic_load_n(&stream->gen, __ATOMIC_ACQUIRE);
+	const struct Zone *zone = __atomic_load_n(&stream->zone, __ATOMIC_RELAXED);
+	if (!zone)
+		return;
+
+	uint64_t tag = (uint64_t)(gen & 0xffff) << FRAME_BITS;
+	uint64_t written = __atomic_load_n(&stream->written, __ATOMIC_RELAXED);
+	uint64_t read = __atomic_load_n(&stream->read, __ATOMIC_ACQUIRE);
+
+	uint64_t first = ((written & ~FRAME_MASK) == tag) ? written & FRAME_MASK : zone->numPreload;
+	uint64_t last = read + RING_FRAMES;
+
+	/* After an underrun, skip to where the voice has got to */
+	if (first < read) {
+		first = read;
+	}
+	if (last > zone->numFrames) {
+		last = zone->numFrames;
+	}
+	if (first >= last)
+		return;
+
+	decode(zone, first, last, stream->ring, RING_MASK);
+	__atomic_store_n(&stream->written, tag | last, __ATOMIC_RELEASE);
+
+	drop_frames(zone, first, last);
+	prefetch_frames(zone, last, last + RING_FRAMES);
+}
+
+static void free_retired(Sampler *this)
+{
+	SampleSet *set = __atomic_exchange_n(&this->retired, NULL, __ATOMIC_ACQUIRE);
+
+	while (set) {
+		SampleSet *next = set->nextRetired;
+		free_set(set);
+		set = next;
+	}
+}
+
+/*
+ * Keeps every playing voice's ring topped up, so all disk reads happen here
+ * rather than on the audio thread. Sets retired before a pass are freed at
+ * its start, as no stream can still be reading them.
+ */
+static void *run_streamer(void *data)
+{
+	Sampler *this = data;
+
+	pthread_mutex_lock(&this->lock);
+
+	while (!this->quit) {
+		free_retired(this);
+
+		for (int i = 0; i < HM_MAX_VOICES; i++) {
+			fill_stream(&this->streams[i]);
+		}
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		long usec = now.tv_usec + STREAM_INTERVAL_MS * 1000;
+		struct timespec deadline = {
+			.tv_sec = now.tv_sec + usec / 1000000,
+			.tv_nsec = (usec % 1000000) * 1000
+		};
+
+		pthread_cond_timedwait(&this->cond, &this->lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&this->lock);
+
+	return NULL;
+}
+
+static AlError start_streamer(Sampler *this)
+{
+	BEGIN()
+
+	bool locked = false;
+	bool conditioned = false;
+
+	if (pthread_mutex_init(&this->lock, NULL) != 0)
+		THROW(AL_ERROR_GENERIC);
+	locked = true;
+
+	if (pthread_cond_init(&this->cond, NULL) != 0)
+		THROW(AL_ERROR_GENERIC);
+	conditioned = true;
+
+	if (pthread_create(&this->streamer, NULL, run_streamer, this) != 0)
+		THROW(AL_ERROR_GENERIC);
+
+	CATCH(
+		if (conditioned) {
+			pthread_cond_destroy(&this->cond);
+		}
+		if (locked) {
+			pthread_mutex_destroy(&this->lock);
+		}
+	)
+	FINALLY()
+}
+
+static void stop_streamer(Sampler *this)
+{
+	pthread_mutex_lock(&this->lock);
+	this->quit = true;
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->lock);
+
+	pthread_join(this->streamer, NULL);
+	pthread_cond_destroy(&this->cond);
+	pthread_mutex_destroy(&this->lock);
+}
+
+static void start_stream(struct Stream *stream, const struct Zone *zone)
+{
+	__atomic_store_n(&stream->read, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stream->zone, zone, __ATOMIC_RELAXED);
+	__atomic_store_n(&stream->gen, stream->gen + 1, __ATOMIC_RELEASE);
+}
+
+static void stop_stream(struct Stream *stream)
+{
+	__atomic_store_n(&stream->zone, NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&stream->gen, stream->gen + 1, __ATOMIC_RELEASE);
+}
+
+/* Switches to a set handed over by load, stopping every voice */
+static void update_set(Sampler *this)
+{
+	if (!__atomic_load_n(&this->next, __ATOMIC_RELAXED))
+		return;
+
+	SampleSet *next = __atomic_exchange_n(&this->next, NULL, __ATOMIC_ACQUIRE);
+	if (!next)
+		return;
+
+	while (this->alloc.numActive > 0) {
+		hm_voices_free(&this->alloc, this->alloc.numActive - 1);
+	}
+
+	for (int i = 0; i < HM_MAX_VOICES; i++) {
+		stop_stream(&this->streams[i]);
+	}
+
+	if (this->set) {
+		SampleSet *head = __atomic_load_n(&this->retired, __ATOMIC_RELAXED);
+
+		do {
+			this->set->nextRetired = head;
+		} while (!__atomic_compare_exchange_n(&this->retired, &head, this->set, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+
+	this->set = next;
+}
+
+static void set_sample_rate(HmSynth *base, int sampleRate)
+{
+	Sampler *this = (Sampler *)base;
+
+	this->sampleRate = sampleRate;
+}
+
+static const char **get_params(HmSynth *base, int *numParams)
+{
+	*numParams = NUM_PARAMS;
+	return params;
+}
+
+static float get_param(HmSynth *base, int param)
+{
+	Sampler *this = (Sampler *)base;
+
+	if (param < 0 || param >= NUM_PARAMS)
+		return 0.0f;
+
+	return this->params[param];
+}
+
+static void set_param(Sampler *this, int param, float value)
+{
+	if (param < 0 || param >= NUM_PARAMS)
+		return;
+
+	this->params[param] = value;
+}
+
+static int get_polyphony(HmSynth *base)
+{
+	Sampler *this = (Sampler *)base;
+
+	return this->alloc.numVoices;
+}
+
+static void set_polyphony(HmSynth *base, int numVoices)
+{
+	Sampler *this = (Sampler *)base;
+
+	int numActive = this->alloc.numActive;
+	hm_voices_set_polyphony(&this->alloc, numVoices);
+
+	for (int i = this->alloc.numActive; i < numActive; i++) {
+		stop_stream(&this->streams[this->voices[i].stream]);
+	}
+}
+
+static void move_voice(void *synth, int from, int to)
+{
+	Sampler *this = synth;
+
+	struct Voice voice = this->voices[to];
+	this->voices[to] = this->voices[from];
+	this->voices[from] = voice;
+}
+
+static void release_voice(void *synth, int i)
+{
+	Sampler *this = synth;
+	float time = 0.005f + 4.0f * this->params[PARAM_RELEASE] * this->params[PARAM_RELEASE];
+
+	this->voices[i].ampStep = -1.0f / (time * this->sampleRate);
+}
+
+static void start_note(Sampler *this, int note, float velocity)
+{
+	if (!this->set)
+		return;
+
+	int v = hm_voices_start(&this->alloc, note);
+	if (v < 0)
+		return;
+
+	struct Voice *voice = &this->voices[v];
+	const struct Zone *zone = &this->set->zones[this->set->noteZones[note]];
+	float attack = 0.001f + 2.0f * this->params[PARAM_ATTACK] * this->params[PARAM_ATTACK];
+
+	voice->zone = zone;
+	voice->pos = 0.0;
+	voice->step = (double)zone->rate / this->sampleRate * hm_note_freqs[note] / hm_note_freqs[zone->root];
+	voice->velocity = velocity;
+	voice->amp = 0.0f;
+	voice->ampStep = 1.0f / (attack * this->sampleRate);
+
+	start_stream(&this->streams[voice->stream], zone);
+}
+
+static void set_control(Sampler *this, int control, float value)
+{
+	switch (control) {
+		case 64:
+			hm_voices_set_sustain(&this->alloc, value >= 0.5f);
+			break;
+	}
+}
+
+/*
+ * Adds a voice into output, reading the preload and then its stream.
+ * Frames the streamer has not reached yet play as silence. Returns false
+ * once the voice has finished.
+ */
+static bool render_voice(Sampler *this, struct Voice *voice, float *output, int length, float gain)
+{
+	const struct Zone *zone = voice->zone;
+	struct Stream *stream = &this->streams[voice->stream];
+	const float *preload = zone->preload;
+	const float *ring = stream->ring;
+	uint64_t numPreload = zone->numPreload;
+	uint64_t end = zone->numFrames;
+
+	uint64_t tag = (uint64_t)(stream->gen & 0xffff) << FRAME_BITS;
+	uint64_t written = __atomic_load_n(&stream->written, __ATOMIC_ACQUIRE);
+	uint64_t avail = ((written & ~FRAME_MASK) == tag) ? written & FRAME_MASK : numPreload;
+
+	double pos = voice->pos;
+	double step = voice->step * this->bend;
+	float amp = voice->amp;
+	float ampStep = voice->ampStep;
+	bool playing = true;
+
+	gain *= voice->velocity;
+
+	for (int n = 0; n < length; n++) {
+		uint64_t i = (uint64_t)pos;
+		if (i + 1 >= end) {
+			playing = false;
+			break;
+		}
+
+		amp += ampStep;
+		if (amp >= 1.0f) {
+			amp = 1.0f;
+			ampStep = 0.0f;
+		} else if (amp <= 0.0f) {
+			playing = false;
+			break;
+		}
+
+		if (i + 1 < avail) {
+			float a, b;
+			if (i + 1 < numPreload) {
+				a = preload[i];
+				b = preload[i + 1];
+			} else {
+				a = (i < numPreload) ? preload[i] : ring[i & RING_MASK];
+				b = ring[(i + 1) & RING_MASK];
+			}
+
+			float t = (float)(pos - (double)i);
+			output[n] += gain * amp * (a + t * (b - a));
+		}
+
+		pos += step;
+	}
+
+	voice->pos = pos;
+	voice->amp = amp;
+	voice->ampStep = ampStep;
+	__atomic_store_n(&stream->read, (uint64_t)pos, __ATOMIC_RELEASE);
+
+	return playing;
+}
+
+static void render(Sampler *this, float *output, int length)
+{
+	float gain = this->params[PARAM_VOLUME] * this->params[PARAM_VOLUME];
+
+	/* Backwards, as freeing a voice moves the last one into its place */
+	for (int v = this->alloc.numActive - 1; v >= 0; v--) {
+		if (!render_voice(this, &this->voices[v], output, length, gain)) {
+			stop_stream(&this->streams[this->voices[v].stream]);
+			hm_voices_free(&this->alloc, v);
+		}
+	}
+}
+
+static void process(HmSynth *base, const HmEvent *events, int numEvents, float *output, int samples)
+{
+	Sampler *this = (Sampler *)base;
+	int done = 0;
+
+	update_set(this);
+
+	for (int i = 0; i < numEvents; i++) {
+		const HmEvent *event = &events[i];
+
+		if ((int)event->time > done) {
+			render(this, output + done, event->time - done);
+			done = event->time;
+		}
+
+		switch (event->type) {
+			case HM_EV_NOTE_OFF:
+				hm_voices_stop(&this->alloc, event->data.note.num);
+				break;
+
+			case HM_EV_NOTE_ON:
+				start_note(this, event->data.note.num, event->data.note.velocity);
+				break;
+
+			case HM_EV_PITCH:
+				this->bend = hm_fast_exp2(event->data.pitch * 2.0f / 12.0f);
+				break;
+
+			case HM_EV_CONTROL:
+				set_control(this, event->data.control.num, event->data.control.value);
+				break;
+
+			case HM_EV_PARAM:
+				set_param(this, event->data.param.num, event->data.param.value);
+				break;
+
+			case HM_EV_PATCH:
+				break;
+		}
+	}
+
+	if (samples > done) {
+		render(this, output + done, samples - done);
+	}
+}
+
+static AlError load(HmSynth *base, const char *path)
+{
+	BEGIN()
+
+	Sampler *this = (Sampler *)base;
+	SampleSet *set = NULL;
+
+	TRY(load_set(path, &set));
+
+	/* One the audio thread never picked up can go straight away */
+	free_set(__atomic_exchange_n(&this->next, set, __ATOMIC_RELEASE));
+
+	PASS()
+}
+
+static void free_synth(HmSynth *synth)
+{
+	Sampler *this = (Sampler *)synth;
+
+	stop_streamer(this);
+
+	free_retired(this);
+	free_set(this->set);
+	free_set(this->next);
+	free(this->streams);
+	free(this);
+}
+
+static HmSynth *init(const HmSynthType *type)
+{
+	Sampler *this = malloc(sizeof(Sampler));
+	if (!this)
+		return NULL;
+
+	this->streams = calloc(HM_MAX_VOICES, sizeof(struct Stream));
+	if (!this->streams) {
+		free(this);
+		return NULL;
+	}
+
+	this->base = (HmSynth){
+		.type = type,
+		.version = HM_SYNTH_ABI_PROCESS,
+		.free = free_synth,
+		.setSampleRate = set_sample_rate,
+		.getParams = get_params,
+		.getParam = get_param,
+		.getPolyphony = get_polyphony,
+		.setPolyphony = set_polyphony,
+		.process = process,
+		.load = load
+	};
+
+	this->sampleRate = 44100;
+	this->params[PARAM_ATTACK] = 0.0f;
+	this->params[PARAM_RELEASE] = 0.2f;
+	this->params[PARAM_VOLUME] = 0.7f;
+	this->bend = 1.0f;
+
+	for (int i = 0; i < HM_MAX_VOICES; i++) {
+		this->voices[i].stream = i;
+	}
+
+	hm_voices_init(&this->alloc, DEFAULT_VOICES, move_voice, release_voice, this);
+
+	this->set = NULL;
+	this->next = NULL;
+	this->retired = NULL;
+	this->quit = false;
+
+	if (start_streamer(this)) {
+		free(this->streams);
+		free(this);
+		return NULL;
+	}
+
+	return &this->base;
+}
+
+AlError sampler_register(HmBand *band)
+{
+	return hm_lib_add_synth(hm_band_get_lib(band), name, init);
+}
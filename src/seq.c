@@ -6,57 +6,292 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <limits.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
 #include "hamilton/seq.h"
-#include "albase/mq.h"
 
-typedef struct EventNode EventNode;
+#define CHUNK_SIZE 128
+#define CHUNK_FILL 96
+#define NUM_SPARE 6
 
-struct EventNode {
-	EventNode *prev, *next;
+#define PAGE_EVENTS 16384
+#define PAGES_AHEAD 8
+#define PAGE_INTERVAL_MS 5
+
+#define KEYFRAME_SECONDS 2
+#define KEYFRAME_BATCH (PAGE_EVENTS * 4)
+#define CHASE_EVENTS 256
+#define NO_CHASE UINT64_MAX
+
+#define POSITION_SHIFT 24
+#define POSITION_MASK ((UINT64_C(1) << POSITION_SHIFT) - 1)
+#define MAX_SAMPLE (UINT64_MAX >> POSITION_SHIFT)
+
+/*
+ * The edit copy of the sequence is kept as a list of chunks, each holding a
+ * short sorted run of entries. Chunks are never empty, so the first and last
+ * entries of each chunk can be used to binary search to any time. Each
+ * chunk also keeps the latest end of the notes starting in it, so ranges
+ * can skip chunks whose notes have all finished. Chunks are shared with
+ * saved versions and copied before they are changed.
+ */
+typedef struct {
 	HmEvent event;
-};
+	HmNote *note;
+} Entry;
+
+typedef struct {
+	int refs;
+	int numEntries;
+	uint64_t maxEnd;
+	Entry entries[];
+} Chunk;
 
-#define GET_NOTE(node) ((HmNote *)((void *)(node) - offsetof(HmNote, on)))
+typedef struct {
+	int chunk;
+	int index;
+} Pos;
 
+/*
+ * Notes are counted by the chunks holding their note on, so they live as
+ * long as any version that has them. The fields match the current version.
+ */
 struct HmNote {
+	int refs;
+	int channel;
+	uint32_t time;
 	HmNoteData data;
-	EventNode on, off;
 };
 
+/*
+ * Patterns are immutable once added, so snapshots share them by reference
+ * rather than copying. References are only counted on the control thread.
+ */
+struct HmPattern {
+	int refs;
+	uint32_t length;
+	int numEvents;
+	HmEvent events[];
+};
+
+struct HmInstance {
+	int refs;
+	HmPattern *pattern;
+	HmInstanceData data;
+};
+
+/* Lanes are replaced rather than edited, and shared in the same way */
 typedef struct {
-	enum {
-		SWAP_ARRAY
-	} type;
-
-	union {
-		struct {
-			HmEvent *ptr;
-			int length;
-		} array;
-	} data;
-} ToAudioMessage;
+	int refs;
+	HmAutoTarget target;
+	int numPoints;
+	HmAutoPoint points[];
+} Lane;
 
+/*
+ * A run of the tempo map at one tempo, with positions and rates in samples
+ * as 40.24 fixed point so the audio thread can convert with integer maths.
+ * That keeps a sample in 2^40 exact, and rates lose under a sample in 2^25
+ * ticks. Positions past the end saturate rather than wrap.
+ */
 typedef struct {
-	enum {
-		FREE_PTR
-	} type;
-	union {
-		void *ptr;
-	} data;
-} FromAudioMessage;
+	uint32_t tick;
+	uint64_t position;
+	uint64_t rate;
+} Segment;
 
-struct HmSeq {
-	AlMQ *toAudio;
-	AlMQ *fromAudio;
+/*
+ * The patch, param, control and pitch changes that bring the synths to their
+ * state at the start of a keyframe. Keyframes with nothing new between them
+ * share their events.
+ */
+typedef struct {
+	int first;
+	int count;
+} Keyframe;
+
+typedef struct {
+	Keyframe *frames;
+	int numFrames;
+	HmEvent *events;
+} Keyframes;
+
+/*
+ * The instances of patterns with one length, as indices into the snapshot's
+ * instances in start order, so those still playing at a tick can be found
+ * without scanning back past everything that has finished.
+ */
+typedef struct {
+	uint32_t length;
+	int first;
+	int count;
+} LengthGroup;
+
+/*
+ * An immutable, sorted copy of the events used by the audio thread, along
+ * with the sample position of each event, the tempo map they came from, the
+ * pattern instances to expand alongside them and keyframes for seeking.
+ * The events are either owned by the snapshot or by whoever loaded them, in
+ * which case release is called when the last reference goes. References are
+ * only counted on the control thread. The keyframes of a mapped snapshot
+ * are built afterwards by the pager, and are the one thing set once the
+ * snapshot is published.
+ */
+typedef struct Snapshot Snapshot;
+
+struct Snapshot {
+	const HmEvent *events;
+	uint64_t *positions;
+	int numEvents;
+	Segment *segments;
+	int numSegments;
+	HmInstance *instances;
+	int numInstances;
+	LengthGroup *groups;
+	int numGroups;
+	int *grouped;
+	Lane **lanes;
+	int numLanes;
+	uint32_t *pageTicks;
+	bool *resident;
+	int numPages;
+	Keyframes *keys;
+	uint64_t keyInterval;
+	int refs;
+	void (*release)(void *owner);
+	void *owner;
+	Snapshot *nextRetired;
+};
+
+/*
+ * A commit waiting for or going through the builder thread. It holds
+ * references to the edit copy's chunks, the way a saved version does, and
+ * edits copy shared chunks before changing them, so the control thread can
+ * go on editing while it builds. The snapshot comes with the instances and
+ * lanes already copied in. References are only counted on the control
+ * thread, which takes each build back once it has been published.
+ */
+typedef struct Build Build;
+typedef struct KeyBuild KeyBuild;
 
-	EventNode *head, *tail;
+struct Build {
+	Snapshot *snapshot;
+	Chunk **chunks;
+	int numChunks;
 	int numEvents;
-	HmEvent *array;
-	int arrayLength;
+	HmTempo *tempos;
+	int numTempos;
+	double sampleRate;
+	Snapshot *unused;
+	AlError error;
+	Build *next;
 };
 
+/*
+ * Snapshots are handed over without locks or queues. The control thread
+ * publishes into next, replacing (and releasing) any snapshot the audio
+ * thread has not picked up yet. The audio thread swaps next in and pushes
+ * the one it stops using onto the retired list, which the control thread
+ * takes whole and releases on every publish. Between publishes at most one
+ * snapshot waits in next and two on the retired list, so garbage stays
+ * bounded however often the sequence is committed.
+ */
+struct HmSeq {
+	Chunk **chunks;
+	int numChunks;
+	int chunksLength;
+	Chunk *spare[NUM_SPARE];
+	int numEvents;
+
+	/*
+	 * The latest note end of each chunk and all those before it, up to date
+	 * for the first numReached chunks, so a range can start at the first
+	 * chunk with a note still sounding.
+	 */
+	uint64_t *reach;
+	int numReached;
+	int reachLength;
+
+	HmPattern **patterns;
+	int numPatterns;
+	int patternsLength;
+	HmInstance **instances;
+	int numInstances;
+	int instancesLength;
+
+	Lane **lanes;
+	int numLanes;
+	int lanesLength;
+
+	HmTempo *tempos;
+	int numTempos;
+	int temposLength;
+	double sampleRate;
+
+	Snapshot *pending;
+	bool reload;
+
+	/*
+	 * Mapped sequences are read ahead of the playhead by the pager thread,
+	 * which holds a reference to the snapshot it is paging and builds its
+	 * keyframes in keyBuild. The pages a seek to seekTick reads are kept in
+	 * as well. The audio thread leaves the sample of its last chase in
+	 * chaseSample, or NO_CHASE, so the pages it read can be given back.
+	 */
+	pthread_t pager;
+	pthread_mutex_t pageLock;
+	pthread_cond_t pageCond;
+	bool paging;
+	bool pageQuit;
+	Snapshot *paged;
+	KeyBuild *keyBuild;
+	uint32_t playTick;
+	bool seeking;
+	uint32_t seekTick;
+	uint64_t chaseSample;
+
+	/*
+	 * Commits are built by a background thread. A commit replaces the one
+	 * in request if that hasn't started yet. Finished builds wait in done
+	 * for the control thread to take them back.
+	 */
+	pthread_t builder;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool threaded;
+	Build *request;
+	bool building;
+	Build *done;
+	bool quit;
+	AlError buildError;
+
+	/* The last snapshot published, for reads on the control thread */
+	Snapshot *committed;
+
+	Snapshot *next;
+	Snapshot *retired;
+
+	Snapshot *snapshot;
+};
+
+static void release_snapshot(Snapshot *snapshot);
+static void process_retired(HmSeq *seq);
+static void free_build(Build *build);
+static void free_keyframes(Keyframes *keys);
+static void release_builds(HmSeq *seq, Build *build);
+static void finish_builds(HmSeq *seq);
+static AlError start_builder(HmSeq *seq);
+static void stop_builder(HmSeq *seq);
+static void set_paged(HmSeq *seq, Snapshot *snapshot);
+static void stop_pager(HmSeq *seq);
+static AlError reload_pending(HmSeq *seq);
+
 AlError hm_seq_init(HmSeq **result)
 {
 	BEGIN()
@@ -64,18 +299,57 @@ AlError hm_seq_init(HmSeq **result)
 	HmSeq *seq = NULL;
 	TRY(al_malloc(&seq, sizeof(HmSeq)));
 
-	seq->toAudio = NULL;
-	seq->fromAudio = NULL;
-
-	seq->head = NULL;
-	seq->tail = NULL;
+	seq->chunks = NULL;
+	seq->numChunks = 0;
+	seq->chunksLength = 0;
+	for (int i = 0; i < NUM_SPARE; i++) {
+		seq->spare[i] = NULL;
+	}
 	seq->numEvents = 0;
-
-	seq->array = NULL;
-	seq->arrayLength = 0;
-
-	TRY(al_mq_init(&seq->toAudio, sizeof(ToAudioMessage), 128));
-	TRY(al_mq_init(&seq->fromAudio, sizeof(FromAudioMessage), 128));
+	seq->reach = NULL;
+	seq->numReached = 0;
+	seq->reachLength = 0;
+
+	seq->patterns = NULL;
+	seq->numPatterns = 0;
+	seq->patternsLength = 0;
+	seq->instances = NULL;
+	seq->numInstances = 0;
+	seq->instancesLength = 0;
+
+	seq->lanes = NULL;
+	seq->numLanes = 0;
+	seq->lanesLength = 0;
+
+	seq->tempos = NULL;
+	seq->numTempos = 0;
+	seq->temposLength = 0;
+	seq->sampleRate = 48000;
+
+	seq->pending = NULL;
+	seq->reload = false;
+	seq->paging = false;
+	seq->pageQuit = false;
+	seq->paged = NULL;
+	seq->keyBuild = NULL;
+	seq->playTick = 0;
+	seq->seeking = false;
+	seq->seekTick = 0;
+	seq->chaseSample = NO_CHASE;
+	seq->threaded = false;
+	seq->request = NULL;
+	seq->building = false;
+	seq->done = NULL;
+	seq->quit = false;
+	seq->buildError = AL_NO_ERROR;
+	seq->committed = NULL;
+	seq->next = NULL;
+	seq->retired = NULL;
+	seq->snapshot = NULL;
+
+	TRY(start_builder(seq));
+	TRY(hm_seq_commit(seq));
+	TRY(hm_seq_wait(seq));
 
 	*result = seq;
 
@@ -85,592 +359,3978 @@ AlError hm_seq_init(HmSeq **result)
 	FINALLY()
 }
 
-static void remove_node(HmSeq *seq, EventNode *node);
-static void update_sequence(HmSeq *seq);
-
-void hm_seq_free(HmSeq *seq)
+static void release_note(HmNote *note)
 {
-	if (seq) {
-		update_sequence(seq);
-		hm_seq_process_messages(seq);
-
-		EventNode *node = seq->head;
-		while (node) {
-			void *freePtr;
-
-			if (node->event.type == HM_EV_NOTE_ON) {
-				HmNote *note = GET_NOTE(node);
-				remove_node(seq, &note->off);
-				freePtr = note;
+	if (--note->refs == 0) {
+		free(note);
+	}
+}
 
-			} else {
-				freePtr = node;
+static void release_chunk(Chunk *chunk)
+{
+	if (--chunk->refs == 0) {
+		for (int i = 0; i < chunk->numEntries; i++) {
+			if (chunk->entries[i].event.type == HM_EV_NOTE_ON) {
+				release_note(chunk->entries[i].note);
 			}
-
-			node = node->next;
-			free(freePtr);
 		}
 
-		al_mq_free(seq->toAudio);
-		al_mq_free(seq->fromAudio);
-		free(seq->array);
-		free(seq);
+		free(chunk);
 	}
 }
 
-static void insert_node(HmSeq *seq, EventNode *node)
+static void clear_entries(HmSeq *seq)
 {
-	EventNode *next = seq->head;
-
-	if (!next) {
-		seq->head = node;
-		seq->tail = node;
-
-	} else {
-		while (next && next->event.time <= node->event.time) {
-			next = next->next;
-		}
-
-		if (!next) {
-			seq->tail->next = node;
-			node->prev = seq->tail;
-			seq->tail = node;
+	for (int i = 0; i < seq->numChunks; i++) {
+		release_chunk(seq->chunks[i]);
+	}
 
-		} else if (!next->prev) {
-			seq->head = node;
-			next->prev = node;
-			node->next = next;
+	seq->numChunks = 0;
+	seq->numEvents = 0;
+	seq->numReached = 0;
+}
 
-		} else {
-			next->prev->next = node;
-			node->prev = next->prev;
-			next->prev = node;
-			node->next = next;
-		}
+static void release_pattern(HmPattern *pattern)
+{
+	if (pattern && --pattern->refs == 0) {
+		free(pattern);
 	}
-
-	seq->numEvents++;
 }
 
-static void remove_node(HmSeq *seq, EventNode *node)
+static void release_instance(HmInstance *instance)
 {
-	if (node->prev) {
-		node->prev->next = node->next;
-	} else {
-		seq->head = node->next;
+	if (--instance->refs == 0) {
+		free(instance);
 	}
+}
 
-	if (node->next) {
-		node->next->prev = node->prev;
-	} else {
-		seq->tail = node->prev;
+static void clear_patterns(HmSeq *seq)
+{
+	for (int i = 0; i < seq->numInstances; i++) {
+		release_instance(seq->instances[i]);
 	}
 
-	node->prev = NULL;
-	node->next = NULL;
+	for (int i = 0; i < seq->numPatterns; i++) {
+		release_pattern(seq->patterns[i]);
+	}
 
-	seq->numEvents--;
+	seq->numInstances = 0;
+	seq->numPatterns = 0;
 }
 
-static EventNode *find_node(EventNode *start, uint32_t time, int channel, HmEventType type)
+static void release_lane(Lane *lane)
 {
-	for (EventNode *node = start; node && node->event.time <= time; node = node->next) {
-		if (node->event.time == time && node->event.channel == channel && node->event.type == type)
-			return node;
+	if (lane && --lane->refs == 0) {
+		free(lane);
 	}
-
-	return NULL;
 }
 
-static EventNode *find_control_node(EventNode *start, uint32_t time, int channel, int control)
+static void clear_lanes(HmSeq *seq)
 {
-	EventNode *node = start;
-	while ((node = find_node(node, time, channel, HM_EV_CONTROL))) {
-		if (node->event.data.control.num == control)
-			return node;
-
-		node = node->next;
+	for (int i = 0; i < seq->numLanes; i++) {
+		release_lane(seq->lanes[i]);
 	}
 
-	return NULL;
+	seq->numLanes = 0;
 }
 
-static EventNode *find_param_node(EventNode *start, uint32_t time, int channel, int param)
+void hm_seq_free(HmSeq *seq)
 {
-	EventNode *node = start;
-	while ((node = find_node(node, time, channel, HM_EV_PARAM))) {
-		if (node->event.data.param.num == param)
-			return node;
-
-		node = node->next;
+	if (seq) {
+		stop_builder(seq);
+		free_build(seq->request);
+		release_builds(seq, seq->done);
+		stop_pager(seq);
+		process_retired(seq);
+
+		clear_entries(seq);
+		clear_patterns(seq);
+		clear_lanes(seq);
+		free(seq->chunks);
+		free(seq->reach);
+		for (int i = 0; i < NUM_SPARE; i++) {
+			free(seq->spare[i]);
+		}
+		free(seq->patterns);
+		free(seq->instances);
+		free(seq->lanes);
+		free(seq->tempos);
+		release_snapshot(seq->pending);
+		release_snapshot(seq->committed);
+		release_snapshot(seq->next);
+		release_snapshot(seq->snapshot);
+		free(seq);
 	}
+}
 
-	return NULL;
+static Entry *get_entry(HmSeq *seq, Pos pos)
+{
+	return &seq->chunks[pos.chunk]->entries[pos.index];
 }
 
-static void free_from_audio(HmSeq *seq, void *ptr)
+static void next_pos(HmSeq *seq, Pos *pos)
 {
-	FromAudioMessage message = {
-		.type = FREE_PTR,
-		.data = {
-			.ptr = ptr
-		}
-	};
+	if (++pos->index == seq->chunks[pos->chunk]->numEntries) {
+		pos->chunk++;
+		pos->index = 0;
+	}
+}
 
-	al_mq_push(seq->fromAudio, &message);
+static uint32_t last_time(Chunk *chunk)
+{
+	return chunk->entries[chunk->numEntries - 1].event.time;
 }
 
-static void update_sequence(HmSeq *seq)
+/* Position of the first entry at or after time */
+static Pos seek(HmSeq *seq, uint32_t time)
 {
-	ToAudioMessage message;
-	while (al_mq_pop(seq->toAudio, &message)) {
-		switch (message.type) {
-			case SWAP_ARRAY:
-				free_from_audio(seq, seq->array);
-				seq->array = message.data.array.ptr;
-				seq->arrayLength = message.data.array.length;
-				break;
+	int a = 0;
+	int b = seq->numChunks;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (last_time(seq->chunks[m]) < time) {
+			a = m + 1;
+		} else {
+			b = m;
 		}
 	}
+
+	if (a == seq->numChunks)
+		return (Pos){a, 0};
+
+	Chunk *chunk = seq->chunks[a];
+	int i = 0;
+	while (chunk->entries[i].event.time < time) {
+		i++;
+	}
+
+	return (Pos){a, i};
 }
 
-static HmEvent *find_first_event(HmEvent *events, int length, uint32_t time)
+/* Position after the last entry at or before time, in a non-empty sequence */
+static Pos seek_after(HmSeq *seq, uint32_t time)
 {
-	if (length == 0)
-		return events;
-
 	int a = 0;
-	int b = length - 1;
+	int b = seq->numChunks - 1;
 
 	while (a < b) {
 		int m = a + (b - a) / 2;
 
-		if (events[m].time < time) {
+		if (last_time(seq->chunks[m]) <= time) {
 			a = m + 1;
 		} else {
 			b = m;
 		}
 	}
 
-	if (events[a].time < time) {
-		a = length;
+	Chunk *chunk = seq->chunks[a];
+	int i = chunk->numEntries;
+	while (i > 0 && chunk->entries[i - 1].event.time > time) {
+		i--;
 	}
 
-	return events + a;
+	return (Pos){a, i};
 }
 
-int hm_seq_get_events(HmSeq *seq, HmEvent *dest, int numEvents, uint64_t start, uint64_t end, double sampleRate)
+/*
+ * Makes sure the next two single-entry inserts and removes can't fail, so
+ * that edits that move entries around never leave the sequence
+ * half-updated. Each can need a copy of a shared chunk and an insert can
+ * also split one.
+ */
+static AlError reserve(HmSeq *seq)
 {
-	update_sequence(seq);
-
-	uint32_t startTick = ceil((double)start * HM_SEQ_TICK_RATE / sampleRate);
-	uint32_t endTick = ceil((double)end * HM_SEQ_TICK_RATE / sampleRate) - 1;
+	BEGIN()
 
-	HmEvent *src = find_first_event(seq->array, seq->arrayLength, startTick);
-	HmEvent *srcEnd = seq->array + seq->arrayLength;
+	if (seq->chunksLength < seq->numChunks + 2) {
+		int length = (seq->chunksLength) ? seq->chunksLength * 2 : 16;
+		Chunk **chunks = realloc(seq->chunks, sizeof(Chunk *) * length);
+		if (!chunks)
+			THROW(AL_ERROR_MEMORY);
 
-	int n = 0;
-	while (src < srcEnd && src->time <= endTick && n < numEvents) {
-		*dest = *src;
-		dest->time = (dest->time - startTick) * sampleRate / HM_SEQ_TICK_RATE;
+		seq->chunks = chunks;
+		seq->chunksLength = length;
+	}
 
-		src++;
-		dest++;
-		n++;
+	for (int i = 0; i < NUM_SPARE; i++) {
+		if (!seq->spare[i]) {
+			TRY(al_malloc(&seq->spare[i], sizeof(Chunk) + sizeof(Entry) * CHUNK_SIZE));
+			seq->spare[i]->numEntries = 0;
+		}
 	}
 
-	return n;
+	PASS()
 }
 
-void hm_seq_process_messages(HmSeq *seq)
+static Chunk *take_spare(HmSeq *seq)
 {
-	FromAudioMessage audioMessage;
-	while (al_mq_pop(seq->fromAudio, &audioMessage)) {
-		switch (audioMessage.type) {
-			case FREE_PTR:
-				free(audioMessage.data.ptr);
-				break;
+	for (int i = 0; i < NUM_SPARE; i++) {
+		Chunk *chunk = seq->spare[i];
+
+		if (chunk) {
+			seq->spare[i] = NULL;
+			chunk->refs = 1;
+			chunk->numEntries = 0;
+			return chunk;
 		}
 	}
+
+	return NULL;
 }
 
-AlError hm_seq_get_items(HmSeq *seq, HmSeqItem **result, int *resultLength)
+static Chunk *add_chunk(HmSeq *seq, int index)
 {
-	BEGIN()
+	Chunk *chunk = take_spare(seq);
 
-	HmSeqItem *items = NULL;
-	int numItems = 0;
-	TRY(al_malloc(&items, sizeof(HmSeqItem) * seq->numEvents));
-
-	HmSeqItem *item = items;
-	for (EventNode *node = seq->head; node; node = node->next, item++) {
-		switch (node->event.type) {
-			case HM_EV_NOTE_ON:
-				*item = (HmSeqItem){
-					.type = HM_SEQ_NOTE,
-					.time = node->event.time,
-					.channel = node->event.channel,
-					.data = {
-						.note = {
-							.note = GET_NOTE(node),
-							.data = GET_NOTE(node)->data
-						}
-					}
-				};
-				numItems++;
-				break;
+	memmove(seq->chunks + index + 1, seq->chunks + index, sizeof(Chunk *) * (seq->numChunks - index));
+	seq->chunks[index] = chunk;
+	seq->numChunks++;
 
-			case HM_EV_NOTE_OFF:
-				break;
+	return chunk;
+}
 
-			case HM_EV_PITCH:
-				*item = (HmSeqItem){
-					.type = HM_SEQ_PITCH,
-					.time = node->event.time,
-					.channel = node->event.channel,
-					.data = {
-						.pitch = node->event.data.pitch
-					}
-				};
-				numItems++;
-				break;
+static void lower_reach(HmSeq *seq, int index)
+{
+	if (index < seq->numReached) {
+		seq->numReached = index;
+	}
+}
 
-			case HM_EV_CONTROL:
-				*item = (HmSeqItem){
-					.type = HM_SEQ_CONTROL,
-					.time = node->event.time,
-					.channel = node->event.channel,
-					.data = {
-						.control = {
-							.num = node->event.data.control.num,
-							.value = node->event.data.control.value
-						}
-					}
-				};
-				numItems++;
-				break;
+/* Works out the latest note end in a chunk again after it changes */
+static void update_chunk(HmSeq *seq, int index)
+{
+	Chunk *chunk = seq->chunks[index];
+	uint64_t maxEnd = 0;
 
-			case HM_EV_PARAM:
-				*item = (HmSeqItem){
-					.type = HM_SEQ_PARAM,
-					.time = node->event.time,
-					.channel = node->event.channel,
-					.data = {
-						.param = {
-							.num = node->event.data.param.num,
-							.value = node->event.data.param.value
-						}
-					}
-				};
-				numItems++;
-				break;
+	for (int i = 0; i < chunk->numEntries; i++) {
+		const HmEvent *event = &chunk->entries[i].event;
 
-			case HM_EV_PATCH:
-				*item = (HmSeqItem){
-					.type = HM_SEQ_PATCH,
-					.time = node->event.time,
-					.channel = node->event.channel,
-					.data = {
-						.patch = node->event.data.patch
-					}
-				};
-				numItems++;
-				break;
+		if (event->type == HM_EV_NOTE_ON && (uint64_t)event->time + event->data.note.length > maxEnd) {
+			maxEnd = (uint64_t)event->time + event->data.note.length;
 		}
 	}
 
-	*result = items;
-	*resultLength = numItems;
-
-	CATCH(
-		free(items);
-	)
-	FINALLY()
+	chunk->maxEnd = maxEnd;
+	lower_reach(seq, index);
 }
 
-AlError hm_seq_add_note(HmSeq *seq, int channel, uint32_t time, HmNoteData *data)
+/* Copies a chunk shared with a saved version before it is changed */
+static Chunk *own_chunk(HmSeq *seq, int index)
 {
-	BEGIN()
-
-	HmNote *note = NULL;
-	TRY(al_malloc(&note, sizeof(HmNote)));
-
-	note->data = *data;
-	note->on = (EventNode){
-		.prev = NULL,
-		.next = NULL,
-		.event = (HmEvent){
-			.time = time,
-			.channel = channel,
-			.type = HM_EV_NOTE_ON,
-			.data = {
-				.note = {
-					.num = data->num,
-					.velocity = data->velocity
-				}
-			}
-		}
-	};
-	note->off = (EventNode){
-		.prev = NULL,
-		.next = NULL,
-		.event = (HmEvent){
-			.time = data + data->length,
-			.channel = channel,
-			.type = HM_EV_NOTE_OFF,
-			.data = {
-				.note = {
-					.num = data->num,
-					.velocity = 0
-				}
-			}
+	Chunk *chunk = seq->chunks[index];
+	if (chunk->refs == 1)
+		return chunk;
+
+	Chunk *copy = take_spare(seq);
+	memcpy(copy->entries, chunk->entries, sizeof(Entry) * chunk->numEntries);
+	copy->numEntries = chunk->numEntries;
+	copy->maxEnd = chunk->maxEnd;
+
+	for (int i = 0; i < copy->numEntries; i++) {
+		if (copy->entries[i].event.type == HM_EV_NOTE_ON) {
+			copy->entries[i].note->refs++;
 		}
-	};
+	}
 
-	insert_node(seq, &note->on);
-	insert_node(seq, &note->off);
+	chunk->refs--;
+	seq->chunks[index] = copy;
 
-	CATCH(
-		free(note);
-	)
-	FINALLY()
+	return copy;
 }
 
-AlError hm_seq_remove_note(HmSeq *seq, HmNote *note)
+static void insert_entry(HmSeq *seq, const Entry *entry)
 {
-	BEGIN()
+	if (seq->numChunks == 0) {
+		add_chunk(seq, 0);
+	}
 
-	remove_node(seq, &note->on);
-	remove_node(seq, &note->off);
-	free(note);
+	Pos pos = (seq->numEvents) ? seek_after(seq, entry->event.time) : (Pos){0, 0};
+	Chunk *chunk = own_chunk(seq, pos.chunk);
+	int first = pos.chunk;
+	bool split = chunk->numEntries == CHUNK_SIZE;
 
-	PASS()
-}
+	if (split) {
+		int half = CHUNK_SIZE / 2;
+		Chunk *next = add_chunk(seq, pos.chunk + 1);
 
-AlError hm_seq_update_note(HmSeq *seq, HmNote *note, uint32_t time, HmNoteData *data)
-{
-	BEGIN()
+		memcpy(next->entries, chunk->entries + half, sizeof(Entry) * (CHUNK_SIZE - half));
+		next->numEntries = CHUNK_SIZE - half;
+		chunk->numEntries = half;
 
-	if (note->on.event.time != time || note->data.length != data->length) {
-		remove_node(seq, &note->on);
-		remove_node(seq, &note->off);
+		if (pos.index > half) {
+			pos.chunk++;
+			pos.index -= half;
+			chunk = next;
+		}
+	}
 
-		note->on.event.time = time;
-		note->off.event.time = time + data->length;
+	memmove(chunk->entries + pos.index + 1, chunk->entries + pos.index, sizeof(Entry) * (chunk->numEntries - pos.index));
+	chunk->entries[pos.index] = *entry;
+	chunk->numEntries++;
 
-		insert_node(seq, &note->on);
-		insert_node(seq, &note->off);
+	if (entry->event.type == HM_EV_NOTE_ON) {
+		entry->note->refs++;
 	}
 
-	note->data = *data;
-	note->on.event.data.note.num = data->num;
-	note->on.event.data.note.velocity = data->velocity;
-	note->off.event.data.note.num = data->num;
+	update_chunk(seq, first);
+	if (split) {
+		update_chunk(seq, first + 1);
+	}
 
-	PASS()
+	seq->numEvents++;
 }
 
-AlError hm_seq_set_pitch(HmSeq *seq, int channel, uint32_t time, float pitch)
+static void remove_entry(HmSeq *seq, Pos pos)
 {
-	BEGIN()
-
-	EventNode *node = find_node(seq->head, time, channel, HM_EV_PITCH);
+	Chunk *chunk = own_chunk(seq, pos.chunk);
+	Entry removed = chunk->entries[pos.index];
 
-	if (node) {
-		node->event.data.pitch = pitch;
+	chunk->numEntries--;
+	memmove(chunk->entries + pos.index, chunk->entries + pos.index + 1, sizeof(Entry) * (chunk->numEntries - pos.index));
 
-	} else {
-		TRY(al_malloc(&node, sizeof(EventNode)));
+	if (chunk->numEntries == 0) {
+		seq->numChunks--;
+		memmove(seq->chunks + pos.chunk, seq->chunks + pos.chunk + 1, sizeof(Chunk *) * (seq->numChunks - pos.chunk));
 
-		node->prev = NULL;
-		node->next = NULL;
-		node->event = (HmEvent){
-			.time = time,
-			.channel = channel,
-			.type = HM_EV_PITCH,
-			.data = {
-				.pitch = pitch
-			}
-		};
+		int i = 0;
+		while (i < NUM_SPARE && seq->spare[i]) {
+			i++;
+		}
 
-		insert_node(seq, node);
-	}
+		if (i < NUM_SPARE) {
+			seq->spare[i] = chunk;
+		} else {
+			free(chunk);
+		}
 
-	PASS()
-}
+		lower_reach(seq, pos.chunk);
 
-AlError hm_seq_clear_pitch(HmSeq *seq, int channel, uint32_t time)
-{
-	BEGIN()
+	} else if (removed.event.type == HM_EV_NOTE_ON) {
+		update_chunk(seq, pos.chunk);
+	}
 
-	EventNode *node = find_node(seq->head, time, channel, HM_EV_PITCH);
-	if (node) {
-		remove_node(seq, node);
-		free(node);
+	if (removed.event.type == HM_EV_NOTE_ON) {
+		release_note(removed.note);
 	}
 
-	PASS()
+	seq->numEvents--;
 }
 
-AlError hm_seq_set_control(HmSeq *seq, int channel, uint32_t time, int control, float value)
+static bool same_slot(const HmEvent *a, const HmEvent *b)
 {
-	BEGIN()
+	if (a->time != b->time || a->channel != b->channel || a->type != b->type)
+		return false;
 
-	EventNode *node = find_control_node(seq->head, time, channel, control);
+	switch (a->type) {
+		case HM_EV_PITCH:
+		case HM_EV_PATCH:
+			return true;
 
-	if (node) {
-		node->event.data.control.value = value;
+		case HM_EV_CONTROL:
+			return a->data.control.num == b->data.control.num;
 
-	} else {
-		TRY(al_malloc(&node, sizeof(EventNode)));
+		case HM_EV_PARAM:
+			return a->data.param.num == b->data.param.num;
 
-		node->prev = NULL;
-		node->next = NULL;
-		node->event = (HmEvent){
-			.time = time,
-			.channel = channel,
-			.type = HM_EV_CONTROL,
-			.data = {
-				.control = {
-					.num = control,
-					.value = value
-				}
-			}
-		};
+		default:
+			return false;
+	}
+}
 
-		insert_node(seq, node);
+static bool find_slot(HmSeq *seq, const HmEvent *event, Pos *result)
+{
+	for (Pos pos = seek(seq, event->time); pos.chunk < seq->numChunks; next_pos(seq, &pos)) {
+		Entry *entry = get_entry(seq, pos);
+		if (entry->event.time != event->time)
+			break;
+
+		if (same_slot(&entry->event, event)) {
+			*result = pos;
+			return true;
+		}
 	}
 
-	PASS()
+	return false;
 }
 
-AlError hm_seq_clear_control(HmSeq *seq, int channel, uint32_t time, int control)
+static bool find_note_entry(HmSeq *seq, HmNote *note, HmEventType type, Pos *result)
 {
-	BEGIN()
+	uint32_t time = (type == HM_EV_NOTE_ON) ? note->time : note->time + note->data.length;
 
-	EventNode *node = find_control_node(seq->head, time, channel, control);
-	if (node) {
-		remove_node(seq, node);
-		free(node);
+	for (Pos pos = seek(seq, time); pos.chunk < seq->numChunks; next_pos(seq, &pos)) {
+		Entry *entry = get_entry(seq, pos);
+		if (entry->event.time != time)
+			break;
+
+		if (entry->note == note && entry->event.type == type) {
+			*result = pos;
+			return true;
+		}
 	}
 
-	PASS()
+	return false;
 }
 
-AlError hm_seq_set_param(HmSeq *seq, int channel, uint32_t time, int param, float value)
+static void sort_entries(Entry *entries, Entry *temp, int numEntries)
 {
-	BEGIN()
-
-	EventNode *node = find_param_node(seq->head, time, channel, param);
+	Entry *src = entries;
+	Entry *dest = temp;
 
-	if (node) {
-		node->event.data.param.value = value;
+	for (int width = 1; width < numEntries; width *= 2) {
+		for (int a = 0; a < numEntries; a += 2 * width) {
+			int m = (a + width < numEntries) ? a + width : numEntries;
+			int b = (a + 2 * width < numEntries) ? a + 2 * width : numEntries;
+			int i = a, j = m, k = a;
 
-	} else {
-		TRY(al_malloc(&node, sizeof(EventNode)));
-
-		node->prev = NULL;
-		node->next = NULL;
-		node->event = (HmEvent){
-			.time = time,
-			.channel = channel,
-			.type = HM_EV_PARAM,
-			.data = {
-				.param = {
-					.num = param,
-					.value = value
-				}
+			while (i < m && j < b) {
+				dest[k++] = (src[j].event.time < src[i].event.time) ? src[j++] : src[i++];
 			}
-		};
 
-		insert_node(seq, node);
+			while (i < m) dest[k++] = src[i++];
+			while (j < b) dest[k++] = src[j++];
+		}
+
+		Entry *swap = src;
+		src = dest;
+		dest = swap;
 	}
 
+	if (src != entries) {
+		memcpy(entries, src, sizeof(Entry) * numEntries);
+	}
+}
+
+static Entry *find_merged_slot(Chunk **chunks, int c, const HmEvent *event)
+{
+	for (int i = c; i >= 0; i--) {
+		for (int j = chunks[i]->numEntries - 1; j >= 0; j--) {
+			Entry *entry = &chunks[i]->entries[j];
+			if (entry->event.time != event->time)
+				return NULL;
+
+			if (same_slot(&entry->event, event))
+				return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Merges a sorted batch with the existing entries into a freshly packed set
+ * of chunks. Batch entries go after existing ones at the same time, and
+ * batch state events replace any event already in the same slot.
+ */
+static AlError merge_entries(HmSeq *seq, const Entry *batch, int numBatch)
+{
+	BEGIN()
+
+	int maxChunks = (seq->numEvents + numBatch) / CHUNK_FILL + 1;
+	Chunk **chunks = NULL;
+	int numChunks = 0;
+
+	TRY(al_malloc(&chunks, sizeof(Chunk *) * maxChunks));
+	for (; numChunks < maxChunks; numChunks++) {
+		TRY(al_malloc(&chunks[numChunks], sizeof(Chunk) + sizeof(Entry) * CHUNK_SIZE));
+		chunks[numChunks]->refs = 1;
+		chunks[numChunks]->numEntries = 0;
+		chunks[numChunks]->maxEnd = 0;
+	}
+
+	Pos pos = {0, 0};
+	int b = 0;
+	int c = 0;
+	int numEvents = 0;
+
+	while (pos.chunk < seq->numChunks || b < numBatch) {
+		const Entry *entry;
+		bool fromBatch = b < numBatch &&
+			(pos.chunk == seq->numChunks || batch[b].event.time < get_entry(seq, pos)->event.time);
+
+		if (fromBatch) {
+			entry = &batch[b++];
+		} else {
+			entry = get_entry(seq, pos);
+			next_pos(seq, &pos);
+		}
+
+		if (fromBatch && !entry->note) {
+			Entry *match = find_merged_slot(chunks, c, &entry->event);
+
+			if (match) {
+				match->event.data = entry->event.data;
+				continue;
+			}
+		}
+
+		if (chunks[c]->numEntries == CHUNK_FILL) {
+			c++;
+		}
+
+		chunks[c]->entries[chunks[c]->numEntries++] = *entry;
+		numEvents++;
+
+		if (entry->event.type == HM_EV_NOTE_ON) {
+			entry->note->refs++;
+
+			uint64_t end = (uint64_t)entry->event.time + entry->event.data.note.length;
+			if (end > chunks[c]->maxEnd) {
+				chunks[c]->maxEnd = end;
+			}
+		}
+	}
+
+	for (int i = 0; i < seq->numChunks; i++) {
+		release_chunk(seq->chunks[i]);
+	}
+	free(seq->chunks);
+
+	numChunks = (numEvents) ? c + 1 : 0;
+	for (int i = numChunks; i < maxChunks; i++) {
+		free(chunks[i]);
+	}
+
+	seq->chunks = chunks;
+	seq->numChunks = numChunks;
+	seq->chunksLength = maxChunks;
+	seq->numEvents = numEvents;
+	seq->numReached = 0;
+
+	CATCH(
+		for (int i = 0; i < numChunks; i++) {
+			free(chunks[i]);
+		}
+		free(chunks);
+	)
+	FINALLY()
+}
+
+static void release_snapshot(Snapshot *snapshot)
+{
+	if (snapshot && --snapshot->refs == 0) {
+		if (snapshot->release) {
+			snapshot->release(snapshot->owner);
+		} else {
+			free((void *)snapshot->events);
+		}
+
+		for (int i = 0; i < snapshot->numInstances; i++) {
+			release_pattern(snapshot->instances[i].pattern);
+		}
+
+		for (int i = 0; i < snapshot->numLanes; i++) {
+			release_lane(snapshot->lanes[i]);
+		}
+
+		free(snapshot->positions);
+		free(snapshot->segments);
+		free(snapshot->instances);
+		free(snapshot->groups);
+		free(snapshot->grouped);
+		free(snapshot->lanes);
+		free(snapshot->pageTicks);
+		free(snapshot->resident);
+		free_keyframes(snapshot->keys);
+		free(snapshot);
+	}
+}
+
+static void retire_snapshot(HmSeq *seq, Snapshot *snapshot)
+{
+	Snapshot *head = __atomic_load_n(&seq->retired, __ATOMIC_RELAXED);
+
+	do {
+		snapshot->nextRetired = head;
+	} while (!__atomic_compare_exchange_n(&seq->retired, &head, snapshot, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void update_sequence(HmSeq *seq)
+{
+	if (!__atomic_load_n(&seq->next, __ATOMIC_RELAXED))
+		return;
+
+	Snapshot *next = __atomic_exchange_n(&seq->next, NULL, __ATOMIC_ACQUIRE);
+	if (!next)
+		return;
+
+	if (seq->snapshot) {
+		retire_snapshot(seq, seq->snapshot);
+	}
+
+	seq->snapshot = next;
+}
+
+static uint64_t position_to_sample(uint64_t position)
+{
+	return (position >> POSITION_SHIFT) + ((position & POSITION_MASK) != 0);
+}
+
+static uint64_t sample_to_position(uint64_t sample)
+{
+	return (sample <= MAX_SAMPLE) ? sample << POSITION_SHIFT : UINT64_MAX;
+}
+
+static uint64_t add_positions(uint64_t a, uint64_t b)
+{
+	return (a <= UINT64_MAX - b) ? a + b : UINT64_MAX;
+}
+
+static uint64_t ticks_to_position(uint32_t ticks, uint64_t rate)
+{
+	uint64_t whole = (uint64_t)ticks * (rate >> POSITION_SHIFT);
+	if (whole > MAX_SAMPLE)
+		return UINT64_MAX;
+
+	return add_positions(whole << POSITION_SHIFT, (uint64_t)ticks * (rate & POSITION_MASK));
+}
+
+static const Segment *find_segment(const Snapshot *snapshot, uint32_t tick)
+{
+	int a = 0;
+	int b = snapshot->numSegments - 1;
+
+	while (a < b) {
+		int m = b - (b - a) / 2;
+
+		if (snapshot->segments[m].tick <= tick) {
+			a = m;
+		} else {
+			b = m - 1;
+		}
+	}
+
+	return &snapshot->segments[a];
+}
+
+static uint64_t tick_to_position(const Snapshot *snapshot, uint32_t tick)
+{
+	const Segment *segment = find_segment(snapshot, tick);
+	return add_positions(segment->position, ticks_to_position(tick - segment->tick, segment->rate));
+}
+
+static uint64_t tick_to_sample(const Snapshot *snapshot, uint32_t tick)
+{
+	return position_to_sample(tick_to_position(snapshot, tick));
+}
+
+static uint32_t sample_to_tick(const Snapshot *snapshot, uint64_t sample)
+{
+	uint64_t position = sample_to_position(sample);
+
+	int a = 0;
+	int b = snapshot->numSegments - 1;
+
+	while (a < b) {
+		int m = b - (b - a) / 2;
+
+		if (snapshot->segments[m].position <= position) {
+			a = m;
+		} else {
+			b = m - 1;
+		}
+	}
+
+	const Segment *segment = &snapshot->segments[a];
+	uint64_t ticks = segment->tick + (position - segment->position) / segment->rate;
+
+	return (ticks < UINT32_MAX) ? (uint32_t)ticks : UINT32_MAX;
+}
+
+/* Mapped snapshots don't keep positions, so they are worked out as needed */
+static uint64_t event_sample(const Snapshot *snapshot, int i)
+{
+	if (snapshot->positions)
+		return position_to_sample(snapshot->positions[i]);
+
+	return tick_to_sample(snapshot, snapshot->events[i].time);
+}
+
+/* Last page starting at or before the tick, or 0 */
+static int find_page(const Snapshot *snapshot, uint32_t tick)
+{
+	int a = 0;
+	int b = snapshot->numPages - 1;
+
+	while (a < b) {
+		int m = b - (b - a) / 2;
+
+		if (snapshot->pageTicks[m] <= tick) {
+			a = m;
+		} else {
+			b = m - 1;
+		}
+	}
+
+	return a;
+}
+
+static int find_first_event(const Snapshot *snapshot, uint64_t sample)
+{
+	int a = 0;
+	int b = snapshot->numEvents;
+
+	/* Narrow the search to one page first, so only that page is read */
+	if (snapshot->numPages > 0) {
+		int first = 0;
+		int last = snapshot->numPages - 1;
+
+		while (first < last) {
+			int m = last - (last - first) / 2;
+
+			if (tick_to_sample(snapshot, snapshot->pageTicks[m]) < sample) {
+				first = m;
+			} else {
+				last = m - 1;
+			}
+		}
+
+		a = first * PAGE_EVENTS;
+		if (b > a + PAGE_EVENTS) {
+			b = a + PAGE_EVENTS;
+		}
+	}
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (event_sample(snapshot, m) < sample) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+
+	return a;
+}
+
+static bool note_in_range(const HmInstanceData *instance, const HmEvent *event)
+{
+	if (event->type != HM_EV_NOTE_ON && event->type != HM_EV_NOTE_OFF)
+		return true;
+
+	int num = event->data.note.num + instance->transpose;
+	return num >= 0 && num <= 127;
+}
+
+static void place_event(const HmInstanceData *instance, const HmEvent *src, HmEvent *dest)
+{
+	*dest = *src;
+	dest->time = instance->time + src->time;
+	dest->channel = instance->channel;
+
+	if (src->type == HM_EV_NOTE_ON || src->type == HM_EV_NOTE_OFF) {
+		dest->data.note.num += instance->transpose;
+	}
+
+	if (src->type == HM_EV_NOTE_ON) {
+		float velocity = src->data.note.velocity * instance->velocity;
+		dest->data.note.velocity = (velocity < 1) ? velocity : 1;
+	}
+}
+
+/* Most instances that can be playing at once; commits with more fail */
+#define MAX_ACTIVE 128
+
+/*
+ * A read position in either the flat events of a snapshot or the events of
+ * one instance, along with the tick and sample of the current event.
+ */
+typedef struct {
+	const HmInstance *instance;
+	const HmEvent *event;
+	const HmEvent *end;
+	uint32_t tick;
+	uint64_t sample;
+} Cursor;
+
+static void settle_cursor(const Snapshot *snapshot, Cursor *cursor, uint64_t start)
+{
+	const HmInstance *instance = cursor->instance;
+
+	for (; cursor->event < cursor->end; cursor->event++) {
+		if (instance) {
+			if (!note_in_range(&instance->data, cursor->event))
+				continue;
+
+			cursor->tick = instance->data.time + cursor->event->time;
+			cursor->sample = tick_to_sample(snapshot, cursor->tick);
+
+		} else {
+			cursor->tick = cursor->event->time;
+			cursor->sample = event_sample(snapshot, (int)(cursor->event - snapshot->events));
+		}
+
+		if (cursor->sample >= start)
+			return;
+	}
+
+	cursor->sample = UINT64_MAX;
+}
+
+static void advance_cursor(const Snapshot *snapshot, Cursor *cursor)
+{
+	cursor->event++;
+	settle_cursor(snapshot, cursor, 0);
+}
+
+static const HmEvent *find_pattern_event(const HmPattern *pattern, uint32_t time)
+{
+	int a = 0;
+	int b = pattern->numEvents;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (pattern->events[m].time < time) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+
+	return &pattern->events[a];
+}
+
+static int find_first_instance(const Snapshot *snapshot, uint32_t time)
+{
+	int a = 0;
+	int b = snapshot->numInstances;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (snapshot->instances[m].data.time < time) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+
+	return a;
+}
+
+/* Index into grouped of the first instance in the group at or after time */
+static int find_first_grouped(const Snapshot *snapshot, const LengthGroup *group, uint32_t time)
+{
+	int a = group->first;
+	int b = group->first + group->count;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (snapshot->instances[snapshot->grouped[m]].data.time < time) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+
+	return a;
+}
+
+static bool add_instance_cursor(const Snapshot *snapshot, Cursor *cursor, const HmInstance *instance, uint32_t first, uint64_t start, uint64_t end)
+{
+	*cursor = (Cursor){
+		.instance = instance,
+		.event = find_pattern_event(instance->pattern, (first > instance->data.time) ? first - instance->data.time : 0),
+		.end = instance->pattern->events + instance->pattern->numEvents
+	};
+	settle_cursor(snapshot, cursor, start);
+
+	return cursor->sample < end;
+}
+
+/*
+ * Sets up a cursor for the flat events and one for each instance with
+ * events between start and end, returning the number of cursors. Commits
+ * keep the instances playing at any one tick to MAX_ACTIVE, but more than
+ * that can start within the window, in which case end is brought in to the
+ * start of the first that doesn't fit.
+ */
+static int find_cursors(const Snapshot *snapshot, Cursor *cursors, uint64_t start, uint64_t *end)
+{
+	int i = find_first_event(snapshot, start);
+	cursors[0] = (Cursor){
+		.instance = NULL,
+		.event = snapshot->events + i,
+		.end = snapshot->events + snapshot->numEvents
+	};
+	settle_cursor(snapshot, &cursors[0], start);
+
+	if (snapshot->numInstances == 0)
+		return 1;
+
+	/* Any event at or after start is after the first tick and no later than the last */
+	uint32_t first = (start > 0) ? sample_to_tick(snapshot, start - 1) : 0;
+	uint32_t last = sample_to_tick(snapshot, *end - 1);
+
+	/* Instances started before the first tick and still playing, in start order */
+	int playing[MAX_ACTIVE];
+	int numPlaying = 0;
+
+	for (int g = 0; g < snapshot->numGroups; g++) {
+		const LengthGroup *group = &snapshot->groups[g];
+		uint32_t from = (first > group->length) ? first - group->length : 0;
+
+		for (int k = find_first_grouped(snapshot, group, from); k < group->first + group->count && numPlaying < MAX_ACTIVE; k++) {
+			int j = snapshot->grouped[k];
+			if (snapshot->instances[j].data.time >= first)
+				break;
+
+			int at = numPlaying++;
+			while (at > 0 && playing[at - 1] > j) {
+				playing[at] = playing[at - 1];
+				at--;
+			}
+			playing[at] = j;
+		}
+	}
+
+	int numCursors = 1;
+
+	for (int k = 0; k < numPlaying; k++) {
+		if (add_instance_cursor(snapshot, &cursors[numCursors], &snapshot->instances[playing[k]], first, start, *end)) {
+			numCursors++;
+		}
+	}
+
+	for (int j = find_first_instance(snapshot, first); j < snapshot->numInstances; j++) {
+		const HmInstance *instance = &snapshot->instances[j];
+
+		if (instance->data.time > last)
+			break;
+
+		if (numCursors > MAX_ACTIVE) {
+			/* Read up to this one and pick the rest up from there */
+			uint64_t sample = tick_to_sample(snapshot, instance->data.time);
+			if (sample > start && sample < *end) {
+				*end = sample;
+			}
+
+			break;
+		}
+
+		if (add_instance_cursor(snapshot, &cursors[numCursors], instance, first, start, *end)) {
+			numCursors++;
+		}
+	}
+
+	return numCursors;
+}
+
+/* Earliest cursor by tick, preferring flat events and then earlier instances */
+static Cursor *next_cursor(Cursor *cursors, int numCursors)
+{
+	Cursor *next = NULL;
+
+	for (int i = 0; i < numCursors; i++) {
+		Cursor *cursor = &cursors[i];
+
+		if (cursor->sample != UINT64_MAX && (!next || cursor->tick < next->tick)) {
+			next = cursor;
+		}
+	}
+
+	return next;
+}
+
+/* Moves pos past the first n events read from it */
+static void advance_pos(HmSeqPos *pos, const HmEvent *events, int n)
+{
+	if (n == 0)
+		return;
+
+	uint32_t last = events[n - 1].time;
+	int same = 1;
+	while (same < n && events[n - 1 - same].time == last) {
+		same++;
+	}
+
+	if (last == 0) {
+		pos->skip += same;
+	} else {
+		pos->sample += last;
+		pos->skip = same;
+	}
+}
+
+static int read_events(const Snapshot *snapshot, HmEvent *dest, int numEvents, HmSeqPos *pos, uint64_t end)
+{
+	uint64_t start = pos->sample;
+	if (numEvents <= 0 || end <= start)
+		return 0;
+
+	Cursor cursors[MAX_ACTIVE + 1];
+	int n = 0;
+	HmSeqPos at = *pos;
+
+	/* The window is read in parts when too many instances start in it */
+	while (n < numEvents && at.sample < end) {
+		uint64_t until = end;
+		int numCursors = find_cursors(snapshot, cursors, at.sample, &until);
+		int skipped = 0;
+
+		Cursor *cursor;
+		while ((cursor = next_cursor(cursors, numCursors)) && cursor->sample < until && n < numEvents) {
+			if (cursor->sample == at.sample && skipped < at.skip) {
+				skipped++;
+				advance_cursor(snapshot, cursor);
+				continue;
+			}
+
+			if (cursor->instance) {
+				place_event(&cursor->instance->data, cursor->event, &dest[n]);
+			} else {
+				dest[n] = *cursor->event;
+			}
+
+			dest[n].time = (uint32_t)(cursor->sample - start);
+			n++;
+
+			advance_cursor(snapshot, cursor);
+		}
+
+		at = (HmSeqPos){until, 0};
+	}
+
+	advance_pos(pos, dest, n);
+
+	return n;
+}
+
+int hm_seq_get_events(HmSeq *seq, HmEvent *dest, int numEvents, HmSeqPos *pos, uint64_t end)
+{
+	update_sequence(seq);
+
+	const Snapshot *snapshot = seq->snapshot;
+	if (!snapshot)
+		return 0;
+
+	if (snapshot->numPages > 0) {
+		__atomic_store_n(&seq->playTick, sample_to_tick(snapshot, pos->sample), __ATOMIC_RELAXED);
+	}
+
+	return read_events(snapshot, dest, numEvents, pos, end);
+}
+
+static bool is_state_event(const HmEvent *event)
+{
+	return event->type != HM_EV_NOTE_ON && event->type != HM_EV_NOTE_OFF;
+}
+
+int hm_seq_get_state(HmSeq *seq, HmEvent *dest, int numEvents, uint64_t sample, HmSeqStatePos *pos)
+{
+	update_sequence(seq);
+
+	const Snapshot *snapshot = seq->snapshot;
+	if (!snapshot)
+		return 0;
+
+	if (snapshot->numPages > 0) {
+		__atomic_store_n(&seq->chaseSample, sample, __ATOMIC_RELAXED);
+	}
+
+	/*
+	 * Without keyframes yet, the changes are replayed from the start. A read
+	 * started that way carries on that way if they turn up part way.
+	 */
+	const Keyframes *keys = __atomic_load_n(&snapshot->keys, __ATOMIC_ACQUIRE);
+	bool started = pos->keyEvents == 0 && (pos->pos.sample > 0 || pos->pos.skip > 0);
+	int n = 0;
+
+	if (keys && !started) {
+		uint64_t k = sample / snapshot->keyInterval;
+		if (k >= (uint64_t)keys->numFrames) {
+			k = keys->numFrames - 1;
+		}
+
+		const Keyframe *keyframe = &keys->frames[k];
+
+		while (pos->keyEvents < keyframe->count && n < numEvents) {
+			dest[n++] = keys->events[keyframe->first + pos->keyEvents++];
+		}
+
+		uint64_t keySample = k * snapshot->keyInterval;
+
+		if (pos->pos.sample < keySample) {
+			pos->pos = (HmSeqPos){keySample, 0};
+		}
+	}
+
+	/* Then the changes between the keyframe and the sample */
+	HmEvent events[CHASE_EVENTS];
+
+	while (n < numEvents) {
+		HmSeqPos from = pos->pos;
+		int numRead = read_events(snapshot, events, CHASE_EVENTS, &from, sample);
+		int used = 0;
+
+		for (; used < numRead && n < numEvents; used++) {
+			if (is_state_event(&events[used])) {
+				dest[n] = events[used];
+				dest[n].time = 0;
+				n++;
+			}
+		}
+
+		/* Only move past the events used, in case dest filled first */
+		advance_pos(&pos->pos, events, used);
+
+		if (numRead < CHASE_EVENTS)
+			break;
+	}
+
+	return n;
+}
+
+uint64_t hm_seq_get_sample(HmSeq *seq, uint32_t tick)
+{
+	update_sequence(seq);
+
+	if (!seq->snapshot)
+		return 0;
+
+	return tick_to_sample(seq->snapshot, tick);
+}
+
+uint32_t hm_seq_get_tick(HmSeq *seq, uint64_t sample)
+{
+	update_sequence(seq);
+
+	if (!seq->snapshot)
+		return 0;
+
+	return sample_to_tick(seq->snapshot, sample);
+}
+
+/* Last point at or before the sample, or -1 */
+static int find_point(const Snapshot *snapshot, const Lane *lane, uint64_t sample)
+{
+	uint32_t tick = sample_to_tick(snapshot, sample);
+
+	int a = -1;
+	int b = lane->numPoints - 1;
+
+	while (a < b) {
+		int m = b - (b - a) / 2;
+
+		if (lane->points[m].time <= tick) {
+			a = m;
+		} else {
+			b = m - 1;
+		}
+	}
+
+	return a;
+}
+
+static float lane_value(const Snapshot *snapshot, const Lane *lane, int i, uint64_t sample)
+{
+	const HmAutoPoint *point = &lane->points[i];
+	if (point->curve == HM_CURVE_STEP || i + 1 == lane->numPoints)
+		return point->value;
+
+	const HmAutoPoint *next = point + 1;
+	uint64_t start = tick_to_position(snapshot, point->time);
+	uint64_t end = tick_to_position(snapshot, next->time);
+	uint64_t position = sample_to_position(sample);
+
+	float x = (position > start) ? (double)(position - start) / (end - start) : 0;
+	if (x > 1) {
+		x = 1;
+	}
+
+	if (point->curve == HM_CURVE_EXPONENTIAL && point->value > 0 && next->value > 0)
+		return point->value * powf(next->value / point->value, x);
+
+	return point->value + (next->value - point->value) * x;
+}
+
+int hm_seq_get_automation(HmSeq *seq, HmEvent *dest, int numEvents, uint64_t from, uint64_t to, bool chase)
+{
+	update_sequence(seq);
+
+	const Snapshot *snapshot = seq->snapshot;
+	if (!snapshot)
+		return 0;
+
+	int n = 0;
+
+	for (int i = 0; i < snapshot->numLanes && n < numEvents; i++) {
+		const Lane *lane = snapshot->lanes[i];
+
+		int point = find_point(snapshot, lane, to);
+		if (point < 0)
+			continue;
+
+		if (!chase) {
+			int last = find_point(snapshot, lane, from);
+			bool ramping = last >= 0 && last + 1 < lane->numPoints && lane->points[last].curve != HM_CURVE_STEP;
+
+			if (point == last && !ramping)
+				continue;
+		}
+
+		float value = lane_value(snapshot, lane, point, to);
+		HmEvent *event = &dest[n++];
+
+		event->time = 0;
+		event->channel = lane->target.channel;
+		event->type = lane->target.type;
+
+		switch (lane->target.type) {
+			case HM_EV_PITCH:
+				event->data.pitch = value;
+				break;
+
+			case HM_EV_CONTROL:
+				event->data.control.num = lane->target.num;
+				event->data.control.value = value;
+				break;
+
+			default:
+				event->data.param.num = lane->target.num;
+				event->data.param.value = value;
+				break;
+		}
+	}
+
+	return n;
+}
+
+static void process_retired(HmSeq *seq)
+{
+	Snapshot *snapshot = __atomic_exchange_n(&seq->retired, NULL, __ATOMIC_ACQUIRE);
+
+	while (snapshot) {
+		Snapshot *next = snapshot->nextRetired;
+		release_snapshot(snapshot);
+		snapshot = next;
+	}
+
+	/* Stop paging a mapping once nothing else is using it */
+	if (seq->paged && seq->paged->refs == 1) {
+		set_paged(seq, NULL);
+	}
+}
+
+void hm_seq_process_messages(HmSeq *seq)
+{
+	finish_builds(seq);
+}
+
+/*
+ * Builds the edit copy from a loaded snapshot the first time it is needed,
+ * pairing each note off with the earliest open note on the same channel and
+ * key that ends at that time. Unpaired note events are dropped.
+ */
+static AlError load_pending(HmSeq *seq)
+{
+	if (!seq->pending)
+		return AL_NO_ERROR;
+
+	BEGIN()
+
+	const HmEvent *events = seq->pending->events;
+	int numEvents = seq->pending->numEvents;
+
+	Entry *entries = NULL;
+	int *next = NULL;
+	int *open = NULL;
+	int numEntries = 0;
+	int numChannels = 0;
+
+	for (int i = 0; i < numEvents; i++) {
+		if (events[i].channel < 0)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		if (events[i].channel >= numChannels) {
+			numChannels = events[i].channel + 1;
+		}
+	}
+
+	TRY(al_malloc(&entries, sizeof(Entry) * (numEvents + 1)));
+	TRY(al_malloc(&next, sizeof(int) * (numEvents + 1)));
+	TRY(al_malloc(&open, sizeof(int) * 2 * 128 * numChannels + 1));
+
+	for (int i = 0; i < 128 * numChannels; i++) {
+		open[2 * i] = -1;
+	}
+
+	for (int i = 0; i < numEvents; i++) {
+		const HmEvent *event = &events[i];
+		int key = 0;
+
+		if (event->type == HM_EV_NOTE_ON || event->type == HM_EV_NOTE_OFF) {
+			if (event->data.note.num < 0 || event->data.note.num > 127)
+				THROW(AL_ERROR_INVALID_DATA);
+
+			key = 2 * (event->channel * 128 + event->data.note.num);
+		}
+
+		Entry *entry = &entries[numEntries];
+		*entry = (Entry){
+			.event = *event,
+			.note = NULL
+		};
+
+		if (event->type == HM_EV_NOTE_ON) {
+			TRY(al_malloc(&entry->note, sizeof(HmNote)));
+			*entry->note = (HmNote){
+				.refs = 0,
+				.channel = event->channel,
+				.time = event->time,
+				.data = {
+					.length = event->data.note.length,
+					.num = event->data.note.num,
+					.velocity = event->data.note.velocity
+				}
+			};
+
+			next[numEntries] = -1;
+			if (open[key] < 0) {
+				open[key] = numEntries;
+			} else {
+				next[open[key + 1]] = numEntries;
+			}
+			open[key + 1] = numEntries;
+
+		} else if (event->type == HM_EV_NOTE_OFF) {
+			int prev = -1;
+			int on = open[key];
+			while (on >= 0 && entries[on].note->time + entries[on].note->data.length != event->time) {
+				prev = on;
+				on = next[on];
+			}
+
+			if (on < 0)
+				continue;
+
+			if (prev < 0) {
+				open[key] = next[on];
+			} else {
+				next[prev] = next[on];
+			}
+
+			if (open[key + 1] == on) {
+				open[key + 1] = prev;
+			}
+
+			next[on] = -2;
+			entry->note = entries[on].note;
+		}
+
+		numEntries++;
+	}
+
+	int kept = 0;
+	for (int i = 0; i < numEntries; i++) {
+		Entry *entry = &entries[i];
+
+		if (entry->event.type == HM_EV_NOTE_ON && next[i] != -2) {
+			free(entry->note);
+			continue;
+		}
+
+		entries[kept++] = *entry;
+	}
+	numEntries = kept;
+
+	TRY(merge_entries(seq, entries, numEntries));
+
+	release_snapshot(seq->pending);
+	seq->pending = NULL;
+	seq->reload = false;
+
+	CATCH(
+		for (int i = 0; i < numEntries; i++) {
+			if (entries[i].event.type == HM_EV_NOTE_ON) {
+				free(entries[i].note);
+			}
+		}
+	)
+	FINALLY(
+		free(entries);
+		free(next);
+		free(open);
+	)
+}
+
+static void wait_for_build(HmSeq *seq)
+{
+	pthread_mutex_lock(&seq->lock);
+	while (seq->request || seq->building) {
+		pthread_cond_wait(&seq->cond, &seq->lock);
+	}
+	pthread_mutex_unlock(&seq->lock);
+}
+
+/*
+ * Builds hold their own references, so edits don't wait for them. Taking
+ * finished ones back first drops those references, so that chunks the
+ * build shared aren't copied for nothing.
+ */
+static AlError begin_edit(HmSeq *seq)
+{
+	finish_builds(seq);
+	return load_pending(seq);
+}
+
+/*
+ * The tempo map and lanes are kept apart from the events, so changing them
+ * doesn't need the edit copy. Loaded events are placed again with them at
+ * the next commit instead.
+ */
+static void begin_timing_edit(HmSeq *seq)
+{
+	finish_builds(seq);
+
+	if (seq->pending) {
+		seq->reload = true;
+	}
+}
+
+static Entry make_note_entry(HmNote *note, HmEventType type)
+{
+	bool on = type == HM_EV_NOTE_ON;
+
+	return (Entry){
+		.event = {
+			.time = (on) ? note->time : note->time + note->data.length,
+			.channel = note->channel,
+			.type = type,
+			.data = {
+				.note = {
+					.num = note->data.num,
+					.velocity = (on) ? note->data.velocity : 0,
+					.length = (on) ? note->data.length : 0
+				}
+			}
+		},
+		.note = note
+	};
+}
+
+/* Needs two reserved inserts */
+static void insert_note(HmSeq *seq, HmNote *note)
+{
+	Entry on = make_note_entry(note, HM_EV_NOTE_ON);
+	Entry off = make_note_entry(note, HM_EV_NOTE_OFF);
+
+	insert_entry(seq, &on);
+	insert_entry(seq, &off);
+}
+
+/* Needs two reserved removes. The note is freed if nothing else has it. */
+static void remove_note(HmSeq *seq, HmNote *note)
+{
+	Pos pos;
+
+	if (find_note_entry(seq, note, HM_EV_NOTE_OFF, &pos)) {
+		remove_entry(seq, pos);
+	}
+
+	if (find_note_entry(seq, note, HM_EV_NOTE_ON, &pos)) {
+		remove_entry(seq, pos);
+	}
+}
+
+static bool get_item(const Entry *entry, HmSeqItem *item)
+{
+	const HmEvent *event = &entry->event;
+
+	switch (event->type) {
+		case HM_EV_NOTE_ON:
+			*item = (HmSeqItem){
+				.type = HM_SEQ_NOTE,
+				.time = event->time,
+				.channel = event->channel,
+				.data = {
+					.note = {
+						.note = entry->note,
+						.data = entry->note->data
+					}
+				}
+			};
+			return true;
+
+		case HM_EV_NOTE_OFF:
+			return false;
+
+		case HM_EV_PITCH:
+			*item = (HmSeqItem){
+				.type = HM_SEQ_PITCH,
+				.time = event->time,
+				.channel = event->channel,
+				.data = {
+					.pitch = event->data.pitch
+				}
+			};
+			return true;
+
+		case HM_EV_CONTROL:
+			*item = (HmSeqItem){
+				.type = HM_SEQ_CONTROL,
+				.time = event->time,
+				.channel = event->channel,
+				.data = {
+					.control = {
+						.num = event->data.control.num,
+						.value = event->data.control.value
+					}
+				}
+			};
+			return true;
+
+		case HM_EV_PARAM:
+			*item = (HmSeqItem){
+				.type = HM_SEQ_PARAM,
+				.time = event->time,
+				.channel = event->channel,
+				.data = {
+					.param = {
+						.num = event->data.param.num,
+						.value = event->data.param.value
+					}
+				}
+			};
+			return true;
+
+		case HM_EV_PATCH:
+			*item = (HmSeqItem){
+				.type = HM_SEQ_PATCH,
+				.time = event->time,
+				.channel = event->channel,
+				.data = {
+					.patch = event->data.patch
+				}
+			};
+			return true;
+	}
+
+	return false;
+}
+
+AlError hm_seq_get_items(HmSeq *seq, HmSeqItem **result, int *resultLength)
+{
+	BEGIN()
+
+	HmSeqItem *items = NULL;
+	int numItems = 0;
+	TRY(begin_edit(seq));
+	TRY(al_malloc(&items, sizeof(HmSeqItem) * (seq->numEvents + 1)));
+
+	for (Pos pos = {0, 0}; pos.chunk < seq->numChunks; next_pos(seq, &pos)) {
+		if (get_item(get_entry(seq, pos), &items[numItems])) {
+			numItems++;
+		}
+	}
+
+	*result = items;
+	*resultLength = numItems;
+
+	CATCH(
+		free(items);
+	)
+	FINALLY()
+}
+
+/* Brings the running latest note ends up to date */
+static AlError reach_chunks(HmSeq *seq)
+{
+	BEGIN()
+
+	if (seq->reachLength < seq->numChunks) {
+		uint64_t *reach = realloc(seq->reach, sizeof(uint64_t) * seq->chunksLength);
+		if (!reach)
+			THROW(AL_ERROR_MEMORY);
+
+		seq->reach = reach;
+		seq->reachLength = seq->chunksLength;
+	}
+
+	for (int i = seq->numReached; i < seq->numChunks; i++) {
+		uint64_t before = (i > 0) ? seq->reach[i - 1] : 0;
+		uint64_t maxEnd = seq->chunks[i]->maxEnd;
+
+		seq->reach[i] = (maxEnd > before) ? maxEnd : before;
+	}
+	seq->numReached = seq->numChunks;
+
+	PASS()
+}
+
+/*
+ * Starts at the first chunk with a note still sounding at start, or at the
+ * first with anything from start on. Items hand out notes to edit, so
+ * loaded events are still turned into the edit copy first.
+ */
+AlError hm_seq_range_init(HmSeq *seq, HmSeqRange *range, uint32_t start, uint32_t end, int channel, unsigned types)
+{
+	BEGIN()
+
+	TRY(load_pending(seq));
+	TRY(reach_chunks(seq));
+
+	int a = 0;
+	int b = seek(seq, start).chunk;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (seq->reach[m] > start) {
+			b = m;
+		} else {
+			a = m + 1;
+		}
+	}
+
+	*range = (HmSeqRange){
+		.seq = seq,
+		.start = start,
+		.end = end,
+		.channel = channel,
+		.types = (types) ? types : ~0u,
+		.chunk = a,
+		.index = 0
+	};
+
+	PASS()
+}
+
+bool hm_seq_range_next(HmSeqRange *range, HmSeqItem *item)
+{
+	HmSeq *seq = range->seq;
+	Pos pos = {range->chunk, range->index};
+	bool found = false;
+
+	while (!found && pos.chunk < seq->numChunks) {
+		Chunk *chunk = seq->chunks[pos.chunk];
+
+		/* Skip chunks from before the window whose notes have all finished */
+		if (pos.index == 0 && chunk->maxEnd <= range->start && last_time(chunk) < range->start) {
+			pos.chunk++;
+			continue;
+		}
+
+		Entry *entry = get_entry(seq, pos);
+		if (entry->event.time >= range->end) {
+			pos.chunk = seq->numChunks;
+			break;
+		}
+
+		next_pos(seq, &pos);
+
+		if (range->channel >= 0 && entry->event.channel != range->channel)
+			continue;
+
+		if (!get_item(entry, item) || !(range->types & (1u << item->type)))
+			continue;
+
+		if (item->time < range->start) {
+			found = item->type == HM_SEQ_NOTE &&
+				item->time + item->data.note.data.length > range->start;
+		} else {
+			found = true;
+		}
+	}
+
+	range->chunk = pos.chunk;
+	range->index = pos.index;
+
+	return found;
+}
+
+AlError hm_seq_add_note(HmSeq *seq, int channel, uint32_t time, HmNoteData *data)
+{
+	BEGIN()
+
+	HmNote *note = NULL;
+	TRY(begin_edit(seq));
+	TRY(al_malloc(&note, sizeof(HmNote)));
+	TRY(reserve(seq));
+
+	*note = (HmNote){
+		.refs = 0,
+		.channel = channel,
+		.time = time,
+		.data = *data
+	};
+
+	insert_note(seq, note);
+
+	CATCH(
+		free(note);
+	)
+	FINALLY()
+}
+
+AlError hm_seq_remove_note(HmSeq *seq, HmNote *note)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+	TRY(reserve(seq));
+
+	remove_note(seq, note);
+
+	PASS()
+}
+
+AlError hm_seq_update_note(HmSeq *seq, HmNote *note, uint32_t time, HmNoteData *data)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+	TRY(reserve(seq));
+
+	note->refs++;
+	remove_note(seq, note);
+
+	note->time = time;
+	note->data = *data;
+
+	insert_note(seq, note);
+	release_note(note);
+
+	PASS()
+}
+
+AlError hm_seq_add_notes(HmSeq *seq, const HmSeqNote *notes, int numNotes)
+{
+	if (numNotes <= 0)
+		return AL_NO_ERROR;
+
+	BEGIN()
+
+	Entry *entries = NULL;
+	int numEntries = 0;
+	TRY(begin_edit(seq));
+	TRY(al_malloc(&entries, sizeof(Entry) * numNotes * 4));
+
+	for (int i = 0; i < numNotes; i++) {
+		HmNote *note = NULL;
+		TRY(al_malloc(&note, sizeof(HmNote)));
+
+		*note = (HmNote){
+			.refs = 0,
+			.channel = notes[i].channel,
+			.time = notes[i].time,
+			.data = notes[i].data
+		};
+
+		entries[numEntries++] = make_note_entry(note, HM_EV_NOTE_ON);
+		entries[numEntries++] = make_note_entry(note, HM_EV_NOTE_OFF);
+	}
+
+	sort_entries(entries, entries + numEntries, numEntries);
+	TRY(merge_entries(seq, entries, numEntries));
+
+	CATCH(
+		for (int i = 0; i < numEntries; i++) {
+			if (entries[i].event.type == HM_EV_NOTE_ON) {
+				free(entries[i].note);
+			}
+		}
+	)
+	FINALLY(
+		free(entries);
+	)
+}
+
+AlError hm_seq_add_events(HmSeq *seq, const HmEvent *events, int numEvents)
+{
+	if (numEvents <= 0)
+		return AL_NO_ERROR;
+
+	BEGIN()
+
+	Entry *entries = NULL;
+
+	for (int i = 0; i < numEvents; i++) {
+		if (events[i].type == HM_EV_NOTE_ON || events[i].type == HM_EV_NOTE_OFF)
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(begin_edit(seq));
+	TRY(al_malloc(&entries, sizeof(Entry) * numEvents * 2));
+
+	for (int i = 0; i < numEvents; i++) {
+		entries[i] = (Entry){
+			.event = events[i],
+			.note = NULL
+		};
+	}
+
+	sort_entries(entries, entries + numEvents, numEvents);
+	TRY(merge_entries(seq, entries, numEvents));
+
+	PASS(
+		free(entries);
+	)
+}
+
+static AlError set_event(HmSeq *seq, const HmEvent *event)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+	TRY(reserve(seq));
+
+	Pos pos;
+	if (find_slot(seq, event, &pos)) {
+		own_chunk(seq, pos.chunk)->entries[pos.index].event.data = event->data;
+
+	} else {
+		Entry entry = {
+			.event = *event,
+			.note = NULL
+		};
+
+		insert_entry(seq, &entry);
+	}
+
+	PASS()
+}
+
+static AlError clear_event(HmSeq *seq, const HmEvent *event)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+	TRY(reserve(seq));
+
+	Pos pos;
+	if (find_slot(seq, event, &pos)) {
+		remove_entry(seq, pos);
+	}
+
+	PASS()
+}
+
+AlError hm_seq_set_pitch(HmSeq *seq, int channel, uint32_t time, float pitch)
+{
+	return set_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_PITCH,
+		.data = {
+			.pitch = pitch
+		}
+	});
+}
+
+AlError hm_seq_clear_pitch(HmSeq *seq, int channel, uint32_t time)
+{
+	return clear_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_PITCH
+	});
+}
+
+AlError hm_seq_set_control(HmSeq *seq, int channel, uint32_t time, int control, float value)
+{
+	return set_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_CONTROL,
+		.data = {
+			.control = {
+				.num = control,
+				.value = value
+			}
+		}
+	});
+}
+
+AlError hm_seq_clear_control(HmSeq *seq, int channel, uint32_t time, int control)
+{
+	return clear_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_CONTROL,
+		.data = {
+			.control = {
+				.num = control
+			}
+		}
+	});
+}
+
+AlError hm_seq_set_param(HmSeq *seq, int channel, uint32_t time, int param, float value)
+{
+	return set_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_PARAM,
+		.data = {
+			.param = {
+				.num = param,
+				.value = value
+			}
+		}
+	});
+}
+
+AlError hm_seq_clear_param(HmSeq *seq, int channel, uint32_t time, int param)
+{
+	return clear_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_PARAM,
+		.data = {
+			.param = {
+				.num = param
+			}
+		}
+	});
+}
+
+AlError hm_seq_set_patch(HmSeq *seq, int channel, uint32_t time, int patch)
+{
+	return set_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_PATCH,
+		.data = {
+			.patch = patch
+		}
+	});
+}
+
+AlError hm_seq_clear_patch(HmSeq *seq, int channel, uint32_t time)
+{
+	return clear_event(seq, &(HmEvent){
+		.time = time,
+		.channel = channel,
+		.type = HM_EV_PATCH
+	});
+}
+
+static AlError reserve_patterns(HmSeq *seq, int numPatterns)
+{
+	BEGIN()
+
+	if (numPatterns > seq->patternsLength) {
+		int length = seq->patternsLength ? seq->patternsLength : 8;
+		while (length < numPatterns) {
+			length *= 2;
+		}
+
+		HmPattern **patterns = realloc(seq->patterns, sizeof(HmPattern *) * length);
+		if (!patterns)
+			THROW(AL_ERROR_MEMORY);
+
+		seq->patterns = patterns;
+		seq->patternsLength = length;
+	}
+
+	PASS()
+}
+
+static AlError reserve_instances(HmSeq *seq, int numInstances)
+{
+	BEGIN()
+
+	if (numInstances > seq->instancesLength) {
+		int length = seq->instancesLength ? seq->instancesLength : 8;
+		while (length < numInstances) {
+			length *= 2;
+		}
+
+		HmInstance **instances = realloc(seq->instances, sizeof(HmInstance *) * length);
+		if (!instances)
+			THROW(AL_ERROR_MEMORY);
+
+		seq->instances = instances;
+		seq->instancesLength = length;
+	}
+
+	PASS()
+}
+
+AlError hm_seq_add_pattern(HmSeq *seq, const HmSeqNote *notes, int numNotes, const HmEvent *events, int numEvents, HmPattern **result)
+{
+	BEGIN()
+
+	HmPattern *pattern = NULL;
+	Entry *entries = NULL;
+	HmNote *pairs = NULL;
+	int numEntries = numNotes * 2 + numEvents;
+
+	for (int i = 0; i < numEvents; i++) {
+		if (events[i].type == HM_EV_NOTE_ON || events[i].type == HM_EV_NOTE_OFF)
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	TRY(begin_edit(seq));
+	TRY(reserve_patterns(seq, seq->numPatterns + 1));
+	TRY(al_malloc(&pattern, sizeof(HmPattern) + sizeof(HmEvent) * numEntries));
+	TRY(al_malloc(&entries, sizeof(Entry) * (numEntries * 2 + 1)));
+	TRY(al_malloc(&pairs, sizeof(HmNote) * (numNotes + 1)));
+
+	int n = 0;
+	for (int i = 0; i < numNotes; i++) {
+		pairs[i] = (HmNote){
+			.channel = 0,
+			.time = notes[i].time,
+			.data = notes[i].data
+		};
+
+		entries[n++] = make_note_entry(&pairs[i], HM_EV_NOTE_ON);
+		entries[n++] = make_note_entry(&pairs[i], HM_EV_NOTE_OFF);
+	}
+
+	for (int i = 0; i < numEvents; i++) {
+		entries[n] = (Entry){
+			.event = events[i],
+			.note = NULL
+		};
+		entries[n++].event.channel = 0;
+	}
+
+	sort_entries(entries, entries + numEntries, numEntries);
+
+	pattern->refs = 1;
+	pattern->numEvents = numEntries;
+	pattern->length = (numEntries > 0) ? entries[numEntries - 1].event.time : 0;
+	for (int i = 0; i < numEntries; i++) {
+		pattern->events[i] = entries[i].event;
+	}
+
+	seq->patterns[seq->numPatterns++] = pattern;
+	*result = pattern;
+
+	CATCH(
+		free(pattern);
+	)
+	FINALLY(
+		free(entries);
+		free(pairs);
+	)
+}
+
+static void remove_instance_at(HmSeq *seq, int index)
+{
+	release_instance(seq->instances[index]);
+	memmove(&seq->instances[index], &seq->instances[index + 1], sizeof(HmInstance *) * (seq->numInstances - index - 1));
+	seq->numInstances--;
+}
+
+AlError hm_seq_remove_pattern(HmSeq *seq, HmPattern *pattern)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+
+	for (int i = 0; i < seq->numPatterns; i++) {
+		if (seq->patterns[i] == pattern) {
+			for (int j = seq->numInstances - 1; j >= 0; j--) {
+				if (seq->instances[j]->pattern == pattern) {
+					remove_instance_at(seq, j);
+				}
+			}
+
+			memmove(&seq->patterns[i], &seq->patterns[i + 1], sizeof(HmPattern *) * (seq->numPatterns - i - 1));
+			seq->numPatterns--;
+			release_pattern(pattern);
+			break;
+		}
+	}
+
+	PASS()
+}
+
+AlError hm_seq_add_instance(HmSeq *seq, HmPattern *pattern, const HmInstanceData *data, HmInstance **result)
+{
+	BEGIN()
+
+	HmInstance *instance = NULL;
+	TRY(begin_edit(seq));
+	TRY(reserve_instances(seq, seq->numInstances + 1));
+	TRY(al_malloc(&instance, sizeof(HmInstance)));
+
+	*instance = (HmInstance){
+		.refs = 1,
+		.pattern = pattern,
+		.data = *data
+	};
+
+	int index = seq->numInstances;
+	while (index > 0 && seq->instances[index - 1]->data.time > data->time) {
+		index--;
+	}
+
+	memmove(&seq->instances[index + 1], &seq->instances[index], sizeof(HmInstance *) * (seq->numInstances - index));
+	seq->instances[index] = instance;
+	seq->numInstances++;
+	*result = instance;
+
+	PASS()
+}
+
+AlError hm_seq_remove_instance(HmSeq *seq, HmInstance *instance)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+
+	for (int i = 0; i < seq->numInstances; i++) {
+		if (seq->instances[i] == instance) {
+			remove_instance_at(seq, i);
+			break;
+		}
+	}
+
+	PASS()
+}
+
+static bool same_target(const HmAutoTarget *a, const HmAutoTarget *b)
+{
+	return a->channel == b->channel && a->type == b->type && (a->type == HM_EV_PITCH || a->num == b->num);
+}
+
+static int find_lane(HmSeq *seq, const HmAutoTarget *target)
+{
+	for (int i = 0; i < seq->numLanes; i++) {
+		if (same_target(&seq->lanes[i]->target, target))
+			return i;
+	}
+
+	return -1;
+}
+
+static AlError reserve_lanes(HmSeq *seq, int numLanes)
+{
+	BEGIN()
+
+	if (numLanes > seq->lanesLength) {
+		int length = seq->lanesLength ? seq->lanesLength : 8;
+		while (length < numLanes) {
+			length *= 2;
+		}
+
+		Lane **lanes = realloc(seq->lanes, sizeof(Lane *) * length);
+		if (!lanes)
+			THROW(AL_ERROR_MEMORY);
+
+		seq->lanes = lanes;
+		seq->lanesLength = length;
+	}
+
+	PASS()
+}
+
+AlError hm_seq_set_lane(HmSeq *seq, const HmAutoTarget *target, const HmAutoPoint *points, int numPoints)
+{
+	BEGIN()
+
+	Lane *lane = NULL;
+
+	if (target->type != HM_EV_PITCH && target->type != HM_EV_CONTROL && target->type != HM_EV_PARAM)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	for (int i = 0; i < numPoints; i++) {
+		if ((i > 0 && points[i].time <= points[i - 1].time) ||
+			points[i].curve < HM_CURVE_STEP || points[i].curve > HM_CURVE_EXPONENTIAL ||
+			!isfinite(points[i].value))
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	begin_timing_edit(seq);
+
+	int index = find_lane(seq, target);
+
+	if (numPoints > 0) {
+		if (index < 0) {
+			TRY(reserve_lanes(seq, seq->numLanes + 1));
+		}
+
+		TRY(al_malloc(&lane, sizeof(Lane) + sizeof(HmAutoPoint) * numPoints));
+		lane->refs = 1;
+		lane->target = *target;
+		lane->numPoints = numPoints;
+		memcpy(lane->points, points, sizeof(HmAutoPoint) * numPoints);
+
+		if (target->type == HM_EV_PITCH) {
+			lane->target.num = 0;
+		}
+
+		if (index < 0) {
+			seq->lanes[seq->numLanes++] = lane;
+		} else {
+			release_lane(seq->lanes[index]);
+			seq->lanes[index] = lane;
+		}
+
+	} else if (index >= 0) {
+		release_lane(seq->lanes[index]);
+		memmove(&seq->lanes[index], &seq->lanes[index + 1], sizeof(Lane *) * (seq->numLanes - index - 1));
+		seq->numLanes--;
+	}
+
+	PASS()
+}
+
+AlError hm_seq_clear_lanes(HmSeq *seq)
+{
+	BEGIN()
+
+	begin_timing_edit(seq);
+	clear_lanes(seq);
+
+	PASS()
+}
+
+const HmAutoPoint *hm_seq_get_lane(HmSeq *seq, const HmAutoTarget *target, int *numPoints)
+{
+	int index = find_lane(seq, target);
+	if (index < 0) {
+		*numPoints = 0;
+		return NULL;
+	}
+
+	*numPoints = seq->lanes[index]->numPoints;
+	return seq->lanes[index]->points;
+}
+
+int hm_seq_get_num_lanes(HmSeq *seq)
+{
+	return seq->numLanes;
+}
+
+const HmAutoPoint *hm_seq_get_lane_at(HmSeq *seq, int index, HmAutoTarget *target, int *numPoints)
+{
+	const Lane *lane = seq->lanes[index];
+
+	*target = lane->target;
+	*numPoints = lane->numPoints;
+	return lane->points;
+}
+
+static int find_tempo(HmSeq *seq, uint32_t time)
+{
+	int a = 0;
+	int b = seq->numTempos;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+
+		if (seq->tempos[m].time < time) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+
+	return a;
+}
+
+static AlError reserve_tempos(HmSeq *seq, int numTempos)
+{
+	BEGIN()
+
+	if (numTempos > seq->temposLength) {
+		int length = seq->temposLength ? seq->temposLength : 8;
+		while (length < numTempos) {
+			length *= 2;
+		}
+
+		HmTempo *tempos = realloc(seq->tempos, sizeof(HmTempo) * length);
+		if (!tempos)
+			THROW(AL_ERROR_MEMORY);
+
+		seq->tempos = tempos;
+		seq->temposLength = length;
+	}
+
+	PASS()
+}
+
+static bool valid_bpm(float bpm)
+{
+	return bpm >= HM_SEQ_MIN_BPM && bpm <= HM_SEQ_MAX_BPM;
+}
+
+AlError hm_seq_set_tempo(HmSeq *seq, uint32_t time, float bpm)
+{
+	BEGIN()
+
+	if (!valid_bpm(bpm))
+		THROW(AL_ERROR_INVALID_DATA);
+
+	begin_timing_edit(seq);
+
+	int i = find_tempo(seq, time);
+	if (i < seq->numTempos && seq->tempos[i].time == time) {
+		seq->tempos[i].bpm = bpm;
+
+	} else {
+		TRY(reserve_tempos(seq, seq->numTempos + 1));
+
+		memmove(&seq->tempos[i + 1], &seq->tempos[i], sizeof(HmTempo) * (seq->numTempos - i));
+		seq->tempos[i] = (HmTempo){
+			.time = time,
+			.bpm = bpm
+		};
+		seq->numTempos++;
+	}
+
+	PASS()
+}
+
+AlError hm_seq_clear_tempo(HmSeq *seq, uint32_t time)
+{
+	BEGIN()
+
+	begin_timing_edit(seq);
+
+	int i = find_tempo(seq, time);
+	if (i < seq->numTempos && seq->tempos[i].time == time) {
+		memmove(&seq->tempos[i], &seq->tempos[i + 1], sizeof(HmTempo) * (seq->numTempos - i - 1));
+		seq->numTempos--;
+	}
+
+	PASS()
+}
+
+AlError hm_seq_set_tempos(HmSeq *seq, const HmTempo *tempos, int numTempos)
+{
+	BEGIN()
+
+	for (int i = 0; i < numTempos; i++) {
+		if (!valid_bpm(tempos[i].bpm) || (i > 0 && tempos[i].time <= tempos[i - 1].time))
+			THROW(AL_ERROR_INVALID_DATA);
+	}
+
+	begin_timing_edit(seq);
+	TRY(reserve_tempos(seq, numTempos));
+
+	if (numTempos > 0) {
+		memcpy(seq->tempos, tempos, sizeof(HmTempo) * numTempos);
+	}
+	seq->numTempos = numTempos;
+
+	PASS()
+}
+
+const HmTempo *hm_seq_get_tempos(HmSeq *seq, int *numTempos)
+{
+	*numTempos = seq->numTempos;
+	return seq->tempos;
+}
+
+AlError hm_seq_set_sample_rate(HmSeq *seq, double sampleRate)
+{
+	BEGIN()
+
+	if (!(sampleRate > 0.0))
+		THROW(AL_ERROR_INVALID_DATA);
+
+	double oldRate = seq->sampleRate;
+
+	/* Loaded events are placed again as they are, without building the edit copy */
+	if (seq->pending) {
+		seq->sampleRate = sampleRate;
+		TRY(reload_pending(seq));
+
+	} else {
+		TRY(begin_edit(seq));
+
+		seq->sampleRate = sampleRate;
+		TRY(hm_seq_commit(seq));
+	}
+
+	CATCH(
+		seq->sampleRate = oldRate;
+	)
+	FINALLY()
+}
+
+struct HmSeqVersion {
+	Chunk **chunks;
+	int numChunks;
+	int numEvents;
+	HmPattern **patterns;
+	int numPatterns;
+	HmInstance **instances;
+	int numInstances;
+	Lane **lanes;
+	int numLanes;
+	HmTempo *tempos;
+	int numTempos;
+};
+
+AlError hm_seq_save_version(HmSeq *seq, HmSeqVersion **result)
+{
+	BEGIN()
+
+	HmSeqVersion *version = NULL;
+	TRY(begin_edit(seq));
+	TRY(al_malloc(&version, sizeof(HmSeqVersion)));
+
+	*version = (HmSeqVersion){
+		.chunks = NULL,
+		.patterns = NULL,
+		.instances = NULL,
+		.lanes = NULL,
+		.tempos = NULL
+	};
+
+	TRY(al_malloc(&version->chunks, sizeof(Chunk *) * (seq->numChunks + 1)));
+	TRY(al_malloc(&version->patterns, sizeof(HmPattern *) * (seq->numPatterns + 1)));
+	TRY(al_malloc(&version->instances, sizeof(HmInstance *) * (seq->numInstances + 1)));
+	TRY(al_malloc(&version->lanes, sizeof(Lane *) * (seq->numLanes + 1)));
+	TRY(al_malloc(&version->tempos, sizeof(HmTempo) * (seq->numTempos + 1)));
+
+	for (int i = 0; i < seq->numChunks; i++) {
+		version->chunks[i] = seq->chunks[i];
+		version->chunks[i]->refs++;
+	}
+
+	for (int i = 0; i < seq->numPatterns; i++) {
+		version->patterns[i] = seq->patterns[i];
+		version->patterns[i]->refs++;
+	}
+
+	for (int i = 0; i < seq->numInstances; i++) {
+		version->instances[i] = seq->instances[i];
+		version->instances[i]->refs++;
+	}
+
+	for (int i = 0; i < seq->numLanes; i++) {
+		version->lanes[i] = seq->lanes[i];
+		version->lanes[i]->refs++;
+	}
+
+	if (seq->numTempos > 0) {
+		memcpy(version->tempos, seq->tempos, sizeof(HmTempo) * seq->numTempos);
+	}
+
+	version->numChunks = seq->numChunks;
+	version->numEvents = seq->numEvents;
+	version->numPatterns = seq->numPatterns;
+	version->numInstances = seq->numInstances;
+	version->numLanes = seq->numLanes;
+	version->numTempos = seq->numTempos;
+
+	*result = version;
+
+	CATCH(
+		if (version) {
+			free(version->chunks);
+			free(version->patterns);
+			free(version->instances);
+			free(version->lanes);
+			free(version->tempos);
+		}
+		free(version);
+	)
+	FINALLY()
+}
+
+AlError hm_seq_restore_version(HmSeq *seq, const HmSeqVersion *version)
+{
+	BEGIN()
+
+	TRY(begin_edit(seq));
+
+	/* Make room for everything first so the swap can't fail part way */
+	if (seq->chunksLength < version->numChunks + 2) {
+		Chunk **chunks = realloc(seq->chunks, sizeof(Chunk *) * (version->numChunks + 2));
+		if (!chunks)
+			THROW(AL_ERROR_MEMORY);
+
+		seq->chunks = chunks;
+		seq->chunksLength = version->numChunks + 2;
+	}
+
+	TRY(reserve_patterns(seq, version->numPatterns));
+	TRY(reserve_instances(seq, version->numInstances));
+	TRY(reserve_lanes(seq, version->numLanes));
+	TRY(reserve_tempos(seq, version->numTempos));
+
+	for (int i = 0; i < version->numChunks; i++) {
+		version->chunks[i]->refs++;
+	}
+
+	for (int i = 0; i < version->numPatterns; i++) {
+		version->patterns[i]->refs++;
+	}
+
+	for (int i = 0; i < version->numInstances; i++) {
+		version->instances[i]->refs++;
+	}
+
+	for (int i = 0; i < version->numLanes; i++) {
+		version->lanes[i]->refs++;
+	}
+
+	clear_entries(seq);
+	clear_patterns(seq);
+	clear_lanes(seq);
+
+	for (int i = 0; i < version->numChunks; i++) {
+		seq->chunks[i] = version->chunks[i];
+	}
+
+	for (int i = 0; i < version->numPatterns; i++) {
+		seq->patterns[i] = version->patterns[i];
+	}
+
+	for (int i = 0; i < version->numInstances; i++) {
+		seq->instances[i] = version->instances[i];
+	}
+
+	for (int i = 0; i < version->numLanes; i++) {
+		seq->lanes[i] = version->lanes[i];
+	}
+
+	for (int i = 0; i < version->numTempos; i++) {
+		seq->tempos[i] = version->tempos[i];
+	}
+
+	seq->numChunks = version->numChunks;
+	seq->numEvents = version->numEvents;
+	seq->numReached = 0;
+	seq->numPatterns = version->numPatterns;
+	seq->numInstances = version->numInstances;
+	seq->numLanes = version->numLanes;
+	seq->numTempos = version->numTempos;
+
+	/* Notes may have been moved since, so put them back where this version has them */
+	for (int i = 0; i < seq->numChunks; i++) {
+		const Chunk *chunk = seq->chunks[i];
+
+		for (int j = 0; j < chunk->numEntries; j++) {
+			const HmEvent *event = &chunk->entries[j].event;
+
+			if (event->type == HM_EV_NOTE_ON) {
+				*chunk->entries[j].note = (HmNote){
+					.refs = chunk->entries[j].note->refs,
+					.channel = event->channel,
+					.time = event->time,
+					.data = {
+						.length = event->data.note.length,
+						.num = event->data.note.num,
+						.velocity = event->data.note.velocity
+					}
+				};
+			}
+		}
+	}
+
+	PASS()
+}
+
+void hm_seq_free_version(HmSeq *seq, HmSeqVersion *version)
+{
+	if (version) {
+		for (int i = 0; i < version->numChunks; i++) {
+			release_chunk(version->chunks[i]);
+		}
+
+		for (int i = 0; i < version->numInstances; i++) {
+			release_instance(version->instances[i]);
+		}
+
+		for (int i = 0; i < version->numPatterns; i++) {
+			release_pattern(version->patterns[i]);
+		}
+
+		for (int i = 0; i < version->numLanes; i++) {
+			release_lane(version->lanes[i]);
+		}
+
+		free(version->chunks);
+		free(version->patterns);
+		free(version->instances);
+		free(version->lanes);
+		free(version->tempos);
+		free(version);
+	}
+}
+
+static AlError flatten_chunks(Chunk *const *chunks, int numChunks, int numEvents, HmEvent **result)
+{
+	BEGIN()
+
+	HmEvent *events = NULL;
+	TRY(al_malloc(&events, sizeof(HmEvent) * (numEvents + 1)));
+
+	HmEvent *event = events;
+	for (int i = 0; i < numChunks; i++) {
+		for (int j = 0; j < chunks[i]->numEntries; j++) {
+			*event++ = chunks[i]->entries[j].event;
+		}
+	}
+
+	*result = events;
+
+	PASS()
+}
+
+static AlError flatten_entries(HmSeq *seq, HmEvent **result, int *numEvents)
+{
+	BEGIN()
+
+	HmEvent *events = NULL;
+
+	if (seq->pending) {
+		TRY(al_malloc(&events, sizeof(HmEvent) * (seq->pending->numEvents + 1)));
+		memcpy(events, seq->pending->events, sizeof(HmEvent) * seq->pending->numEvents);
+		*numEvents = seq->pending->numEvents;
+
+	} else {
+		TRY(flatten_chunks(seq->chunks, seq->numChunks, seq->numEvents, &events));
+		*numEvents = seq->numEvents;
+	}
+
+	*result = events;
+
+	PASS()
+}
+
+AlError hm_seq_flatten(HmSeq *seq, HmEvent **result, int *numEvents)
+{
+	BEGIN()
+
+	HmEvent *events = NULL;
+	HmEvent *flat = NULL;
+	Entry *entries = NULL;
+	int numFlat = 0;
+	TRY(flatten_entries(seq, &flat, &numFlat));
+
+	int numPlaced = 0;
+	for (int i = 0; i < seq->numInstances; i++) {
+		numPlaced += seq->instances[i]->pattern->numEvents;
+	}
+
+	TRY(al_malloc(&entries, sizeof(Entry) * (numPlaced * 2 + 1)));
+	TRY(al_malloc(&events, sizeof(HmEvent) * (numFlat + numPlaced + 1)));
+
+	int n = 0;
+	for (int i = 0; i < seq->numInstances; i++) {
+		const HmInstance *instance = seq->instances[i];
+		const HmPattern *pattern = instance->pattern;
+
+		for (int j = 0; j < pattern->numEvents; j++) {
+			if (note_in_range(&instance->data, &pattern->events[j])) {
+				entries[n].note = NULL;
+				place_event(&instance->data, &pattern->events[j], &entries[n++].event);
+			}
+		}
+	}
+
+	sort_entries(entries, entries + n, n);
+
+	/* Events in the sequence itself come before instance events at the same time */
+	int i = 0, j = 0, k = 0;
+	while (i < numFlat && j < n) {
+		events[k++] = (entries[j].event.time < flat[i].time) ? entries[j++].event : flat[i++];
+	}
+
+	while (i < numFlat) events[k++] = flat[i++];
+	while (j < n) events[k++] = entries[j++].event;
+
+	*result = events;
+	*numEvents = k;
+
+	CATCH(
+		free(events);
+	)
+	FINALLY(
+		free(flat);
+		free(entries);
+	)
+}
+
+static uint64_t tempo_rate(double sampleRate, float bpm)
+{
+	return sampleRate * 60.0 / ((double)bpm * HM_SEQ_PPQ) * (POSITION_MASK + 1.0) + 0.5;
+}
+
+static uint64_t key_interval(double sampleRate)
+{
+	uint64_t interval = sampleRate * KEYFRAME_SECONDS;
+
+	return (interval > 0) ? interval : 1;
+}
+
+/*
+ * Works out the tempo map segments for the snapshot and the sample position
+ * of every event, so the audio thread never converts per event. Paged
+ * snapshots skip the positions, which would touch every page.
+ */
+static AlError build_timing(const HmTempo *tempos, int numTempos, double sampleRate, Snapshot *snapshot)
+{
+	BEGIN()
+
+	Segment *segments = NULL;
+	uint64_t *positions = NULL;
+	TRY(al_malloc(&segments, sizeof(Segment) * (numTempos + 1)));
+	if (snapshot->numPages == 0) {
+		TRY(al_malloc(&positions, sizeof(uint64_t) * (snapshot->numEvents + 1)));
+	}
+
+	int numSegments = 1;
+	segments[0] = (Segment){
+		.tick = 0,
+		.position = 0,
+		.rate = tempo_rate(sampleRate, HM_SEQ_DEFAULT_BPM)
+	};
+
+	for (int i = 0; i < numTempos; i++) {
+		const HmTempo *tempo = &tempos[i];
+		Segment *last = &segments[numSegments - 1];
+
+		if (tempo->time == last->tick) {
+			last->rate = tempo_rate(sampleRate, tempo->bpm);
+
+		} else {
+			segments[numSegments++] = (Segment){
+				.tick = tempo->time,
+				.position = add_positions(last->position, ticks_to_position(tempo->time - last->tick, last->rate)),
+				.rate = tempo_rate(sampleRate, tempo->bpm)
+			};
+		}
+	}
+
+	const Segment *segment = segments;
+	const Segment *lastSegment = segments + numSegments - 1;
+
+	for (int i = 0; positions && i < snapshot->numEvents; i++) {
+		uint32_t time = snapshot->events[i].time;
+
+		while (segment < lastSegment && segment[1].tick <= time) {
+			segment++;
+		}
+
+		positions[i] = add_positions(segment->position, ticks_to_position(time - segment->tick, segment->rate));
+	}
+
+	snapshot->positions = positions;
+	snapshot->segments = segments;
+	snapshot->numSegments = numSegments;
+
+	CATCH(
+		free(segments);
+		free(positions);
+	)
+	FINALLY()
+}
+
+static int compare_lengths(const void *a, const void *b)
+{
+	const LengthGroup *x = a;
+	const LengthGroup *y = b;
+
+	if (x->length != y->length)
+		return (x->length < y->length) ? -1 : 1;
+
+	return x->first - y->first;
+}
+
+/*
+ * Groups the instances by pattern length, failing if more than MAX_ACTIVE
+ * would be playing at once.
+ */
+static AlError group_instances(Snapshot *snapshot)
+{
+	BEGIN()
+
+	int numInstances = snapshot->numInstances;
+	LengthGroup *sorted = NULL;
+	LengthGroup *groups = NULL;
+	int *grouped = NULL;
+
+	uint64_t ends[MAX_ACTIVE + 1];
+	int numEnds = 0;
+
+	for (int i = 0; i < numInstances; i++) {
+		const HmInstance *instance = &snapshot->instances[i];
+
+		int kept = 0;
+		for (int j = 0; j < numEnds; j++) {
+			if (ends[j] >= instance->data.time) {
+				ends[kept++] = ends[j];
+			}
+		}
+
+		if (kept == MAX_ACTIVE)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		ends[kept] = (uint64_t)instance->data.time + instance->pattern->length;
+		numEnds = kept + 1;
+	}
+
+	/* Sorted by length then start, reusing the group struct for each one */
+	TRY(al_malloc(&sorted, sizeof(LengthGroup) * (numInstances + 1)));
+	for (int i = 0; i < numInstances; i++) {
+		sorted[i] = (LengthGroup){snapshot->instances[i].pattern->length, i, 1};
+	}
+	qsort(sorted, numInstances, sizeof(LengthGroup), compare_lengths);
+
+	TRY(al_malloc(&groups, sizeof(LengthGroup) * (numInstances + 1)));
+	TRY(al_malloc(&grouped, sizeof(int) * (numInstances + 1)));
+
+	int numGroups = 0;
+	for (int i = 0; i < numInstances; i++) {
+		if (numGroups == 0 || groups[numGroups - 1].length != sorted[i].length) {
+			groups[numGroups++] = (LengthGroup){sorted[i].length, i, 0};
+		}
+
+		grouped[i] = sorted[i].first;
+		groups[numGroups - 1].count++;
+	}
+
+	snapshot->groups = groups;
+	snapshot->numGroups = numGroups;
+	snapshot->grouped = grouped;
+
+	CATCH(
+		free(groups);
+		free(grouped);
+	)
+	FINALLY(
+		free(sorted);
+	)
+}
+
+/*
+ * Copies the instances into the snapshot, taking a reference to each
+ * pattern, so the audio thread can expand them as it goes. The build groups
+ * them.
+ */
+static AlError copy_instances(HmSeq *seq, Snapshot *snapshot)
+{
+	BEGIN()
+
+	HmInstance *instances = NULL;
+	TRY(al_malloc(&instances, sizeof(HmInstance) * (seq->numInstances + 1)));
+
+	for (int i = 0; i < seq->numInstances; i++) {
+		instances[i] = *seq->instances[i];
+		instances[i].pattern->refs++;
+	}
+
+	snapshot->instances = instances;
+	snapshot->numInstances = seq->numInstances;
+
+	PASS()
+}
+
+static AlError copy_lanes(HmSeq *seq, Snapshot *snapshot)
+{
+	BEGIN()
+
+	Lane **lanes = NULL;
+	TRY(al_malloc(&lanes, sizeof(Lane *) * (seq->numLanes + 1)));
+
+	for (int i = 0; i < seq->numLanes; i++) {
+		lanes[i] = seq->lanes[i];
+		lanes[i]->refs++;
+	}
+
+	snapshot->lanes = lanes;
+	snapshot->numLanes = seq->numLanes;
+
+	PASS()
+}
+
+/* What each slot of a keyframe holds, in the order they are replayed */
+enum {
+	KEY_PARAM,
+	KEY_PATCH,
+	KEY_CONTROL,
+	KEY_PITCH
+};
+
+/*
+ * The last change of one kind on a channel. Synths keep params per patch, so
+ * params are also keyed by the patch they were set on.
+ */
+typedef struct {
+	int channel;
+	int kind;
+	int patch;
+	int num;
+	HmEvent event;
+} KeySlot;
+
+typedef struct {
+	KeySlot *slots;
+	int numSlots;
+	int slotsLength;
+	HmEvent *events;
+	int numEvents;
+	int eventsLength;
+	bool changed;
+} KeyState;
+
+static int compare_key_slots(const KeySlot *a, const KeySlot *b)
+{
+	if (a->channel != b->channel)
+		return (a->channel < b->channel) ? -1 : 1;
+	if (a->kind != b->kind)
+		return (a->kind < b->kind) ? -1 : 1;
+	if (a->patch != b->patch)
+		return (a->patch < b->patch) ? -1 : 1;
+	if (a->num != b->num)
+		return (a->num < b->num) ? -1 : 1;
+
+	return 0;
+}
+
+/* Index of the slot, or of where it would go */
+static int find_key_slot(const KeyState *state, const KeySlot *slot, bool *found)
+{
+	int a = 0;
+	int b = state->numSlots;
+
+	while (a < b) {
+		int m = a + (b - a) / 2;
+		int order = compare_key_slots(&state->slots[m], slot);
+
+		if (order == 0) {
+			*found = true;
+			return m;
+		}
+
+		if (order < 0) {
+			a = m + 1;
+		} else {
+			b = m;
+		}
+	}
+
+	*found = false;
+	return a;
+}
+
+static int current_patch(const KeyState *state, int channel)
+{
+	KeySlot key = {
+		.channel = channel,
+		.kind = KEY_PATCH,
+		.patch = 0,
+		.num = 0
+	};
+
+	bool found;
+	int i = find_key_slot(state, &key, &found);
+
+	return found ? state->slots[i].event.data.patch : -1;
+}
+
+static AlError update_key_slot(KeyState *state, const HmEvent *event)
+{
+	BEGIN()
+
+	KeySlot slot = {
+		.channel = event->channel,
+		.patch = 0,
+		.num = 0,
+		.event = *event
+	};
+	slot.event.time = 0;
+
+	switch (event->type) {
+		case HM_EV_PARAM:
+			slot.kind = KEY_PARAM;
+			slot.patch = current_patch(state, event->channel);
+			slot.num = event->data.param.num;
+			break;
+
+		case HM_EV_PATCH:
+			slot.kind = KEY_PATCH;
+			break;
+
+		case HM_EV_CONTROL:
+			slot.kind = KEY_CONTROL;
+			slot.num = event->data.control.num;
+			break;
+
+		default:
+			slot.kind = KEY_PITCH;
+			break;
+	}
+
+	bool found;
+	int i = find_key_slot(state, &slot, &found);
+
+	if (!found) {
+		if (state->numSlots == state->slotsLength) {
+			int length = state->slotsLength ? state->slotsLength * 2 : 32;
+			KeySlot *slots = realloc(state->slots, sizeof(KeySlot) * length);
+			if (!slots)
+				THROW(AL_ERROR_MEMORY);
+
+			state->slots = slots;
+			state->slotsLength = length;
+		}
+
+		memmove(&state->slots[i + 1], &state->slots[i], sizeof(KeySlot) * (state->numSlots - i));
+		state->numSlots++;
+	}
+
+	state->slots[i] = slot;
+	state->changed = true;
+
+	PASS()
+}
+
+static AlError push_key_event(KeyState *state, const HmEvent *event)
+{
+	BEGIN()
+
+	if (state->numEvents == state->eventsLength) {
+		int length = state->eventsLength ? state->eventsLength * 2 : 64;
+		HmEvent *events = realloc(state->events, sizeof(HmEvent) * length);
+		if (!events)
+			THROW(AL_ERROR_MEMORY);
+
+		state->events = events;
+		state->eventsLength = length;
+	}
+
+	state->events[state->numEvents++] = *event;
+
+	PASS()
+}
+
+/*
+ * Writes out the slots as events. Params are grouped under the patch they
+ * were set on, and the current patch is selected again after them.
+ */
+static AlError write_keyframe(KeyState *state, Keyframe *keyframe)
+{
+	BEGIN()
+
+	keyframe->first = state->numEvents;
+
+	int channel = 0;
+	int patch = -1;
+
+	for (int i = 0; i < state->numSlots; i++) {
+		const KeySlot *slot = &state->slots[i];
+
+		if (i == 0 || slot->channel != channel) {
+			channel = slot->channel;
+			patch = -1;
+		}
+
+		if (slot->kind == KEY_PARAM && slot->patch >= 0 && slot->patch != patch) {
+			patch = slot->patch;
+			TRY(push_key_event(state, &(HmEvent){
+				.time = 0,
+				.channel = channel,
+				.type = HM_EV_PATCH,
+				.data = {
+					.patch = patch
+				}
+			}));
+		}
+
+		TRY(push_key_event(state, &slot->event));
+	}
+
+	keyframe->count = state->numEvents - keyframe->first;
+	state->changed = false;
+
+	PASS()
+}
+
+/*
+ * A build of a snapshot's keyframes that can be done a few keyframes at a
+ * time, so the pager can build those of a mapped snapshot between reading
+ * pages in.
+ */
+struct KeyBuild {
+	KeyState state;
+	Keyframes *keys;
+	int next;
+	bool failed;
+};
+
+static void free_keyframes(Keyframes *keys)
+{
+	if (keys) {
+		free(keys->frames);
+		free(keys->events);
+		free(keys);
+	}
+}
+
+static void end_keyframes(KeyBuild *build)
+{
+	free(build->state.slots);
+	free(build->state.events);
+	free_keyframes(build->keys);
+
+	*build = (KeyBuild){
+		.state = {
+			.slots = NULL,
+			.events = NULL
+		},
+		.keys = NULL,
+		.next = 0,
+		.failed = false
+	};
+}
+
+static AlError start_keyframes(const Snapshot *snapshot, KeyBuild *build)
+{
+	BEGIN()
+
+	uint64_t end = 0;
+	if (snapshot->numEvents > 0) {
+		end = event_sample(snapshot, snapshot->numEvents - 1);
+	}
+
+	for (int i = 0; i < snapshot->numInstances; i++) {
+		const HmInstance *instance = &snapshot->instances[i];
+		uint64_t last = tick_to_sample(snapshot, instance->data.time + instance->pattern->length);
+
+		if (last > end) {
+			end = last;
+		}
+	}
+
+	build->state = (KeyState){
+		.slots = NULL,
+		.numSlots = 0,
+		.slotsLength = 0,
+		.events = NULL,
+		.numEvents = 0,
+		.eventsLength = 0,
+		.changed = false
+	};
+	build->next = 0;
+
+	TRY(al_malloc(&build->keys, sizeof(Keyframes)));
+	build->keys->numFrames = (int)(end / snapshot->keyInterval) + 1;
+	build->keys->events = NULL;
+	build->keys->frames = NULL;
+	TRY(al_malloc(&build->keys->frames, sizeof(Keyframe) * build->keys->numFrames));
+
+	CATCH(
+		end_keyframes(build);
+	)
+	FINALLY()
+}
+
+/*
+ * Plays through the snapshot's patch, param, control and pitch changes from
+ * the next keyframe on, recording the state every KEYFRAME_SECONDS so a seek
+ * only has to replay from the keyframe before it. Stops once at least
+ * budget events have been read, setting done after the last keyframe.
+ */
+static AlError step_keyframes(const Snapshot *snapshot, KeyBuild *build, int budget, bool *done)
+{
+	BEGIN()
+
+	KeyState *state = &build->state;
+	Keyframe *frames = build->keys->frames;
+	uint64_t interval = snapshot->keyInterval;
+	HmEvent events[CHASE_EVENTS];
+	int numRead = 0;
+
+	while (build->next < build->keys->numFrames && numRead < budget) {
+		int k = build->next;
+
+		if (k == 0 || state->changed) {
+			TRY(write_keyframe(state, &frames[k]));
+		} else {
+			frames[k] = frames[k - 1];
+		}
+
+		HmSeqPos pos = {k * interval, 0};
+		uint64_t to = pos.sample + interval;
+
+		while (true) {
+			int n = read_events(snapshot, events, CHASE_EVENTS, &pos, to);
+
+			for (int i = 0; i < n; i++) {
+				if (is_state_event(&events[i])) {
+					TRY(update_key_slot(state, &events[i]));
+				}
+			}
+
+			numRead += n;
+			if (n < CHASE_EVENTS)
+				break;
+		}
+
+		build->next++;
+	}
+
+	*done = build->next == build->keys->numFrames;
+
+	PASS()
+}
+
+/* Hands over the finished keyframes */
+static Keyframes *take_keyframes(KeyBuild *build)
+{
+	Keyframes *keys = build->keys;
+	keys->events = build->state.events;
+
+	build->state.events = NULL;
+	build->keys = NULL;
+	end_keyframes(build);
+
+	return keys;
+}
+
+static AlError build_keyframes(Snapshot *snapshot)
+{
+	BEGIN()
+
+	KeyBuild build = {
+		.keys = NULL
+	};
+	bool done;
+
+	TRY(start_keyframes(snapshot, &build));
+	TRY(step_keyframes(snapshot, &build, INT_MAX, &done));
+	snapshot->keys = take_keyframes(&build);
+
+	CATCH(
+		end_keyframes(&build);
+	)
+	FINALLY()
+}
+
+static void publish_snapshot(HmSeq *seq, Snapshot *snapshot)
+{
+	process_retired(seq);
+
+	snapshot->refs++;
+	release_snapshot(seq->committed);
+	seq->committed = snapshot;
+
+	Snapshot *unused = __atomic_exchange_n(&seq->next, snapshot, __ATOMIC_ACQ_REL);
+	release_snapshot(unused);
+}
+
+/*
+ * Builder thread. Fills in the build's snapshot from the chunks it holds,
+ * without counting any references.
+ */
+static AlError build_snapshot(Build *build)
+{
+	BEGIN()
+
+	Snapshot *snapshot = build->snapshot;
+	HmEvent *events = NULL;
+
+	TRY(flatten_chunks(build->chunks, build->numChunks, build->numEvents, &events));
+	snapshot->events = events;
+	snapshot->numEvents = build->numEvents;
+
+	TRY(build_timing(build->tempos, build->numTempos, build->sampleRate, snapshot));
+	TRY(group_instances(snapshot));
+	TRY(build_keyframes(snapshot));
+
 	PASS()
 }
 
-AlError hm_seq_clear_param(HmSeq *seq, int channel, uint32_t time, int param)
+/* Takes references to everything a build reads, so edits can go on meanwhile */
+static AlError make_build(HmSeq *seq, Build **result)
 {
 	BEGIN()
 
-	EventNode *node = find_param_node(seq->head, time, channel, param);
-	if (node) {
-		remove_node(seq, node);
-		free(node);
+	Build *build = NULL;
+	TRY(al_malloc(&build, sizeof(Build)));
+
+	*build = (Build){
+		.snapshot = NULL,
+		.chunks = NULL,
+		.numChunks = 0,
+		.numEvents = seq->numEvents,
+		.tempos = NULL,
+		.numTempos = seq->numTempos,
+		.sampleRate = seq->sampleRate,
+		.unused = NULL,
+		.error = AL_NO_ERROR,
+		.next = NULL
+	};
+
+	TRY(al_malloc(&build->snapshot, sizeof(Snapshot)));
+	*build->snapshot = (Snapshot){
+		.events = NULL,
+		.positions = NULL,
+		.segments = NULL,
+		.instances = NULL,
+		.numInstances = 0,
+		.groups = NULL,
+		.numGroups = 0,
+		.grouped = NULL,
+		.lanes = NULL,
+		.numLanes = 0,
+		.keys = NULL,
+		.keyInterval = key_interval(seq->sampleRate),
+		.refs = 1,
+		.release = NULL,
+		.owner = NULL
+	};
+
+	TRY(copy_instances(seq, build->snapshot));
+	TRY(copy_lanes(seq, build->snapshot));
+
+	TRY(al_malloc(&build->chunks, sizeof(Chunk *) * (seq->numChunks + 1)));
+	TRY(al_malloc(&build->tempos, sizeof(HmTempo) * (seq->numTempos + 1)));
+
+	for (int i = 0; i < seq->numChunks; i++) {
+		build->chunks[i] = seq->chunks[i];
+		build->chunks[i]->refs++;
+	}
+	build->numChunks = seq->numChunks;
+
+	if (seq->numTempos > 0) {
+		memcpy(build->tempos, seq->tempos, sizeof(HmTempo) * seq->numTempos);
+	}
+
+	*result = build;
+
+	CATCH(
+		free_build(build);
+	)
+	FINALLY()
+}
+
+static void free_build(Build *build)
+{
+	if (build) {
+		for (int i = 0; i < build->numChunks; i++) {
+			release_chunk(build->chunks[i]);
+		}
+
+		free(build->chunks);
+		free(build->tempos);
+		release_snapshot(build->snapshot);
+		release_snapshot(build->unused);
+		free(build);
+	}
+}
+
+/*
+ * Takes back a list of finished builds in the order they finished, keeping
+ * the snapshot of each one published as the committed one, then releases
+ * what the audio thread has finished with.
+ */
+static void release_builds(HmSeq *seq, Build *build)
+{
+	while (build) {
+		Build *next = build->next;
+
+		if (build->error) {
+			seq->buildError = build->error;
+
+		} else {
+			release_snapshot(seq->committed);
+			seq->committed = build->snapshot;
+			build->snapshot = NULL;
+		}
+
+		free_build(build);
+		build = next;
+	}
+
+	process_retired(seq);
+}
+
+static void finish_builds(HmSeq *seq)
+{
+	pthread_mutex_lock(&seq->lock);
+	Build *done = seq->done;
+	seq->done = NULL;
+	pthread_mutex_unlock(&seq->lock);
+
+	release_builds(seq, done);
+}
+
+/*
+ * A built snapshot gets a second reference, for the audio thread, before it
+ * is handed over. Whatever it replaces in next is released with the build.
+ */
+static void *run_builder(void *data)
+{
+	HmSeq *seq = data;
+
+	pthread_mutex_lock(&seq->lock);
+
+	while (true) {
+		while (!seq->request && !seq->quit) {
+			pthread_cond_wait(&seq->cond, &seq->lock);
+		}
+
+		if (!seq->request)
+			break;
+
+		Build *build = seq->request;
+		seq->request = NULL;
+		seq->building = true;
+		pthread_mutex_unlock(&seq->lock);
+
+		build->error = build_snapshot(build);
+		if (!build->error) {
+			build->snapshot->refs++;
+			build->unused = __atomic_exchange_n(&seq->next, build->snapshot, __ATOMIC_ACQ_REL);
+		}
+
+		pthread_mutex_lock(&seq->lock);
+		seq->building = false;
+
+		Build **tail = &seq->done;
+		while (*tail) {
+			tail = &(*tail)->next;
+		}
+		*tail = build;
+
+		pthread_cond_broadcast(&seq->cond);
 	}
 
+	pthread_mutex_unlock(&seq->lock);
+
+	return NULL;
+}
+
+static AlError start_builder(HmSeq *seq)
+{
+	BEGIN()
+
+	bool locked = false;
+	bool conditioned = false;
+
+	if (pthread_mutex_init(&seq->lock, NULL) != 0)
+		THROW(AL_ERROR_GENERIC);
+	locked = true;
+
+	if (pthread_cond_init(&seq->cond, NULL) != 0)
+		THROW(AL_ERROR_GENERIC);
+	conditioned = true;
+
+	if (pthread_create(&seq->builder, NULL, run_builder, seq) != 0)
+		THROW(AL_ERROR_GENERIC);
+
+	seq->threaded = true;
+
+	CATCH(
+		if (conditioned) {
+			pthread_cond_destroy(&seq->cond);
+		}
+		if (locked) {
+			pthread_mutex_destroy(&seq->lock);
+		}
+	)
+	FINALLY()
+}
+
+static void stop_builder(HmSeq *seq)
+{
+	if (!seq->threaded)
+		return;
+
+	pthread_mutex_lock(&seq->lock);
+	seq->quit = true;
+	pthread_cond_broadcast(&seq->cond);
+	pthread_mutex_unlock(&seq->lock);
+
+	pthread_join(seq->builder, NULL);
+	pthread_cond_destroy(&seq->cond);
+	pthread_mutex_destroy(&seq->lock);
+	seq->threaded = false;
+}
+
+AlError hm_seq_commit(HmSeq *seq)
+{
+	/* Loaded events are published as they are until the first edit to them */
+	if (seq->pending)
+		return (seq->reload) ? reload_pending(seq) : AL_NO_ERROR;
+
+	BEGIN()
+
+	finish_builds(seq);
+
+	Build *build = NULL;
+	TRY(make_build(seq, &build));
+
+	pthread_mutex_lock(&seq->lock);
+	Build *replaced = seq->request;
+	seq->request = build;
+	pthread_cond_broadcast(&seq->cond);
+	pthread_mutex_unlock(&seq->lock);
+
+	free_build(replaced);
+
+	error = seq->buildError;
+	seq->buildError = AL_NO_ERROR;
+
 	PASS()
 }
 
-AlError hm_seq_set_patch(HmSeq *seq, int channel, uint32_t time, int patch)
+AlError hm_seq_wait(HmSeq *seq)
+{
+	wait_for_build(seq);
+	finish_builds(seq);
+
+	AlError error = seq->buildError;
+	seq->buildError = AL_NO_ERROR;
+
+	return error;
+}
+
+AlError hm_seq_count_events(HmSeq *seq, uint32_t start, uint32_t end, int batch, int *count)
 {
 	BEGIN()
 
-	EventNode *node = find_node(seq->head, time, channel, HM_EV_PATCH);
+	HmEvent *events = NULL;
+	*count = 0;
 
-	if (node) {
-		node->event.data.patch = patch;
+	if (batch <= 0)
+		THROW(AL_ERROR_GENERIC);
 
-	} else {
-		TRY(al_malloc(&node, sizeof(EventNode)));
+	TRY(hm_seq_wait(seq));
 
-		node->prev = NULL;
-		node->next = NULL;
-		node->event = (HmEvent){
-			.time = time,
-			.channel = channel,
-			.type = HM_EV_PATCH,
-			.data = {
-				.patch = patch
+	const Snapshot *snapshot = seq->committed;
+	if (!snapshot)
+		return AL_NO_ERROR;
+
+	TRY(al_malloc(&events, sizeof(HmEvent) * batch));
+
+	HmSeqPos pos = {tick_to_sample(snapshot, start), 0};
+	uint64_t to = tick_to_sample(snapshot, end);
+	int numRead;
+
+	do {
+		numRead = read_events(snapshot, events, batch, &pos, to);
+		*count += numRead;
+	} while (numRead == batch);
+
+	PASS(
+		free(events);
+	)
+}
+
+/* Splits the events into pages, noting the first tick of each */
+static AlError build_pages(Snapshot *snapshot)
+{
+	BEGIN()
+
+	int numPages = (snapshot->numEvents + PAGE_EVENTS - 1) / PAGE_EVENTS;
+	if (numPages == 0) {
+		numPages = 1;
+	}
+
+	uint32_t *pageTicks = NULL;
+	bool *resident = NULL;
+	TRY(al_malloc(&pageTicks, sizeof(uint32_t) * numPages));
+	TRY(al_malloc(&resident, sizeof(bool) * numPages));
+
+	for (int i = 0; i < numPages; i++) {
+		pageTicks[i] = (i * PAGE_EVENTS < snapshot->numEvents) ? snapshot->events[i * PAGE_EVENTS].time : 0;
+		/* Reading the ticks may have brought pages in, so let the pager trim them */
+		resident[i] = true;
+	}
+
+	snapshot->pageTicks = pageTicks;
+	snapshot->resident = resident;
+	snapshot->numPages = numPages;
+
+	CATCH(
+		free(pageTicks);
+		free(resident);
+	)
+	FINALLY()
+}
+
+static AlError load_events(HmSeq *seq, const HmEvent *events, int numEvents, void (*release)(void *owner), void *owner, Snapshot **result)
+{
+	BEGIN()
+
+	/* Builds still to publish would replace the load */
+	wait_for_build(seq);
+	finish_builds(seq);
+
+	Snapshot *snapshot = NULL;
+	TRY(al_malloc(&snapshot, sizeof(Snapshot)));
+
+	*snapshot = (Snapshot){
+		.events = events,
+		.positions = NULL,
+		.numEvents = numEvents,
+		.segments = NULL,
+		.instances = NULL,
+		.numInstances = 0,
+		.groups = NULL,
+		.numGroups = 0,
+		.grouped = NULL,
+		.lanes = NULL,
+		.numLanes = 0,
+		.pageTicks = NULL,
+		.resident = NULL,
+		.numPages = 0,
+		.keys = NULL,
+		.keyInterval = key_interval(seq->sampleRate),
+		.refs = 2,
+		.release = release,
+		.owner = owner
+	};
+
+	if (result) {
+		TRY(build_pages(snapshot));
+	}
+
+	TRY(build_timing(seq->tempos, seq->numTempos, seq->sampleRate, snapshot));
+	TRY(copy_lanes(seq, snapshot));
+
+	/* Reading a mapping through would fault all of it in, so the pager does it */
+	if (!result) {
+		TRY(build_keyframes(snapshot));
+	}
+
+	publish_snapshot(seq, snapshot);
+
+	clear_entries(seq);
+	clear_patterns(seq);
+	release_snapshot(seq->pending);
+	seq->pending = snapshot;
+	seq->reload = false;
+
+	if (result) {
+		*result = snapshot;
+	}
+
+	CATCH(
+		if (snapshot) {
+			free(snapshot->positions);
+			free(snapshot->segments);
+			free(snapshot->pageTicks);
+			free(snapshot->resident);
+			free_keyframes(snapshot->keys);
+		}
+		free(snapshot);
+	)
+	FINALLY()
+}
+
+AlError hm_seq_load(HmSeq *seq, const HmEvent *events, int numEvents, void (*release)(void *owner), void *owner)
+{
+	return load_events(seq, events, numEvents, release, owner, NULL);
+}
+
+/*
+ * First page a chase to the sample reads, from the page before its
+ * keyframe's in case events at that tick started there, or from the start
+ * while there are no keyframes.
+ */
+static int chase_page(const Snapshot *snapshot, uint64_t sample)
+{
+	const Keyframes *keys = __atomic_load_n(&snapshot->keys, __ATOMIC_ACQUIRE);
+	if (!keys)
+		return 0;
+
+	uint64_t k = sample / snapshot->keyInterval;
+	if (k >= (uint64_t)keys->numFrames) {
+		k = keys->numFrames - 1;
+	}
+
+	int page = find_page(snapshot, sample_to_tick(snapshot, k * snapshot->keyInterval));
+
+	return (page > 0) ? page - 1 : 0;
+}
+
+/*
+ * Reads in the pages from just behind the playhead to PAGES_AHEAD in front
+ * of it, and those a seek to seekTick chases through and plays first, and
+ * gives back the rest, keeping a long sequence's resident set to a few
+ * pages.
+ */
+static void update_pages(HmSeq *seq)
+{
+	Snapshot *snapshot = seq->paged;
+	uintptr_t osPage = (uintptr_t)sysconf(_SC_PAGESIZE);
+	int current = find_page(snapshot, __atomic_load_n(&seq->playTick, __ATOMIC_RELAXED));
+	int seekFirst = 0;
+	int seekLast = -1;
+
+	if (seq->seeking) {
+		seekFirst = chase_page(snapshot, tick_to_sample(snapshot, seq->seekTick));
+		seekLast = find_page(snapshot, seq->seekTick) + PAGES_AHEAD;
+	}
+
+	for (int i = 0; i < snapshot->numPages; i++) {
+		int first = i * PAGE_EVENTS;
+		int last = (first + PAGE_EVENTS < snapshot->numEvents) ? first + PAGE_EVENTS : snapshot->numEvents;
+		if (first >= last)
+			continue;
+
+		uintptr_t start = (uintptr_t)&snapshot->events[first];
+		uintptr_t end = (uintptr_t)&snapshot->events[last];
+		bool wanted = (i >= current - 1 && i <= current + PAGES_AHEAD) ||
+			(i >= seekFirst && i <= seekLast);
+
+		if (wanted && !snapshot->resident[i]) {
+			uintptr_t from = start & ~(osPage - 1);
+			madvise((void *)from, end - from, MADV_WILLNEED);
+
+			/* The advice is only a hint, so fault the pages in as well */
+			for (uintptr_t p = from; p < end; p += osPage) {
+				(void)*(volatile const char *)(p > start ? p : start);
 			}
+			snapshot->resident[i] = true;
+
+		} else if (!wanted && snapshot->resident[i]) {
+			/* Only whole pages inside this one, as neighbours share the ends */
+			uintptr_t from = (start + osPage - 1) & ~(osPage - 1);
+			uintptr_t to = end & ~(osPage - 1);
+			if (from < to) {
+				madvise((void *)from, to - from, MADV_DONTNEED);
+			}
+			snapshot->resident[i] = false;
+		}
+	}
+}
+
+/*
+ * Builds some more of the paged snapshot's keyframes. The pages read are
+ * marked resident, so the next update gives back those it doesn't want.
+ */
+static AlError build_paged_keyframes(HmSeq *seq)
+{
+	Snapshot *snapshot = seq->paged;
+	KeyBuild *build = seq->keyBuild;
+
+	if (snapshot->keys || build->failed)
+		return AL_NO_ERROR;
+
+	BEGIN()
+
+	if (!build->keys) {
+		TRY(start_keyframes(snapshot, build));
+	}
+
+	bool done;
+	int first = find_first_event(snapshot, build->next * snapshot->keyInterval);
+	TRY(step_keyframes(snapshot, build, KEYFRAME_BATCH, &done));
+	int last = (done) ? snapshot->numEvents : find_first_event(snapshot, build->next * snapshot->keyInterval);
+
+	for (int i = first / PAGE_EVENTS; i * PAGE_EVENTS < last; i++) {
+		snapshot->resident[i] = true;
+	}
+
+	if (done) {
+		__atomic_store_n(&snapshot->keys, take_keyframes(build), __ATOMIC_RELEASE);
+	}
+
+	/* Seeks go on replaying from the start rather than trying again */
+	CATCH(
+		end_keyframes(build);
+		build->failed = true;
+	)
+	FINALLY()
+}
+
+/* Marks the pages the audio thread's last chase read, so they are given back */
+static void mark_chased(HmSeq *seq)
+{
+	uint64_t sample = __atomic_exchange_n(&seq->chaseSample, NO_CHASE, __ATOMIC_RELAXED);
+	if (sample == NO_CHASE)
+		return;
+
+	Snapshot *snapshot = seq->paged;
+	int last = find_page(snapshot, sample_to_tick(snapshot, sample));
+
+	for (int i = chase_page(snapshot, sample); i <= last; i++) {
+		snapshot->resident[i] = true;
+	}
+}
+
+static void *run_pager(void *data)
+{
+	HmSeq *seq = data;
+
+	pthread_mutex_lock(&seq->pageLock);
+
+	while (!seq->pageQuit) {
+		if (seq->paged) {
+			mark_chased(seq);
+			update_pages(seq);
+			build_paged_keyframes(seq);
+		}
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		long usec = now.tv_usec + PAGE_INTERVAL_MS * 1000;
+		struct timespec deadline = {
+			.tv_sec = now.tv_sec + usec / 1000000,
+			.tv_nsec = (usec % 1000000) * 1000
 		};
 
-		insert_node(seq, node);
+		pthread_cond_timedwait(&seq->pageCond, &seq->pageLock, &deadline);
 	}
 
-	PASS()
+	pthread_mutex_unlock(&seq->pageLock);
+
+	return NULL;
 }
 
-AlError hm_seq_clear_patch(HmSeq *seq, int channel, uint32_t time)
+static AlError start_pager(HmSeq *seq)
 {
+	if (seq->paging)
+		return AL_NO_ERROR;
+
 	BEGIN()
 
-	EventNode *node = find_node(seq->head, time, channel, HM_EV_PATCH);
-	if (node) {
-		remove_node(seq, node);
-		free(node);
+	bool locked = false;
+	bool conditioned = false;
+
+	TRY(al_malloc(&seq->keyBuild, sizeof(KeyBuild)));
+	*seq->keyBuild = (KeyBuild){
+		.keys = NULL,
+		.next = 0,
+		.failed = false
+	};
+
+	if (pthread_mutex_init(&seq->pageLock, NULL) != 0)
+		THROW(AL_ERROR_GENERIC);
+	locked = true;
+
+	if (pthread_cond_init(&seq->pageCond, NULL) != 0)
+		THROW(AL_ERROR_GENERIC);
+	conditioned = true;
+
+	if (pthread_create(&seq->pager, NULL, run_pager, seq) != 0)
+		THROW(AL_ERROR_GENERIC);
+
+	seq->paging = true;
+
+	CATCH(
+		if (conditioned) {
+			pthread_cond_destroy(&seq->pageCond);
+		}
+		if (locked) {
+			pthread_mutex_destroy(&seq->pageLock);
+		}
+		free(seq->keyBuild);
+		seq->keyBuild = NULL;
+	)
+	FINALLY()
+}
+
+static void stop_pager(HmSeq *seq)
+{
+	if (!seq->paging)
+		return;
+
+	pthread_mutex_lock(&seq->pageLock);
+	seq->pageQuit = true;
+	pthread_cond_broadcast(&seq->pageCond);
+	pthread_mutex_unlock(&seq->pageLock);
+
+	pthread_join(seq->pager, NULL);
+	pthread_cond_destroy(&seq->pageCond);
+	pthread_mutex_destroy(&seq->pageLock);
+	seq->paging = false;
+
+	end_keyframes(seq->keyBuild);
+	free(seq->keyBuild);
+	seq->keyBuild = NULL;
+
+	release_snapshot(seq->paged);
+	seq->paged = NULL;
+}
+
+/*
+ * Hands the pager a new snapshot to page. The old one is released outside
+ * the lock, as that may unmap it.
+ */
+static void set_paged(HmSeq *seq, Snapshot *snapshot)
+{
+	if (!seq->paging)
+		return;
+
+	if (snapshot) {
+		snapshot->refs++;
+	}
+
+	pthread_mutex_lock(&seq->pageLock);
+	Snapshot *old = seq->paged;
+	seq->paged = snapshot;
+	end_keyframes(seq->keyBuild);
+	pthread_cond_broadcast(&seq->pageCond);
+	pthread_mutex_unlock(&seq->pageLock);
+
+	release_snapshot(old);
+}
+
+void hm_seq_prefetch(HmSeq *seq, uint32_t tick)
+{
+	if (!seq->paging)
+		return;
+
+	pthread_mutex_lock(&seq->pageLock);
+
+	seq->seeking = true;
+	seq->seekTick = tick;
+	if (seq->paged) {
+		update_pages(seq);
 	}
 
+	pthread_mutex_unlock(&seq->pageLock);
+}
+
+AlError hm_seq_load_mapped(HmSeq *seq, const HmEvent *events, int numEvents, void (*release)(void *owner), void *owner)
+{
+	BEGIN()
+
+	Snapshot *snapshot = NULL;
+	TRY(start_pager(seq));
+	TRY(load_events(seq, events, numEvents, release, owner, &snapshot));
+	set_paged(seq, snapshot);
+
 	PASS()
 }
 
-AlError hm_seq_commit(HmSeq *seq)
+static void release_source(void *owner)
+{
+	release_snapshot(owner);
+}
+
+/*
+ * Builds a new snapshot over the loaded events, after the sample rate
+ * changes, that holds a reference to the snapshot they were loaded into
+ * instead of owning them.
+ */
+static AlError reload_pending(HmSeq *seq)
 {
 	BEGIN()
 
-	HmEvent *array = NULL;
-	TRY(al_malloc(&array, sizeof(HmEvent) * seq->numEvents));
+	wait_for_build(seq);
 
-	HmEvent *event = array;
-	for (EventNode *node = seq->head; node; node = node->next, event++) {
-		*event = node->event;
+	Snapshot *source = seq->pending;
+	if (source->release == release_source) {
+		source = source->owner;
 	}
 
-	ToAudioMessage message = {
-		.type = SWAP_ARRAY,
-		.data = {
-			.array = {
-				.ptr = array,
-				.length = seq->numEvents
-			}
-		}
-	};
+	bool mapped = source->numPages > 0;
+	Snapshot *snapshot = NULL;
 
-	if (!al_mq_push(seq->toAudio, &message))
-		THROW(AL_ERROR_MEMORY);
+	source->refs++;
+	TRY(load_events(seq, source->events, source->numEvents, release_source, source, (mapped) ? &snapshot : NULL));
+
+	if (mapped) {
+		set_paged(seq, snapshot);
+	}
 
 	CATCH(
-		free(array);
+		source->refs--;
 	)
 	FINALLY()
 }
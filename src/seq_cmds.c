@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "seq_cmds.h"
 #include "hamilton/band.h"
@@ -207,101 +208,520 @@ int cmd_clear_set_patch(lua_State *L)
 	FINALLY_LUA(, 0)
 }
 
-int cmd_get_seq_items(lua_State *L)
+int cmd_set_tempo(lua_State *L)
 {
 	BEGIN()
 
 	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
 	HmSeq *seq = hm_band_get_seq(band);
 
-	lua_newtable(L);
-	int n = 1;
+	int time = (int)luaL_checkinteger(L, 1);
+	float bpm = luaL_checknumber(L, 2);
 
-	HmSeqItem *items = NULL;
-	int numItems;
+	TRY(hm_seq_set_tempo(seq, time, bpm));
 
-	TRY(hm_seq_get_items(seq, &items, &numItems));
+	CATCH_LUA(, "error setting tempo")
+	FINALLY_LUA(, 0)
+}
 
-	for (int i = 0; i < numItems; i++) {
-		HmSeqItem *item = &items[i];
+int cmd_clear_tempo(lua_State *L)
+{
+	BEGIN()
 
-		lua_pushinteger(L, n++);
-		lua_newtable(L);
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
 
-		lua_pushliteral(L, "time");
-		lua_pushinteger(L, item->time);
-		lua_settable(L, -3);
+	int time = (int)luaL_checkinteger(L, 1);
 
-		lua_pushliteral(L, "channel");
-		lua_pushinteger(L, item->channel + 1);
-		lua_settable(L, -3);
+	TRY(hm_seq_clear_tempo(seq, time));
 
-		lua_pushliteral(L, "type");
+	CATCH_LUA(, "error clearing tempo")
+	FINALLY_LUA(, 0)
+}
 
-		switch (item->type) {
-			case HM_SEQ_NOTE:
-				lua_pushliteral(L, "note");
-				lua_settable(L, -3);
+int cmd_get_tempos(lua_State *L)
+{
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
 
-				lua_pushliteral(L, "note");
-				lua_pushlightuserdata(L, item->data.note.note);
-				lua_settable(L, -3);
+	int numTempos;
+	const HmTempo *tempos = hm_seq_get_tempos(seq, &numTempos);
 
-				lua_pushliteral(L, "length");
-				lua_pushinteger(L, item->data.note.data.length);
-				lua_settable(L, -3);
+	lua_createtable(L, numTempos, 0);
 
-				lua_pushliteral(L, "num");
-				lua_pushinteger(L, item->data.note.data.num);
-				lua_settable(L, -3);
+	for (int i = 0; i < numTempos; i++) {
+		lua_createtable(L, 0, 2);
 
-				lua_pushliteral(L, "velocity");
-				lua_pushnumber(L, item->data.note.data.velocity);
-				lua_settable(L, -3);
-				break;
+		lua_pushinteger(L, tempos[i].time);
+		lua_setfield(L, -2, "time");
 
-			case HM_SEQ_PITCH:
-				lua_pushliteral(L, "pitch");
-				lua_settable(L, -3);
+		lua_pushnumber(L, tempos[i].bpm);
+		lua_setfield(L, -2, "bpm");
 
-				lua_pushliteral(L, "pitch");
-				lua_pushnumber(L, item->data.pitch);
-				lua_settable(L, -3);
+		lua_rawseti(L, -2, i + 1);
+	}
 
-			case HM_SEQ_CONTROL:
-				lua_pushliteral(L, "control");
-				lua_pushinteger(L, item->data.control.num + 1);
-				lua_settable(L, -3);
+	return 1;
+}
 
-				lua_pushliteral(L, "value");
-				lua_pushnumber(L, item->data.control.value);
-				lua_settable(L, -3);
-				break;
+static lua_Number get_number(lua_State *L, int table, int index)
+{
+	lua_rawgeti(L, table, index);
+	if (lua_type(L, -1) != LUA_TNUMBER)
+		luaL_error(L, "expected number at index %d", index);
+
+	lua_Number value = lua_tonumber(L, -1);
+	lua_pop(L, 1);
+
+	return value;
+}
+
+static HmEventType get_event_type(lua_State *L, int table, int index)
+{
+	lua_rawgeti(L, table, index);
+	const char *name = lua_tostring(L, -1);
+	lua_pop(L, 1);
+
+	if (name) {
+		if (!strcmp(name, "pitch"))
+			return HM_EV_PITCH;
+		if (!strcmp(name, "control"))
+			return HM_EV_CONTROL;
+		if (!strcmp(name, "param"))
+			return HM_EV_PARAM;
+		if (!strcmp(name, "patch"))
+			return HM_EV_PATCH;
+	}
+
+	return luaL_error(L, "expected event type at index %d", index);
+}
+
+/*
+ * Bulk arguments are either an array of records or a single packed array
+ * with the record fields laid out back to back. Records are parsed into
+ * userdata so that a Lua error doesn't leak them.
+ */
+static int check_records(lua_State *L, int arg, int fields, bool *packed)
+{
+	luaL_checktype(L, arg, LUA_TTABLE);
+	int length = (int)lua_rawlen(L, arg);
+
+	lua_rawgeti(L, arg, 1);
+	*packed = lua_type(L, -1) != LUA_TTABLE;
+	lua_pop(L, 1);
+
+	if (!*packed)
+		return length;
+
+	if (length % fields)
+		return luaL_error(L, "packed array length must be a multiple of %d", fields);
+
+	return length / fields;
+}
+
+static int push_record(lua_State *L, int arg, bool packed, int fields, int i, int *base)
+{
+	if (packed) {
+		*base = i * fields;
+		return arg;
+	}
+
+	lua_rawgeti(L, arg, i + 1);
+	luaL_checktype(L, -1, LUA_TTABLE);
+	*base = 0;
+	return lua_gettop(L);
+}
+
+static HmSeqNote *check_notes(lua_State *L, int arg, int *numNotes)
+{
+	bool packed;
+	*numNotes = check_records(L, arg, 5, &packed);
+	HmSeqNote *notes = lua_newuserdata(L, sizeof(HmSeqNote) * *numNotes);
+
+	for (int i = 0; i < *numNotes; i++) {
+		int base;
+		int record = push_record(L, arg, packed, 5, i, &base);
+
+		notes[i] = (HmSeqNote){
+			.channel = (int)get_number(L, record, base + 1) - 1,
+			.time = (uint32_t)get_number(L, record, base + 2),
+			.data = {
+				.length = (uint32_t)get_number(L, record, base + 3),
+				.num = (uint32_t)get_number(L, record, base + 4),
+				.velocity = get_number(L, record, base + 5)
+			}
+		};
+
+		if (!packed) {
+			lua_pop(L, 1);
+		}
+	}
 
-			case HM_SEQ_PARAM:
-				lua_pushliteral(L, "param");
-				lua_settable(L, -3);
+	return notes;
+}
+
+/*
+ * Event records are {type, channel, time, num, value}. Pitch ignores num,
+ * patch takes the patch number as num and ignores value.
+ */
+static HmEvent *check_events(lua_State *L, int arg, int *numEvents)
+{
+	bool packed;
+	*numEvents = check_records(L, arg, 5, &packed);
+	HmEvent *events = lua_newuserdata(L, sizeof(HmEvent) * *numEvents);
 
-				lua_pushliteral(L, "param");
-				lua_pushinteger(L, item->data.param.num + 1);
-				lua_settable(L, -3);
+	for (int i = 0; i < *numEvents; i++) {
+		int base;
+		int record = push_record(L, arg, packed, 5, i, &base);
 
-				lua_pushliteral(L, "value");
-				lua_pushnumber(L, item->data.param.value);
-				lua_settable(L, -3);
+		HmEvent *event = &events[i];
+		event->type = get_event_type(L, record, base + 1);
+		event->channel = (int)get_number(L, record, base + 2) - 1;
+		event->time = (uint32_t)get_number(L, record, base + 3);
+
+		int num = (int)get_number(L, record, base + 4) - 1;
+		float value = get_number(L, record, base + 5);
+
+		switch (event->type) {
+			case HM_EV_PITCH:
+				event->data.pitch = value;
 				break;
 
-			case HM_SEQ_PATCH:
-				lua_pushliteral(L, "patch");
-				lua_settable(L, -3);
+			case HM_EV_CONTROL:
+				event->data.control.num = num;
+				event->data.control.value = value;
+				break;
+
+			case HM_EV_PARAM:
+				event->data.param.num = num;
+				event->data.param.value = value;
+				break;
 
-				lua_pushliteral(L, "patch");
-				lua_pushinteger(L, item->data.patch + 1);
-				lua_settable(L, -3);
+			case HM_EV_PATCH:
+				event->data.patch = num;
+				break;
+
+			default:
 				break;
 		}
 
-		lua_settable(L, -3);
+		if (!packed) {
+			lua_pop(L, 1);
+		}
+	}
+
+	return events;
+}
+
+int cmd_add_notes(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	int numNotes;
+	HmSeqNote *notes = check_notes(L, 1, &numNotes);
+
+	TRY(hm_seq_add_notes(seq, notes, numNotes));
+
+	CATCH_LUA(, "error adding notes")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_add_events(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	int numEvents;
+	HmEvent *events = check_events(L, 1, &numEvents);
+
+	TRY(hm_seq_add_events(seq, events, numEvents));
+
+	CATCH_LUA(, "error adding events")
+	FINALLY_LUA(, 0)
+}
+
+/*
+ * Takes notes and optionally events in the same records as add_notes and
+ * add_events, with the channels ignored, and returns the pattern.
+ */
+int cmd_add_pattern(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	int numNotes;
+	HmSeqNote *notes = check_notes(L, 1, &numNotes);
+
+	int numEvents = 0;
+	HmEvent *events = NULL;
+	if (!lua_isnoneornil(L, 2)) {
+		events = check_events(L, 2, &numEvents);
+	}
+
+	HmPattern *pattern;
+	TRY(hm_seq_add_pattern(seq, notes, numNotes, events, numEvents, &pattern));
+
+	lua_pushlightuserdata(L, pattern);
+
+	CATCH_LUA(, "error adding pattern")
+	FINALLY_LUA(, 1)
+}
+
+int cmd_remove_pattern(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	HmPattern *pattern = lua_touserdata(L, 1);
+
+	TRY(hm_seq_remove_pattern(seq, pattern));
+
+	CATCH_LUA(, "error removing pattern")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_add_instance(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	HmPattern *pattern = lua_touserdata(L, 1);
+
+	HmInstanceData data = {
+		.channel = (int)luaL_checkinteger(L, 2) - 1,
+		.time = (int)luaL_checkinteger(L, 3),
+		.transpose = (int)luaL_optinteger(L, 4, 0),
+		.velocity = luaL_optnumber(L, 5, 1)
+	};
+
+	HmInstance *instance;
+	TRY(hm_seq_add_instance(seq, pattern, &data, &instance));
+
+	lua_pushlightuserdata(L, instance);
+
+	CATCH_LUA(, "error adding instance")
+	FINALLY_LUA(, 1)
+}
+
+int cmd_remove_instance(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	HmInstance *instance = lua_touserdata(L, 1);
+
+	TRY(hm_seq_remove_instance(seq, instance));
+
+	CATCH_LUA(, "error removing instance")
+	FINALLY_LUA(, 0)
+}
+
+static const char *laneTypes[] = {"pitch", "control", "param", NULL};
+static const HmEventType laneEventTypes[] = {HM_EV_PITCH, HM_EV_CONTROL, HM_EV_PARAM};
+static const char *curveNames[] = {"step", "linear", "exponential", NULL};
+
+static HmAutoTarget check_target(lua_State *L, int arg)
+{
+	HmAutoTarget target = {
+		.channel = (int)luaL_checkinteger(L, arg) - 1,
+		.type = laneEventTypes[luaL_checkoption(L, arg + 1, NULL, laneTypes)],
+		.num = (int)luaL_optinteger(L, arg + 2, 1) - 1
+	};
+
+	return target;
+}
+
+static HmCurve get_curve(lua_State *L, int table, int index)
+{
+	lua_rawgeti(L, table, index);
+	const char *name = lua_tostring(L, -1);
+	lua_pop(L, 1);
+
+	for (int i = 0; name && curveNames[i]; i++) {
+		if (!strcmp(name, curveNames[i]))
+			return i;
+	}
+
+	return luaL_error(L, "expected curve at index %d", index);
+}
+
+/*
+ * Takes a channel, lane type, control or param number (ignored for pitch)
+ * and an array of {time, value, curve} point records.
+ */
+int cmd_set_lane(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	HmAutoTarget target = check_target(L, 1);
+
+	bool packed;
+	int numPoints = check_records(L, 4, 3, &packed);
+	HmAutoPoint *points = lua_newuserdata(L, sizeof(HmAutoPoint) * numPoints);
+
+	for (int i = 0; i < numPoints; i++) {
+		int base;
+		int record = push_record(L, 4, packed, 3, i, &base);
+
+		points[i] = (HmAutoPoint){
+			.time = (uint32_t)get_number(L, record, base + 1),
+			.value = get_number(L, record, base + 2),
+			.curve = get_curve(L, record, base + 3)
+		};
+
+		if (!packed) {
+			lua_pop(L, 1);
+		}
+	}
+
+	TRY(hm_seq_set_lane(seq, &target, points, numPoints));
+
+	CATCH_LUA(, "error setting lane")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_get_lane(lua_State *L)
+{
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	HmAutoTarget target = check_target(L, 1);
+
+	int numPoints;
+	const HmAutoPoint *points = hm_seq_get_lane(seq, &target, &numPoints);
+
+	lua_createtable(L, numPoints, 0);
+
+	for (int i = 0; i < numPoints; i++) {
+		lua_createtable(L, 0, 3);
+
+		lua_pushinteger(L, points[i].time);
+		lua_setfield(L, -2, "time");
+
+		lua_pushnumber(L, points[i].value);
+		lua_setfield(L, -2, "value");
+
+		lua_pushstring(L, curveNames[points[i].curve]);
+		lua_setfield(L, -2, "curve");
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 1;
+}
+
+static const char *itemFields[] = {
+	"note", "length", "num", "velocity", "pitch", "control", "param", "value", "patch"
+};
+
+static void set_number_field(lua_State *L, const char *key, lua_Number value)
+{
+	lua_pushnumber(L, value);
+	lua_setfield(L, -2, key);
+}
+
+static void set_integer_field(lua_State *L, const char *key, lua_Integer value)
+{
+	lua_pushinteger(L, value);
+	lua_setfield(L, -2, key);
+}
+
+/*
+ * Fills in the table on top of the stack. Fields belonging to other item
+ * types are cleared so that tables can be reused between calls.
+ */
+static void set_item_fields(lua_State *L, const HmSeqItem *item)
+{
+	for (size_t i = 0; i < sizeof(itemFields) / sizeof(itemFields[0]); i++) {
+		lua_pushnil(L);
+		lua_setfield(L, -2, itemFields[i]);
+	}
+
+	set_integer_field(L, "time", item->time);
+	set_integer_field(L, "channel", item->channel + 1);
+
+	switch (item->type) {
+		case HM_SEQ_NOTE:
+			lua_pushliteral(L, "note");
+			lua_setfield(L, -2, "type");
+
+			lua_pushlightuserdata(L, item->data.note.note);
+			lua_setfield(L, -2, "note");
+
+			set_integer_field(L, "length", item->data.note.data.length);
+			set_integer_field(L, "num", item->data.note.data.num);
+			set_number_field(L, "velocity", item->data.note.data.velocity);
+			break;
+
+		case HM_SEQ_PITCH:
+			lua_pushliteral(L, "pitch");
+			lua_setfield(L, -2, "type");
+
+			set_number_field(L, "pitch", item->data.pitch);
+			break;
+
+		case HM_SEQ_CONTROL:
+			lua_pushliteral(L, "control");
+			lua_setfield(L, -2, "type");
+
+			set_integer_field(L, "control", item->data.control.num + 1);
+			set_number_field(L, "value", item->data.control.value);
+			break;
+
+		case HM_SEQ_PARAM:
+			lua_pushliteral(L, "param");
+			lua_setfield(L, -2, "type");
+
+			set_integer_field(L, "param", item->data.param.num + 1);
+			set_number_field(L, "value", item->data.param.value);
+			break;
+
+		case HM_SEQ_PATCH:
+			lua_pushliteral(L, "patch");
+			lua_setfield(L, -2, "type");
+
+			set_integer_field(L, "patch", item->data.patch + 1);
+			break;
+	}
+}
+
+int cmd_get_seq_items(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	lua_newtable(L);
+
+	HmSeqItem *items = NULL;
+	int numItems;
+
+	TRY(hm_seq_get_items(seq, &items, &numItems));
+
+	for (int i = 0; i < numItems; i++) {
+		lua_newtable(L);
+		set_item_fields(L, &items[i]);
+		lua_rawseti(L, -2, i + 1);
 	}
 
 	CATCH_LUA(, "error getting seq items");
@@ -310,6 +730,148 @@ int cmd_get_seq_items(lua_State *L)
 		1)
 }
 
+static unsigned check_item_types(lua_State *L, int index)
+{
+	static const char *names[] = { "note", "pitch", "control", "param", "patch" };
+	static const unsigned types[] = {
+		1 << HM_SEQ_NOTE, 1 << HM_SEQ_PITCH, 1 << HM_SEQ_CONTROL, 1 << HM_SEQ_PARAM, 1 << HM_SEQ_PATCH
+	};
+
+	if (lua_isnoneornil(L, index))
+		return 0;
+
+	int numNames = 1;
+	if (lua_type(L, index) == LUA_TTABLE) {
+		numNames = (int)lua_rawlen(L, index);
+	}
+
+	unsigned mask = 0;
+	for (int i = 0; i < numNames; i++) {
+		if (lua_type(L, index) == LUA_TTABLE) {
+			lua_rawgeti(L, index, i + 1);
+		} else {
+			lua_pushvalue(L, index);
+		}
+
+		const char *name = lua_tostring(L, -1);
+		int type = 0;
+		while (type < 5 && (!name || strcmp(name, names[type]))) {
+			type++;
+		}
+
+		if (type == 5)
+			return luaL_argerror(L, index, "unknown item type");
+
+		mask |= types[type];
+		lua_pop(L, 1);
+	}
+
+	return mask;
+}
+
+/*
+ * get_seq_range(start, end, [channel], [types], [result]) returns the items
+ * in [start, end), optionally filtered by channel and by a type name or list
+ * of type names. If a result table is given its item tables are reused and
+ * any extra entries are cleared. Returns the table and the number of items.
+ */
+int cmd_get_seq_range(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	uint32_t start = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t end = (uint32_t)luaL_checkinteger(L, 2);
+	int channel = (int)luaL_optinteger(L, 3, 0) - 1;
+	unsigned types = check_item_types(L, 4);
+
+	if (lua_isnoneornil(L, 5)) {
+		lua_newtable(L);
+	} else {
+		luaL_checktype(L, 5, LUA_TTABLE);
+		lua_pushvalue(L, 5);
+	}
+
+	int oldLength = (int)lua_rawlen(L, -1);
+	int n = 0;
+
+	HmSeqRange range;
+	HmSeqItem item;
+	TRY(hm_seq_range_init(seq, &range, start, end, channel, types));
+
+	while (hm_seq_range_next(&range, &item)) {
+		n++;
+
+		lua_rawgeti(L, -1, n);
+		if (lua_type(L, -1) != LUA_TTABLE) {
+			lua_pop(L, 1);
+			lua_newtable(L);
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, -3, n);
+		}
+
+		set_item_fields(L, &item);
+		lua_pop(L, 1);
+	}
+
+	for (int i = oldLength; i > n; i--) {
+		lua_pushnil(L);
+		lua_rawseti(L, -2, i);
+	}
+
+	lua_pushinteger(L, n);
+
+	CATCH_LUA(, "error getting seq range")
+	FINALLY_LUA(, 2)
+}
+
+int cmd_save_seq_version(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	HmSeqVersion *version;
+	TRY(hm_seq_save_version(seq, &version));
+
+	lua_pushlightuserdata(L, version);
+
+	CATCH_LUA(, "error saving seq version")
+	FINALLY_LUA(, 1)
+}
+
+int cmd_restore_seq_version(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	HmSeqVersion *version = lua_touserdata(L, 1);
+
+	TRY(hm_seq_restore_version(seq, version));
+
+	CATCH_LUA(, "error restoring seq version")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_free_seq_version(lua_State *L)
+{
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	HmSeqVersion *version = lua_touserdata(L, 1);
+
+	hm_seq_free_version(seq, version);
+
+	return 0;
+}
+
 int cmd_seq_commit(lua_State *L)
 {
 	BEGIN()
@@ -322,3 +884,22 @@ int cmd_seq_commit(lua_State *L)
 	CATCH_LUA(, "error commiting seq changes")
 	FINALLY_LUA(, 0)
 }
+
+int cmd_count_seq_events(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	HmSeq *seq = hm_band_get_seq(band);
+
+	uint32_t start = (uint32_t)luaL_checkinteger(L, 1);
+	uint32_t end = (uint32_t)luaL_checkinteger(L, 2);
+	int batch = (int)luaL_checkinteger(L, 3);
+	int count;
+
+	TRY(hm_seq_count_events(seq, start, end, batch, &count));
+	lua_pushinteger(L, count);
+
+	CATCH_LUA(, "error counting seq events")
+	FINALLY_LUA(, 1)
+}
@@ -20,8 +20,24 @@ int cmd_add_set_param(lua_State *L);
 int cmd_clear_set_param(lua_State *L);
 int cmd_add_set_patch(lua_State *L);
 int cmd_clear_set_patch(lua_State *L);
+int cmd_set_tempo(lua_State *L);
+int cmd_clear_tempo(lua_State *L);
+int cmd_get_tempos(lua_State *L);
+int cmd_set_lane(lua_State *L);
+int cmd_get_lane(lua_State *L);
+int cmd_add_notes(lua_State *L);
+int cmd_add_events(lua_State *L);
+int cmd_add_pattern(lua_State *L);
+int cmd_remove_pattern(lua_State *L);
+int cmd_add_instance(lua_State *L);
+int cmd_remove_instance(lua_State *L);
 
 int cmd_get_seq_items(lua_State *L);
+int cmd_get_seq_range(lua_State *L);
+int cmd_save_seq_version(lua_State *L);
+int cmd_restore_seq_version(lua_State *L);
+int cmd_free_seq_version(lua_State *L);
 int cmd_seq_commit(lua_State *L);
+int cmd_count_seq_events(lua_State *L);
 
 #endif
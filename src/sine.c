@@ -5,15 +5,41 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "hamilton/synth.h"
+#include "hamilton/voices.h"
+#include "hamilton/filters.h"
+#include "hamilton/fastmath.h"
 #include "hamilton/band.h"
 #include "hamilton/lib.h"
 #include "hamilton/core_synths.h"
 
 static const char *name = "Sine Wave";
 static const char *params[] = { };
+static const int DEFAULT_VOICES = 8;
+
+#define TABLE_BITS 11
+#define TABLE_SIZE (1 << TABLE_BITS)
+#define MAX_HARMONICS (TABLE_SIZE / 4)
+#define NUM_LEVELS (TABLE_BITS - 1)
+#define OSC_BLOCK 64
+
+enum Wave {
+	WAVE_SINE, WAVE_TRI, WAVE_SAW, WAVE_SQUARE, NUM_WAVES
+};
+
+/*
+ * Band-limited wavetables, shared by every instance. Each level holds half
+ * the harmonics of the one before, from MAX_HARMONICS down to one, and an
+ * oscillator plays the fullest level with nothing above Nyquist. Levels
+ * depend only on the phase step, so the tables suit any sample rate. Each
+ * table has a guard sample at the end so lookups needn't wrap.
+ */
+static float tables[NUM_WAVES][NUM_LEVELS][TABLE_SIZE + 1];
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
 
 enum EnvState {
 	OFF, ATTACK, DECAY, SUSTAIN, RELEASE
@@ -30,12 +56,11 @@ struct Osc {
 	float t, step;
 };
 
-struct LP2 {
+struct Voice {
+	struct Osc osc;
+	struct Env env;
+	struct Env fenv;
 	float cutoff;
-	float a[3];
-	float b[3];
-	float in[3];
-	float out[3];
 };
 
 typedef struct SineSynth {
@@ -43,15 +68,48 @@ typedef struct SineSynth {
 
 	float sampleRate;
 
-	int note;
-
-	struct Osc osc;
-	struct Env env;
-	struct Env fenv;
-	struct LP2 filter;
+	HmVoices alloc;
+	struct Voice voices[HM_MAX_VOICES];
+	HmFilterBank filters;
 } SineSynth;
 
-typedef float (*OscFunc)(float t);
+/* Sums the harmonics of each wave, reading sines at multiples of the index */
+static void build_tables(void)
+{
+	static double sine[TABLE_SIZE];
+
+	for (int i = 0; i < TABLE_SIZE; i++) {
+		sine[i] = sin(2 * M_PI * i / TABLE_SIZE);
+	}
+
+	for (int level = 0; level < NUM_LEVELS; level++) {
+		int harmonics = MAX_HARMONICS >> level;
+
+		for (int i = 0; i < TABLE_SIZE; i++) {
+			double tri = 0, saw = 0, square = 0;
+
+			for (int h = 1; h <= harmonics; h++) {
+				double s = sine[(h * i) & (TABLE_SIZE - 1)];
+				double c = sine[(h * i + TABLE_SIZE / 4) & (TABLE_SIZE - 1)];
+
+				saw -= s / h;
+				if (h & 1) {
+					tri -= c / ((double)h * h);
+					square += s / h;
+				}
+			}
+
+			tables[WAVE_SINE][level][i] = sine[i];
+			tables[WAVE_TRI][level][i] = 8 / (M_PI * M_PI) * tri;
+			tables[WAVE_SAW][level][i] = 2 / M_PI * saw;
+			tables[WAVE_SQUARE][level][i] = 4 / M_PI * square;
+		}
+
+		for (int wave = 0; wave < NUM_WAVES; wave++) {
+			tables[wave][level][TABLE_SIZE] = tables[wave][level][0];
+		}
+	}
+}
 
 static void osc_init(struct Osc *osc)
 {
@@ -64,34 +122,29 @@ static void osc_set_freq(struct Osc *osc, float freq, float sampleRate)
 	osc->step = freq / sampleRate;
 }
 
-static float osc_step(struct Osc *osc, OscFunc func)
+/* Renders a block from the fullest table that stays under Nyquist */
+static void osc_render(struct Osc *osc, enum Wave wave, float *output, int length)
 {
-	osc->t += osc->step;
-	while (osc->t > 1) osc->t -= 1;
+	int level = 0;
+	while (level < NUM_LEVELS - 1 && (MAX_HARMONICS >> level) * osc->step >= 0.5f) {
+		level++;
+	}
 
-	return func(osc->t);
-}
+	const float *table = tables[wave][level];
+	float t = osc->t;
 
-static float osc_sine(float t)
-{
-	return sinf(2 * M_PI * t);
-}
+	for (int i = 0; i < length; i++) {
+		t += osc->step;
+		while (t >= 1) t -= 1;
 
-static float osc_tri(float t)
-{
-	return (t < 0.5) ?
-		 4 * t - 1 :
-		-4 * t + 3;
-}
+		float pos = t * TABLE_SIZE;
+		int index = (int)pos;
+		float frac = pos - index;
 
-static float osc_saw(float t)
-{
-	return 2 * t - 1;
-}
+		output[i] = table[index] + frac * (table[index + 1] - table[index]);
+	}
 
-static float osc_square(float t)
-{
-	return (t < 0.5) ? 1 : -1;
+	osc->t = t;
 }
 
 static void env_init(struct Env *env)
@@ -117,95 +170,72 @@ static void env_stop(struct Env *env)
 	env->releaseGain = env->gain;
 }
 
-static float env_step(struct Env *env)
+/*
+ * Fills a block with the envelope. Each segment is a ramp that ends exactly
+ * on its target at the sample where the state changes, so the work is in
+ * finding how far the current segment runs rather than per sample.
+ */
+static void env_render(struct Env *env, float *output, int length)
 {
-	uint32_t t = env->t++;
-
-	switch (env->state) {
-		case OFF:
-			env->gain = 0.0;
-			break;
-
-		case ATTACK:
-			if (t == env->a) {
-				env->state = DECAY;
-				env->t = 0;
-				env->gain = 1.0;
-			} else {
-				env->gain = t / env->a;
-			}
-			break;
-
-		case DECAY:
-			if (t == env->d) {
-				env->state = SUSTAIN;
-				env->t = 0;
-				env->gain = env->s;
-			} else {
-				env->gain = (1.0 - (t / env->d)) * (1.0 - env->s) + env->s;
-			}
-			break;
-
-		case SUSTAIN:
-			env->gain = env->s;
-			break;
-
-		case RELEASE:
-			if (t == env->r) {
-				env->state = OFF;
-				env->gain = 0.0;
-			} else {
-				env->gain = (1.0 - (t / env->r)) * env->releaseGain;
-			}
+	int i = 0;
+
+	while (i < length) {
+		float from, to, segment;
+		enum EnvState next;
+
+		switch (env->state) {
+			case OFF:
+			case SUSTAIN:
+				env->gain = (env->state == OFF) ? 0.0 : env->s;
+				for (; i < length; i++) {
+					output[i] = env->gain;
+				}
+				return;
+
+			case ATTACK:
+				from = 0.0;
+				to = 1.0;
+				segment = env->a;
+				next = DECAY;
+				break;
+
+			case DECAY:
+				from = 1.0;
+				to = env->s;
+				segment = env->d;
+				next = SUSTAIN;
+				break;
+
+			case RELEASE:
+			default:
+				from = env->releaseGain;
+				to = 0.0;
+				segment = env->r;
+				next = OFF;
+				break;
+		}
+
+		/* Up to and including the sample that lands on the target */
+		uint32_t remaining = (uint32_t)segment - env->t + 1;
+		int n = (remaining < (uint32_t)(length - i)) ? (int)remaining : length - i;
+		float step = (segment > 0) ? (to - from) / segment : 0.0;
+		float t = env->t;
+
+		for (int j = 0; j < n; j++) {
+			output[i + j] = from + step * (t + j);
+		}
+
+		i += n;
+		env->t += n;
+
+		if (env->t > segment) {
+			output[i - 1] = to;
+			env->state = next;
+			env->t = 0;
+		}
+
+		env->gain = output[i - 1];
 	}
-
-	return env->gain;
-}
-
-static void lp2_recalc(struct LP2 *lp, float sampleRate)
-{
-	float alpha = tanf(2 * M_PI * lp->cutoff / sampleRate);
-	float alphaSq = alpha * alpha;
-	float c = 1 / (1 + 2 * M_SQRT1_2 * alpha + alphaSq);
-
-	lp->a[0] = alphaSq * c;
-	lp->a[1] = 2 * lp->a[0];
-	lp->a[2] = lp->a[0];
-
-	lp->b[1] = 2 * (alphaSq - 1) * c;
-//	lp->b[2] = (1 - 2 * M_SQRT1_2 * alpha + alphaSq) / c;
-	lp->b[2] = lp->a[0] + lp->a[1] + lp->a[2] - lp->b[1] - 1;
-}
-
-static void lp2_init(struct LP2 *lp)
-{
-//	lp->cutoff = 16715;
-	lp->cutoff = 1000;
-	lp->in[0] = 0;
-	lp->in[1] = 0;
-	lp->in[2] = 0;
-	lp->out[0] = 0;
-	lp->out[1] = 0;
-	lp->out[2] = 0;
-
-	lp2_recalc(lp, 1);
-}
-
-static float lp2_step(struct LP2 *lp, float input)
-{
-	lp->in[2] = lp->in[1];
-	lp->in[1] = lp->in[0];
-	lp->in[0] = input;
-	lp->out[2] = lp->out[1];
-	lp->out[1] = lp->out[0];
-
-	lp->out[0] = lp->a[0] * lp->in[0] +
-				 lp->a[1] * lp->in[1] +
-				 lp->a[2] * lp->in[2] -
-				 lp->b[1] * lp->out[0] -
-				 lp->b[2] * lp->out[1];
-
-	return lp->out[0];
 }
 
 static float mix(float a, float b, float factor)
@@ -219,7 +249,9 @@ static void set_sample_rate(HmSynth *base, int sampleRate)
 
 	synth->sampleRate = sampleRate;
 
-	lp2_recalc(&synth->filter, sampleRate);
+	for (int i = 0; i < HM_MAX_VOICES; i++) {
+		hm_filters_set_cutoff(&synth->filters, i, synth->voices[i].cutoff, sampleRate);
+	}
 }
 
 static const char **get_params(HmSynth *base, int *numParams)
@@ -236,49 +268,120 @@ static float get_param(HmSynth *base, int param)
 static void set_control(HmSynth *base, int control, float value)
 { }
 
+static int get_polyphony(HmSynth *base)
+{
+	SineSynth *synth = (SineSynth *)base;
+
+	return synth->alloc.numVoices;
+}
+
+static void set_polyphony(HmSynth *base, int numVoices)
+{
+	SineSynth *synth = (SineSynth *)base;
+
+	hm_voices_set_polyphony(&synth->alloc, numVoices);
+}
+
+static void move_voice(void *synth, int from, int to)
+{
+	SineSynth *this = synth;
+
+	this->voices[to] = this->voices[from];
+	hm_filters_move(&this->filters, from, to);
+}
+
+static void release_voice(void *synth, int i)
+{
+	struct Voice *voice = &((SineSynth *)synth)->voices[i];
+
+	env_stop(&voice->env);
+	env_stop(&voice->fenv);
+}
+
 static float midi_to_freq(int note)
 {
-	return (note <= 0) ? 0 : 440.0 * powf(2.0, (note - 69.0) / 12.0);
+	return (note <= 0) ? 0 : hm_note_to_freq(note);
 }
 
 static void start_note(HmSynth *base, int num, float velocity)
 {
 	SineSynth *synth = (SineSynth *)base;
 
-	synth->note = num;
+	int i = hm_voices_start(&synth->alloc, num);
+	if (i < 0)
+		return;
+
+	struct Voice *voice = &synth->voices[i];
 
 	float freq = midi_to_freq(num);
-	osc_set_freq(&synth->osc, freq, synth->sampleRate);
-	env_start(&synth->env);
-	env_start(&synth->fenv);
-	synth->filter.cutoff = freq * 2;
-	lp2_recalc(&synth->filter, synth->sampleRate);
+	osc_set_freq(&voice->osc, freq, synth->sampleRate);
+	env_start(&voice->env);
+	env_start(&voice->fenv);
+	voice->cutoff = freq * 2;
+	hm_filters_reset(&synth->filters, i);
+	hm_filters_set_cutoff(&synth->filters, i, voice->cutoff, synth->sampleRate);
 }
 
 static void stop_note(HmSynth *base, int num)
 {
 	SineSynth *synth = (SineSynth *)base;
 
-	if (num == synth->note) {
-		synth->note = 0;
-
-		env_stop(&synth->env);
-		env_stop(&synth->fenv);
-	}
+	hm_voices_stop(&synth->alloc, num);
 }
 
+/*
+ * Renders voices a lane group at a time, interleaved by voice so the group's
+ * filters run together
+ */
 static void generate(HmSynth *base, float *buffer, int length)
 {
 	SineSynth *synth = (SineSynth *)base;
+	int numActive = synth->alloc.numActive;
 
-	for (int i = 0; i < length; i++) {
-		float x;
+	for (int first = 0; first < numActive; first += HM_FILTER_LANES) {
+		int lanes = (numActive - first < HM_FILTER_LANES) ? numActive - first : HM_FILTER_LANES;
+
+		for (int start = 0; start < length; start += OSC_BLOCK) {
+			float dry[OSC_BLOCK * HM_FILTER_LANES];
+			float wet[OSC_BLOCK * HM_FILTER_LANES];
+			float fenv[OSC_BLOCK * HM_FILTER_LANES];
+			int n = (length - start < OSC_BLOCK) ? length - start : OSC_BLOCK;
+
+			/* Keep the spare lanes' filters fed with silence */
+			if (lanes < HM_FILTER_LANES) {
+				memset(dry, 0, sizeof(dry));
+			}
 
-		x = osc_step(&synth->osc, osc_saw);
-		x *= env_step(&synth->env);
-		x = mix(x, lp2_step(&synth->filter, x), 1 - env_step(&synth->fenv));
+			for (int l = 0; l < lanes; l++) {
+				struct Voice *voice = &synth->voices[first + l];
+				float osc[OSC_BLOCK], env[OSC_BLOCK], filterEnv[OSC_BLOCK];
 
-        buffer[i] = 0.4 * x;
+				osc_render(&voice->osc, WAVE_SAW, osc, n);
+				env_render(&voice->env, env, n);
+				env_render(&voice->fenv, filterEnv, n);
+
+				for (int i = 0; i < n; i++) {
+					dry[i * HM_FILTER_LANES + l] = osc[i] * env[i];
+					fenv[i * HM_FILTER_LANES + l] = filterEnv[i];
+				}
+			}
+
+			hm_filters_process(&synth->filters, first, dry, wet, n);
+
+			for (int i = 0; i < n; i++) {
+				for (int l = 0; l < lanes; l++) {
+					int j = i * HM_FILTER_LANES + l;
+					buffer[start + i] += 0.4 * mix(dry[j], wet[j], 1 - fenv[j]);
+				}
+			}
+		}
+	}
+
+	/* Backwards, as freeing a voice moves the last one into its place */
+	for (int v = numActive - 1; v >= 0; v--) {
+		if (synth->voices[v].env.state == OFF) {
+			hm_voices_free(&synth->alloc, v);
+		}
 	}
 }
 
@@ -289,6 +392,8 @@ static void free_synth(HmSynth *synth)
 
 static HmSynth *init(const HmSynthType *type)
 {
+	pthread_once(&tablesOnce, build_tables);
+
 	SineSynth *synth = malloc(sizeof(SineSynth));
 	if (!synth)
 		return NULL;
@@ -300,27 +405,37 @@ static HmSynth *init(const HmSynthType *type)
 		.getParams = get_params,
 		.getParam = get_param,
 		.setControl = set_control,
+		.getPolyphony = get_polyphony,
+		.setPolyphony = set_polyphony,
 		.startNote = start_note,
 		.stopNote = stop_note,
 		.generate = generate
 	};
 
-	synth->note = 0;
+	synth->sampleRate = 1;
+
+	for (int i = 0; i < HM_MAX_VOICES; i++) {
+		struct Voice *voice = &synth->voices[i];
 
-	osc_init(&synth->osc);
-	env_init(&synth->env);
-	env_init(&synth->fenv);
-	lp2_init(&synth->filter);
+		osc_init(&voice->osc);
+		env_init(&voice->env);
+		env_init(&voice->fenv);
+		voice->cutoff = 1000;
+		hm_filters_reset(&synth->filters, i);
+		hm_filters_set_cutoff(&synth->filters, i, voice->cutoff, synth->sampleRate);
 
-	synth->env.a = 48 * 10;
-	synth->env.d = 48 * 5000;
-	synth->env.s = 0.0;
-	synth->env.r = 48 * 100;
+		voice->env.a = 48 * 10;
+		voice->env.d = 48 * 5000;
+		voice->env.s = 0.0;
+		voice->env.r = 48 * 100;
+
+		voice->fenv.a = 48 * 100;
+		voice->fenv.d = 48 * 0;
+		voice->fenv.s = 0.0;
+		voice->fenv.r = 48 * 100;
+	}
 
-	synth->fenv.a = 48 * 100;
-	synth->fenv.d = 48 * 0;
-	synth->fenv.s = 0.0;
-	synth->fenv.r = 48 * 100;
+	hm_voices_init(&synth->alloc, DEFAULT_VOICES, move_voice, release_voice, synth);
 
 	return &synth->base;
 }
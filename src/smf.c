@@ -0,0 +1,706 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hamilton/smf.h"
+
+#define NUM_MIDI_CHANNELS 16
+#define NUM_KEYS 128
+#define HEADER_SIZE 14
+#define CHUNK_HEADER_SIZE 8
+#define MAX_EVENT_SIZE 8
+#define TEMPO_EVENT_SIZE 10
+
+typedef struct {
+	const uint8_t *pos, *end;
+	uint32_t tick;
+	uint8_t status;
+} Track;
+
+typedef struct {
+	uint32_t tick;
+	uint8_t status;
+	uint8_t data[2];
+	int meta;
+	const uint8_t *metaData;
+	uint32_t metaLength;
+} MidiEvent;
+
+typedef struct {
+	double scale;
+	HmTempo *tempos;
+	int numTempos, temposLength;
+
+	HmSeqNote *notes;
+	int *links;
+	int numNotes, notesLength, linksLength;
+
+	HmEvent *events;
+	int numEvents, eventsLength;
+
+	int heads[NUM_MIDI_CHANNELS][NUM_KEYS];
+	int tails[NUM_MIDI_CHANNELS][NUM_KEYS];
+	const int *numPatches;
+} Import;
+
+static uint16_t read_u16(const uint8_t *data)
+{
+	return (uint16_t)data[0] << 8 | data[1];
+}
+
+static uint32_t read_u32(const uint8_t *data)
+{
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static AlError grow(void *array, int *length, int needed, size_t size)
+{
+	if (needed <= *length)
+		return AL_NO_ERROR;
+
+	int newLength = (*length > 0) ? *length : 256;
+	while (newLength < needed) {
+		newLength *= 2;
+	}
+
+	void *newArray = realloc(*(void **)array, size * newLength);
+	if (!newArray)
+		return AL_ERROR_MEMORY;
+
+	*(void **)array = newArray;
+	*length = newLength;
+
+	return AL_NO_ERROR;
+}
+
+static bool read_varlen(Track *track, uint32_t *result)
+{
+	uint32_t value = 0;
+
+	for (int i = 0; i < 4 && track->pos < track->end; i++) {
+		uint8_t byte = *track->pos++;
+		value = value << 7 | (byte & 0x7F);
+
+		if (!(byte & 0x80)) {
+			*result = value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Decodes the next event in a track, following running status. Meta events
+ * set meta to their type; for everything else it is -1.
+ */
+static AlError next_event(Track *track, MidiEvent *event)
+{
+	uint32_t delta, length;
+
+	if (!read_varlen(track, &delta) || track->pos >= track->end)
+		return AL_ERROR_INVALID_DATA;
+
+	track->tick += delta;
+
+	uint8_t status = *track->pos;
+	if (status & 0x80) {
+		track->pos++;
+	} else {
+		status = track->status;
+		if (!(status & 0x80))
+			return AL_ERROR_INVALID_DATA;
+	}
+
+	*event = (MidiEvent){
+		.tick = track->tick,
+		.status = status,
+		.meta = -1
+	};
+
+	if (status == 0xFF) {
+		if (track->pos >= track->end)
+			return AL_ERROR_INVALID_DATA;
+
+		event->meta = *track->pos++;
+
+		if (!read_varlen(track, &length) || length > track->end - track->pos)
+			return AL_ERROR_INVALID_DATA;
+
+		event->metaData = track->pos;
+		event->metaLength = length;
+		track->pos += length;
+
+	} else if (status == 0xF0 || status == 0xF7) {
+		if (!read_varlen(track, &length) || length > track->end - track->pos)
+			return AL_ERROR_INVALID_DATA;
+
+		track->pos += length;
+
+	} else if (status > 0xF0) {
+		return AL_ERROR_INVALID_DATA;
+
+	} else {
+		int size = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+		if (track->end - track->pos < size)
+			return AL_ERROR_INVALID_DATA;
+
+		event->data[0] = track->pos[0] & 0x7F;
+		event->data[1] = (size == 2) ? track->pos[1] & 0x7F : 0;
+		track->pos += size;
+		track->status = status;
+	}
+
+	return AL_NO_ERROR;
+}
+
+static AlError find_tracks(const uint8_t *data, size_t size, Track **result, int *numTracks, uint16_t *division)
+{
+	BEGIN()
+
+	Track *tracks = NULL;
+
+	if (size < HEADER_SIZE || memcmp(data, "MThd", 4) != 0)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	uint32_t headerLength = read_u32(data + 4);
+	uint16_t format = read_u16(data + 8);
+	uint16_t maxTracks = read_u16(data + 10);
+	*division = read_u16(data + 12);
+
+	if (headerLength < 6 || headerLength > size - CHUNK_HEADER_SIZE || format > 1)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	TRY(al_malloc(&tracks, sizeof(Track) * (maxTracks + 1)));
+	*numTracks = 0;
+
+	const uint8_t *pos = data + CHUNK_HEADER_SIZE + headerLength;
+	const uint8_t *end = data + size;
+
+	while (end - pos >= CHUNK_HEADER_SIZE && *numTracks < maxTracks) {
+		uint32_t length = read_u32(pos + 4);
+		if (length > end - pos - CHUNK_HEADER_SIZE)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		if (memcmp(pos, "MTrk", 4) == 0) {
+			tracks[(*numTracks)++] = (Track){
+				.pos = pos + CHUNK_HEADER_SIZE,
+				.end = pos + CHUNK_HEADER_SIZE + length
+			};
+		}
+
+		pos += CHUNK_HEADER_SIZE + length;
+	}
+
+	*result = tracks;
+
+	CATCH(
+		free(tracks);
+	)
+	FINALLY()
+}
+
+static uint32_t to_ticks(const Import *import, uint32_t tick)
+{
+	double ticks = tick * import->scale + 0.5;
+
+	return (ticks < UINT32_MAX) ? (uint32_t)ticks : UINT32_MAX;
+}
+
+static AlError add_tempo(Import *import, uint32_t time, uint32_t tempo)
+{
+	BEGIN()
+
+	float bpm = (tempo > 0) ? 60000000.0f / tempo : HM_SEQ_MAX_BPM;
+	bpm = (bpm < HM_SEQ_MIN_BPM) ? HM_SEQ_MIN_BPM : (bpm > HM_SEQ_MAX_BPM) ? HM_SEQ_MAX_BPM : bpm;
+
+	TRY(grow(&import->tempos, &import->temposLength, import->numTempos + 1, sizeof(HmTempo)));
+
+	import->tempos[import->numTempos++] = (HmTempo){
+		.time = time,
+		.bpm = bpm
+	};
+
+	PASS()
+}
+
+/*
+ * Works out how file ticks map to sequencer ticks and collects the tempo
+ * changes from every track. SMPTE divisions are converted through real time
+ * at the default tempo and have no tempo map.
+ */
+static AlError read_tempo_map(Import *import, const Track *tracks, int numTracks, uint16_t division)
+{
+	BEGIN()
+
+	if (division & 0x8000) {
+		int frames = -(int8_t)(division >> 8);
+		int ticksPerFrame = division & 0xFF;
+		if (frames <= 0 || ticksPerFrame == 0)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		double fps = (frames == 29) ? 29.97 : frames;
+		import->scale = HM_SEQ_PPQ * HM_SEQ_DEFAULT_BPM / 60.0 / (fps * ticksPerFrame);
+
+	} else {
+		if (division == 0)
+			THROW(AL_ERROR_INVALID_DATA);
+
+		import->scale = (double)HM_SEQ_PPQ / division;
+
+		for (int i = 0; i < numTracks; i++) {
+			Track track = tracks[i];
+
+			while (track.pos < track.end) {
+				MidiEvent event;
+				TRY(next_event(&track, &event));
+
+				if (event.meta == 0x2F)
+					break;
+
+				if (event.meta == 0x51 && event.metaLength == 3) {
+					const uint8_t *data = event.metaData;
+					uint32_t tempo = (uint32_t)data[0] << 16 | (uint32_t)data[1] << 8 | data[2];
+
+					TRY(add_tempo(import, to_ticks(import, event.tick), tempo));
+				}
+			}
+		}
+	}
+
+	/* Tempo tracks are normally already in order */
+	for (int i = 1; i < import->numTempos; i++) {
+		HmTempo tempo = import->tempos[i];
+		int j = i;
+
+		while (j > 0 && import->tempos[j - 1].time > tempo.time) {
+			import->tempos[j] = import->tempos[j - 1];
+			j--;
+		}
+
+		import->tempos[j] = tempo;
+	}
+
+	/* Later changes at the same time win */
+	int kept = 0;
+	for (int i = 0; i < import->numTempos; i++) {
+		if (kept > 0 && import->tempos[kept - 1].time == import->tempos[i].time) {
+			kept--;
+		}
+
+		import->tempos[kept++] = import->tempos[i];
+	}
+	import->numTempos = kept;
+
+	PASS()
+}
+
+static AlError open_note(Import *import, int channel, int key, uint32_t time, int velocity)
+{
+	BEGIN()
+
+	int index = import->numNotes;
+	TRY(grow(&import->notes, &import->notesLength, index + 1, sizeof(HmSeqNote)));
+	TRY(grow(&import->links, &import->linksLength, index + 1, sizeof(int)));
+
+	import->notes[index] = (HmSeqNote){
+		.channel = channel,
+		.time = time,
+		.data = {
+			.num = key,
+			.velocity = velocity / 127.0f
+		}
+	};
+	import->links[index] = -1;
+	import->numNotes++;
+
+	if (import->heads[channel][key] < 0) {
+		import->heads[channel][key] = index;
+	} else {
+		import->links[import->tails[channel][key]] = index;
+	}
+	import->tails[channel][key] = index;
+
+	PASS()
+}
+
+/*
+ * Ends the earliest open note on the key. Notes shorter than a tick are
+ * kept one tick long so they still sound.
+ */
+static void close_note(Import *import, int channel, int key, uint32_t time)
+{
+	int index = import->heads[channel][key];
+	if (index < 0)
+		return;
+
+	import->heads[channel][key] = import->links[index];
+
+	HmSeqNote *note = &import->notes[index];
+	note->data.length = (time > note->time) ? time - note->time : 1;
+}
+
+static AlError add_event(Import *import, const HmEvent *event)
+{
+	BEGIN()
+
+	TRY(grow(&import->events, &import->eventsLength, import->numEvents + 1, sizeof(HmEvent)));
+	import->events[import->numEvents++] = *event;
+
+	PASS()
+}
+
+static AlError read_track(Import *import, Track track)
+{
+	BEGIN()
+
+	for (int i = 0; i < NUM_MIDI_CHANNELS; i++) {
+		for (int j = 0; j < NUM_KEYS; j++) {
+			import->heads[i][j] = -1;
+		}
+	}
+
+	while (track.pos < track.end) {
+		MidiEvent event;
+		TRY(next_event(&track, &event));
+
+		if (event.meta == 0x2F)
+			break;
+
+		if (event.status >= 0xF0)
+			continue;
+
+		uint32_t time = to_ticks(import, event.tick);
+		int channel = event.status & 0x0F;
+
+		switch (event.status & 0xF0) {
+			case 0x90:
+				if (event.data[1] > 0) {
+					TRY(open_note(import, channel, event.data[0], time, event.data[1]));
+					break;
+				}
+				/* A note on with no velocity is a note off */
+
+			case 0x80:
+				close_note(import, channel, event.data[0], time);
+				break;
+
+			case 0xB0:
+				TRY(add_event(import, &(HmEvent){
+					.time = time,
+					.channel = channel,
+					.type = HM_EV_CONTROL,
+					.data = {
+						.control = {
+							.num = event.data[0],
+							.value = event.data[1] / 127.0f
+						}
+					}
+				}));
+				break;
+
+			case 0xC0:
+				if (import->numPatches && event.data[0] >= import->numPatches[channel])
+					break;
+
+				TRY(add_event(import, &(HmEvent){
+					.time = time,
+					.channel = channel,
+					.type = HM_EV_PATCH,
+					.data = {
+						.patch = event.data[0]
+					}
+				}));
+				break;
+
+			case 0xE0:
+				TRY(add_event(import, &(HmEvent){
+					.time = time,
+					.channel = channel,
+					.type = HM_EV_PITCH,
+					.data = {
+						.pitch = ((event.data[1] << 7 | event.data[0]) - 8192) / 8192.0f
+					}
+				}));
+				break;
+		}
+	}
+
+	/* Notes still held are ended with the track */
+	uint32_t end = to_ticks(import, track.tick);
+	for (int i = 0; i < NUM_MIDI_CHANNELS; i++) {
+		for (int j = 0; j < NUM_KEYS; j++) {
+			while (import->heads[i][j] >= 0) {
+				close_note(import, i, j, end);
+			}
+		}
+	}
+
+	PASS()
+}
+
+AlError hm_smf_import(HmSeq *seq, const char *path, const int *numPatches)
+{
+	BEGIN()
+
+	int fd = -1;
+	void *data = MAP_FAILED;
+	size_t size = 0;
+	Track *tracks = NULL;
+	Import *import = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		THROW(AL_ERROR_IO);
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+		THROW(AL_ERROR_IO);
+
+	size = info.st_size;
+	if (size < HEADER_SIZE)
+		THROW(AL_ERROR_INVALID_DATA);
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		THROW(AL_ERROR_IO);
+
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	int numTracks;
+	uint16_t division;
+	TRY(find_tracks(data, size, &tracks, &numTracks, &division));
+
+	TRY(al_malloc(&import, sizeof(Import)));
+	memset(import, 0, sizeof(Import));
+	import->numPatches = numPatches;
+
+	TRY(read_tempo_map(import, tracks, numTracks, division));
+
+	for (int i = 0; i < numTracks; i++) {
+		TRY(read_track(import, tracks[i]));
+	}
+
+	TRY(hm_seq_set_tempos(seq, import->tempos, import->numTempos));
+	TRY(hm_seq_add_notes(seq, import->notes, import->numNotes));
+	TRY(hm_seq_add_events(seq, import->events, import->numEvents));
+
+	PASS(
+		if (import) {
+			free(import->tempos);
+			free(import->notes);
+			free(import->links);
+			free(import->events);
+			free(import);
+		}
+		free(tracks);
+		if (data != MAP_FAILED) {
+			munmap(data, size);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+	)
+}
+
+static uint8_t *put_u16(uint8_t *pos, uint16_t value)
+{
+	*pos++ = value >> 8;
+	*pos++ = value;
+
+	return pos;
+}
+
+static uint8_t *put_u32(uint8_t *pos, uint32_t value)
+{
+	pos = put_u16(pos, value >> 16);
+	return put_u16(pos, value);
+}
+
+static uint8_t *put_varlen(uint8_t *pos, uint32_t value)
+{
+	uint8_t bytes[5];
+	int n = 0;
+
+	do {
+		bytes[n++] = value & 0x7F;
+		value >>= 7;
+	} while (value);
+
+	while (n > 1) {
+		*pos++ = bytes[--n] | 0x80;
+	}
+	*pos++ = bytes[0];
+
+	return pos;
+}
+
+static uint8_t *put_tempo(uint8_t *pos, uint32_t delta, float bpm)
+{
+	uint32_t tempo = lroundf(60000000.0f / bpm);
+
+	pos = put_varlen(pos, delta);
+	*pos++ = 0xFF;
+	*pos++ = 0x51;
+	*pos++ = 0x03;
+	*pos++ = tempo >> 16;
+	*pos++ = tempo >> 8;
+	*pos++ = tempo;
+
+	return pos;
+}
+
+static int to_midi(float value, int min, int max)
+{
+	long result = lroundf(value * max);
+
+	return (result < min) ? min : (result > max) ? max : result;
+}
+
+AlError hm_smf_export(HmSeq *seq, const char *path)
+{
+	BEGIN()
+
+	HmEvent *events = NULL;
+	int numEvents = 0;
+	uint8_t *track = NULL;
+	FILE *file = NULL;
+
+	int numTempos;
+	const HmTempo *tempos = hm_seq_get_tempos(seq, &numTempos);
+
+	TRY(hm_seq_flatten(seq, &events, &numEvents));
+	TRY(al_malloc(&track, HEADER_SIZE + CHUNK_HEADER_SIZE +
+		MAX_EVENT_SIZE * (size_t)(numEvents + 1) + TEMPO_EVENT_SIZE * (size_t)numTempos));
+
+	uint8_t *start = track + HEADER_SIZE + CHUNK_HEADER_SIZE;
+	uint8_t *pos = start;
+
+	uint32_t lastTime = 0;
+	uint8_t runningStatus = 0;
+	int tempo = 0;
+
+	for (int i = 0; i < numEvents; i++) {
+		const HmEvent *event = &events[i];
+		uint8_t status, data[2] = {0, 0};
+		int size = 2;
+
+		/* Meta events cancel running status */
+		for (; tempo < numTempos && tempos[tempo].time <= event->time; tempo++) {
+			pos = put_tempo(pos, tempos[tempo].time - lastTime, tempos[tempo].bpm);
+			lastTime = tempos[tempo].time;
+			runningStatus = 0;
+		}
+
+		if (event->channel < 0 || event->channel >= NUM_MIDI_CHANNELS)
+			continue;
+
+		switch (event->type) {
+			case HM_EV_NOTE_ON:
+			case HM_EV_NOTE_OFF:
+				if (event->data.note.num < 0 || event->data.note.num >= NUM_KEYS)
+					continue;
+
+				status = (event->type == HM_EV_NOTE_ON) ? 0x90 : 0x80;
+				data[0] = event->data.note.num;
+				data[1] = (event->type == HM_EV_NOTE_ON) ? to_midi(event->data.note.velocity, 1, 127) : 0;
+				break;
+
+			case HM_EV_PITCH: {
+				long value = lroundf((event->data.pitch + 1.0f) * 8192.0f);
+				value = (value < 0) ? 0 : (value > 16383) ? 16383 : value;
+
+				status = 0xE0;
+				data[0] = value & 0x7F;
+				data[1] = value >> 7;
+				break;
+			}
+
+			case HM_EV_CONTROL:
+				if (event->data.control.num < 0 || event->data.control.num > 127)
+					continue;
+
+				status = 0xB0;
+				data[0] = event->data.control.num;
+				data[1] = to_midi(event->data.control.value, 0, 127);
+				break;
+
+			case HM_EV_PATCH:
+				if (event->data.patch < 0 || event->data.patch > 127)
+					continue;
+
+				status = 0xC0;
+				data[0] = event->data.patch;
+				size = 1;
+				break;
+
+			default:
+				continue;
+		}
+
+		pos = put_varlen(pos, event->time - lastTime);
+		lastTime = event->time;
+
+		status |= event->channel;
+		if (status != runningStatus) {
+			*pos++ = status;
+			runningStatus = status;
+		}
+
+		memcpy(pos, data, size);
+		pos += size;
+	}
+
+	for (; tempo < numTempos; tempo++) {
+		pos = put_tempo(pos, tempos[tempo].time - lastTime, tempos[tempo].bpm);
+		lastTime = tempos[tempo].time;
+	}
+
+	pos = put_varlen(pos, 0);
+	*pos++ = 0xFF;
+	*pos++ = 0x2F;
+	*pos++ = 0x00;
+
+	uint8_t *header = track;
+	memcpy(header, "MThd", 4);
+	header = put_u32(header + 4, 6);
+	header = put_u16(header, 0);
+	header = put_u16(header, 1);
+	header = put_u16(header, HM_SEQ_PPQ);
+	memcpy(header, "MTrk", 4);
+	put_u32(header + 4, pos - start);
+
+	file = fopen(path, "wb");
+	if (!file)
+		THROW(AL_ERROR_IO);
+
+	size_t size = pos - track;
+	if (fwrite(track, 1, size, file) != size)
+		THROW(AL_ERROR_IO);
+
+	int closed = fclose(file);
+	file = NULL;
+	if (closed != 0)
+		THROW(AL_ERROR_IO);
+
+	CATCH(
+		if (file) {
+			fclose(file);
+		}
+	)
+	FINALLY(
+		free(events);
+		free(track);
+	)
+}
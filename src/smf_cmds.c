@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "smf_cmds.h"
+#include "hamilton/band.h"
+#include "hamilton/smf.h"
+
+int cmd_import_midi(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	const char *path = luaL_checkstring(L, 1);
+
+	int numPatches[16];
+	for (int i = 0; i < 16; i++) {
+		numPatches[i] = hm_band_get_channel_num_patches(band, i);
+	}
+
+	TRY(hm_smf_import(hm_band_get_seq(band), path, numPatches));
+
+	CATCH_LUA(, "error importing MIDI file")
+	FINALLY_LUA(, 0)
+}
+
+int cmd_export_midi(lua_State *L)
+{
+	BEGIN()
+
+	HmBand *band = lua_touserdata(L, lua_upvalueindex(1));
+	const char *path = luaL_checkstring(L, 1);
+
+	TRY(hm_smf_export(hm_band_get_seq(band), path));
+
+	CATCH_LUA(, "error exporting MIDI file")
+	FINALLY_LUA(, 0)
+}
@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#ifndef _HAMILTON_SMF_CMDS_H
+#define _HAMILTON_SMF_CMDS_H
+
+#include "albase/lua.h"
+
+int cmd_import_midi(lua_State *L);
+int cmd_export_midi(lua_State *L);
+
+#endif
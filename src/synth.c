@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "hamilton/synth.h"
+
+static void send_event(HmSynth *synth, const HmEvent *event)
+{
+	switch (event->type) {
+		case HM_EV_NOTE_OFF:
+			if (synth->stopNote) {
+				synth->stopNote(synth, event->data.note.num);
+			}
+			break;
+
+		case HM_EV_NOTE_ON:
+			if (synth->startNote) {
+				synth->startNote(synth, event->data.note.num, event->data.note.velocity);
+			}
+			break;
+
+		case HM_EV_PITCH:
+			if (synth->setPitch) {
+				synth->setPitch(synth, event->data.pitch);
+			}
+			break;
+
+		case HM_EV_CONTROL:
+			if (synth->setControl) {
+				synth->setControl(synth, event->data.control.num, event->data.control.value);
+			}
+			break;
+
+		case HM_EV_PARAM:
+			if (synth->setParam) {
+				synth->setParam(synth, event->data.param.num, event->data.param.value);
+			}
+			break;
+
+		case HM_EV_PATCH:
+			if (synth->setPatch) {
+				synth->setPatch(synth, event->data.patch);
+			}
+			break;
+	}
+}
+
+void hm_synth_process(HmSynth *synth, const HmEvent *events, int numEvents, float *buffer, int length)
+{
+	if (synth->version >= HM_SYNTH_ABI_PROCESS && synth->process) {
+		synth->process(synth, events, numEvents, buffer, length);
+		return;
+	}
+
+	int done = 0;
+	for (int i = 0; i < numEvents; i++) {
+		int time = (events[i].time < (uint32_t)length) ? (int)events[i].time : length;
+
+		if (time > done) {
+			synth->generate(synth, buffer + done, time - done);
+			done = time;
+		}
+
+		send_event(synth, &events[i]);
+	}
+
+	if (length > done) {
+		synth->generate(synth, buffer + done, length - done);
+	}
+}
@@ -13,18 +13,32 @@ hm.add_note(1, 01900, 2100, 64, 0.5)
 hm.add_note(1, 02000, 2000, 60, 0.5)
 
 hm.add_set_patch(2, 0, 32)
-hm.add_note(2, 00000, 200, 65, 0.7)
-hm.add_note(2, 00500, 200, 58, 0.7)
-hm.add_note(2, 01000, 200, 58, 0.7)
-hm.add_note(2, 01500, 200, 58, 0.7)
-
-hm.add_note(2, 02000, 200, 62, 0.7)
-hm.add_note(2, 02500, 200, 58, 0.7)
-hm.add_note(2, 03000, 200, 58, 0.7)
-hm.add_note(2, 03500, 200, 58, 0.7)
+hm.add_notes({
+	2, 00000, 200, 65, 0.7,
+	2, 00500, 200, 58, 0.7,
+	2, 01000, 200, 58, 0.7,
+	2, 01500, 200, 58, 0.7,
+
+	2, 02000, 200, 62, 0.7,
+	2, 02500, 200, 58, 0.7,
+	2, 03000, 200, 58, 0.7,
+	2, 03500, 200, 58, 0.7
+})
+
+-- A dense window past the loop: every event must be read back, however
+-- small the batches playback reads them in
+for i = 0, 99 do
+	hm.add_note(3, 08000, 10, i, 0.5)
+	hm.add_note(3, 08001, 10, i, 0.5)
+end
 
 hm.seq_commit()
 
+for _, batch in ipairs({1, 7, 128}) do
+	local count = hm.count_seq_events(08000, 08100, batch)
+	assert(count == 400, 'dense window gave ' .. count .. ' of 400 events')
+end
+
 hm.set_loop(00000, 04000)
 hm.set_looping(true)
 
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2013 James Deery
+ * Released under the MIT license <http://opensource.org/licenses/MIT>.
+ * See COPYING for details.
+ */
+
+#include "hamilton/voices.h"
+
+/*
+ * Sounding voices are either held by a note or releasing. Each is on the
+ * list for its state, oldest first, and held voices are also chained from
+ * the note holding them. Voices held by the sustain pedal are chained from
+ * SUSTAINED.
+ */
+enum {
+	HELD,
+	RELEASING
+};
+
+#define SUSTAINED HM_VOICE_NOTES
+
+static void unlink_voice(HmVoices *voices, int voice)
+{
+	int list = voices->list[voice];
+	int prev = voices->prev[voice];
+	int next = voices->next[voice];
+
+	if (prev >= 0) {
+		voices->next[prev] = next;
+	} else {
+		voices->first[list] = next;
+	}
+
+	if (next >= 0) {
+		voices->prev[next] = prev;
+	} else {
+		voices->last[list] = prev;
+	}
+
+	if (list == HELD) {
+		int *link = &voices->noteVoices[voices->note[voice]];
+		while (*link != voice) {
+			link = &voices->nextSameNote[*link];
+		}
+		*link = voices->nextSameNote[voice];
+	}
+
+	voices->list[voice] = -1;
+}
+
+static void link_voice(HmVoices *voices, int voice, int list)
+{
+	int last = voices->last[list];
+
+	voices->list[voice] = list;
+	voices->prev[voice] = last;
+	voices->next[voice] = -1;
+
+	if (last >= 0) {
+		voices->next[last] = voice;
+	} else {
+		voices->first[list] = voice;
+	}
+	voices->last[list] = voice;
+
+	if (list == HELD) {
+		voices->nextSameNote[voice] = voices->noteVoices[voices->note[voice]];
+		voices->noteVoices[voices->note[voice]] = voice;
+	}
+}
+
+/* Renumbers a voice, fixing up everything that refers to it */
+static void renumber_voice(HmVoices *voices, int from, int to)
+{
+	int list = voices->list[from];
+	int prev = voices->prev[from];
+	int next = voices->next[from];
+
+	voices->note[to] = voices->note[from];
+	voices->list[to] = list;
+	voices->prev[to] = prev;
+	voices->next[to] = next;
+	voices->nextSameNote[to] = voices->nextSameNote[from];
+
+	if (prev >= 0) {
+		voices->next[prev] = to;
+	} else {
+		voices->first[list] = to;
+	}
+
+	if (next >= 0) {
+		voices->prev[next] = to;
+	} else {
+		voices->last[list] = to;
+	}
+
+	if (list == HELD) {
+		int *link = &voices->noteVoices[voices->note[from]];
+		while (*link != from) {
+			link = &voices->nextSameNote[*link];
+		}
+		*link = to;
+	}
+
+	voices->list[from] = -1;
+}
+
+void hm_voices_init(HmVoices *voices, int numVoices, void (*move)(void *synth, int from, int to), void (*release)(void *synth, int voice), void *synth)
+{
+	voices->numVoices = 1;
+	voices->numActive = 0;
+	voices->sustain = false;
+	voices->move = move;
+	voices->release = release;
+	voices->synth = synth;
+
+	for (int i = 0; i < HM_MAX_VOICES; i++) {
+		voices->list[i] = -1;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		voices->first[i] = -1;
+		voices->last[i] = -1;
+	}
+
+	for (int i = 0; i <= HM_VOICE_NOTES; i++) {
+		voices->noteVoices[i] = -1;
+	}
+
+	hm_voices_set_polyphony(voices, numVoices);
+}
+
+static int oldest_voice(HmVoices *voices)
+{
+	return (voices->first[RELEASING] >= 0) ? voices->first[RELEASING] : voices->first[HELD];
+}
+
+void hm_voices_set_polyphony(HmVoices *voices, int numVoices)
+{
+	if (numVoices < 1) numVoices = 1;
+	if (numVoices > HM_MAX_VOICES) numVoices = HM_MAX_VOICES;
+
+	while (voices->numActive > numVoices) {
+		hm_voices_free(voices, oldest_voice(voices));
+	}
+
+	voices->numVoices = numVoices;
+}
+
+int hm_voices_start(HmVoices *voices, int note)
+{
+	if (note < 0 || note >= HM_VOICE_NOTES)
+		return -1;
+
+	int voice;
+	if (voices->numActive < voices->numVoices) {
+		voice = voices->numActive++;
+	} else {
+		voice = oldest_voice(voices);
+		unlink_voice(voices, voice);
+	}
+
+	voices->note[voice] = note;
+	link_voice(voices, voice, HELD);
+
+	return voice;
+}
+
+static void release_note(HmVoices *voices, int note)
+{
+	int voice;
+	while ((voice = voices->noteVoices[note]) >= 0) {
+		unlink_voice(voices, voice);
+		link_voice(voices, voice, RELEASING);
+		voices->release(voices->synth, voice);
+	}
+}
+
+void hm_voices_stop(HmVoices *voices, int note)
+{
+	if (note < 0 || note >= HM_VOICE_NOTES)
+		return;
+
+	if (!voices->sustain) {
+		release_note(voices, note);
+		return;
+	}
+
+	int voice;
+	while ((voice = voices->noteVoices[note]) >= 0) {
+		unlink_voice(voices, voice);
+		voices->note[voice] = SUSTAINED;
+		link_voice(voices, voice, HELD);
+	}
+}
+
+void hm_voices_set_sustain(HmVoices *voices, bool sustain)
+{
+	voices->sustain = sustain;
+
+	if (!sustain) {
+		release_note(voices, SUSTAINED);
+	}
+}
+
+void hm_voices_free(HmVoices *voices, int voice)
+{
+	if (voice < 0 || voice >= voices->numActive)
+		return;
+
+	unlink_voice(voices, voice);
+
+	int last = --voices->numActive;
+	if (voice != last) {
+		renumber_voice(voices, last, voice);
+		voices->move(voices->synth, last, voice);
+	}
+}